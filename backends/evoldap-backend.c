@@ -52,6 +52,25 @@ typedef struct
 
   LDAP *connection;
 
+  /* Search started by prepare_read(), and who is waiting for it */
+  int     search_msgid;
+  guint   search_watch;
+  GSList *waiters;
+
+  /* When the last search failed, to not block on the server again
+   * right away
+   */
+  time_t  failed_at;
+
+  /* Values older than cache_ttl seconds are still answered with,
+   * but refreshed in the background; 0 keeps them forever
+   */
+  int     cache_ttl;
+  time_t  fetched_at;
+
+  GConfSourceNotifyFunc notify_func;
+  gpointer              notify_user_data;
+
   GConfValue *accounts_value;
   GConfValue *addressbook_value;
   GConfValue *calendar_value;
@@ -112,6 +131,22 @@ static gboolean       sync_all        (GConfSource       *source,
 static void           destroy_source  (GConfSource       *source);
 static void           clear_cache     (GConfSource       *source);
 static void           blow_away_locks (const char        *address);
+static void           set_notify_func (GConfSource           *source,
+				       GConfSourceNotifyFunc  notify_func,
+				       gpointer               user_data);
+static gboolean       prepare_read    (GConfSource          *source,
+				       const char           *key,
+				       GConfSourceReadyFunc  ready_func,
+				       gpointer              user_data);
+
+#define LDAP_RETRY_INTERVAL 60 /* seconds */
+#define DEFAULT_CACHE_TTL   3600 /* seconds */
+
+typedef struct
+{
+  GConfSourceReadyFunc ready_func;
+  gpointer             user_data;
+} Waiter;
 
 static GConfBackendVTable evoldap_vtable = {
   sizeof (GConfBackendVTable),
@@ -134,9 +169,13 @@ static GConfBackendVTable evoldap_vtable = {
   destroy_source,
   clear_cache,
   blow_away_locks,
-  NULL, /* set_notify_func */
+  set_notify_func,
   NULL, /* add_listener    */
-  NULL  /* remove_listener */
+  NULL, /* remove_listener */
+  NULL, /* query_values    */
+  NULL, /* set_values      */
+  NULL, /* unset_values    */
+  prepare_read
 };
 
 static void
@@ -163,6 +202,8 @@ resolve_address (const char  *address,
   esource = g_new0 (EvoSource, 1);
 
   esource->conf_file    = conf_file;
+  esource->search_msgid = -1;
+  esource->cache_ttl    = DEFAULT_CACHE_TTL;
   esource->source.flags = GCONF_SOURCE_ALL_READABLE | GCONF_SOURCE_NEVER_WRITEABLE;
 
   gconf_log (GCL_DEBUG,
@@ -493,6 +534,23 @@ parse_conf_file (EvoSource  *esource,
 	{
 	  template = node;
 	}
+      else if (strcmp (node_name, "cache_ttl") == 0)
+	{
+	  xmlChar *ttl_value;
+
+	  if ((ttl_value = xmlNodeGetContent (node)) != NULL)
+	    {
+	      char *end;
+	      long  l;
+
+	      end = NULL;
+	      l = strtol ((char *) ttl_value, &end, 10);
+	      if (end != NULL && end != (char *) ttl_value && *end == '\0' && l >= 0)
+		esource->cache_ttl = (int) l;
+
+	      xmlFree (ttl_value);
+	    }
+	}
 
       node = node->next;
     }
@@ -555,6 +613,41 @@ parse_conf_file (EvoSource  *esource,
   return TRUE;
 }
 
+/* Whether ret means the connection itself is gone, rather than the
+ * server refusing a request
+ */
+static gboolean
+ldap_error_is_transport (int ret)
+{
+  return ret == -1 || ret == LDAP_SERVER_DOWN || ret == LDAP_CONNECT_ERROR;
+}
+
+/* Forgets a connection that is no longer usable, so the next search
+ * makes a new one; abandons a search still in progress on it.
+ */
+static void
+drop_ldap_connection (EvoSource *esource)
+{
+  if (esource->connection == NULL)
+    return;
+
+  if (esource->search_watch != 0)
+    {
+      g_source_remove (esource->search_watch);
+      esource->search_watch = 0;
+    }
+
+  if (esource->search_msgid != -1)
+    {
+      ldap_abandon_ext (esource->connection, esource->search_msgid,
+			NULL, NULL);
+      esource->search_msgid = -1;
+    }
+
+  ldap_unbind_ext (esource->connection, NULL, NULL);
+  esource->connection = NULL;
+}
+
 static LDAP *
 get_ldap_connection (EvoSource  *esource,
 		     GError    **err)
@@ -563,6 +656,9 @@ get_ldap_connection (EvoSource  *esource,
 
   g_assert (esource->conf_file_parsed);
 
+  if (esource->connection != NULL)
+    return esource->connection;
+
   if (esource->ldap_host == NULL || esource->base_dn == NULL)
     {
       g_set_error (err, GCONF_ERROR,
@@ -581,6 +677,7 @@ get_ldap_connection (EvoSource  *esource,
       gconf_log (GCL_ERR,
 		 _("Failed to contact LDAP server: %s"),
 		 g_strerror (errno));
+      esource->failed_at = time (NULL);
       return NULL;
     }
 
@@ -648,6 +745,86 @@ build_value_from_entries (LDAP        *connection,
   return retval;
 }
 
+/* Replaces *value_p with new_value, and tells the database about it
+ * if this is a refresh that changed the value
+ */
+static void
+replace_value (EvoSource   *esource,
+	       GConfValue **value_p,
+	       GConfValue  *new_value,
+	       const char  *key,
+	       gboolean     refresh)
+{
+  gboolean changed;
+
+  if (*value_p == NULL || new_value == NULL)
+    changed = *value_p != new_value;
+  else
+    changed = gconf_value_compare (*value_p, new_value) != 0;
+
+  if (*value_p != NULL)
+    gconf_value_free (*value_p);
+  *value_p = new_value;
+
+  if (changed && refresh && esource->notify_func != NULL)
+    (* esource->notify_func) ((GConfSource *) esource, key,
+			      esource->notify_user_data);
+}
+
+static void
+build_values_from_result (EvoSource   *esource,
+			  LDAP        *connection,
+			  LDAPMessage *entries)
+{
+  gboolean refresh;
+
+  refresh = esource->queried_ldap;
+
+  esource->queried_ldap = TRUE;
+  esource->failed_at = 0;
+  esource->fetched_at = time (NULL);
+
+  gconf_log (GCL_DEBUG,
+	     _("Got %d entries using filter: %s"),
+	     ldap_count_entries (connection, entries),
+	     esource->filter_str);
+
+  replace_value (esource, &esource->accounts_value,
+		 esource->template_account == NULL ? NULL :
+		 build_value_from_entries (connection, entries,
+					   esource->template_account),
+		 "/apps/evolution/mail/accounts",
+		 refresh);
+
+  replace_value (esource, &esource->addressbook_value,
+		 esource->template_addressbook == NULL ? NULL :
+		 build_value_from_entries (connection, entries,
+					   esource->template_addressbook),
+		 "/apps/evolution/addressbook/sources",
+		 refresh);
+
+  replace_value (esource, &esource->calendar_value,
+		 esource->template_calendar == NULL ? NULL :
+		 build_value_from_entries (connection, entries,
+					   esource->template_calendar),
+		 "/apps/evolution/calendar/sources",
+		 refresh);
+
+  replace_value (esource, &esource->tasks_value,
+		 esource->template_tasks == NULL ? NULL :
+		 build_value_from_entries (connection, entries,
+					   esource->template_tasks),
+		 "/apps/evolution/tasks/sources",
+		 refresh);
+}
+
+static gboolean
+ldap_recently_failed (EvoSource *esource)
+{
+  return esource->failed_at != 0 &&
+    time (NULL) - esource->failed_at < LDAP_RETRY_INTERVAL;
+}
+
 static void
 lookup_values_from_ldap (EvoSource   *esource,
 			 GError     **err)
@@ -656,6 +833,9 @@ lookup_values_from_ldap (EvoSource   *esource,
   LDAPMessage *entries;
   int          ret;
 
+  if (ldap_recently_failed (esource))
+    return;
+
   if (!parse_conf_file (esource, err))
     return;
 
@@ -681,55 +861,241 @@ lookup_values_from_ldap (EvoSource   *esource,
       gconf_log (GCL_ERR,
 		 _("Error querying LDAP server: %s"),
 		 ldap_err2string (ret));
+      if (entries != NULL)
+	ldap_msgfree (entries);
+      if (ldap_error_is_transport (ret))
+	drop_ldap_connection (esource);
+      esource->failed_at = time (NULL);
       return;
     }
 
-  esource->queried_ldap = TRUE;
-
   g_assert (entries != NULL);
 
-  gconf_log (GCL_DEBUG,
-	     _("Got %d entries using filter: %s"),
-	     ldap_count_entries (connection, entries),
-	     esource->filter_str);
+  build_values_from_result (esource, connection, entries);
+
+  ldap_msgfree (entries);
+}
+
+static void
+wake_waiters (EvoSource *esource)
+{
+  GSList *waiters;
+  GSList *tmp;
+
+  waiters = esource->waiters;
+  esource->waiters = NULL;
 
-  if (esource->template_account != NULL)
+  for (tmp = waiters; tmp != NULL; tmp = tmp->next)
     {
-      esource->accounts_value = build_value_from_entries (connection,
-							  entries,
-							  esource->template_account);
+      Waiter *waiter = tmp->data;
+
+      (* waiter->ready_func) (waiter->user_data);
+      g_free (waiter);
     }
 
-  if (esource->template_addressbook != NULL)
+  g_slist_free (waiters);
+}
+
+static gboolean
+search_ready (GIOChannel   *channel,
+	      GIOCondition  condition,
+	      gpointer      data)
+{
+  EvoSource      *esource = data;
+  LDAPMessage    *result;
+  struct timeval  timeout = { 0, 0 };
+  int             ret;
+
+  result = NULL;
+  ret = ldap_result (esource->connection, esource->search_msgid,
+		     LDAP_MSG_ALL, &timeout, &result);
+  if (ret == 0)
+    return TRUE; /* not all there yet */
+
+  esource->search_msgid = -1;
+  esource->search_watch = 0;
+
+  if (ret == -1)
     {
-      esource->addressbook_value = build_value_from_entries (connection,
-							     entries,
-							     esource->template_addressbook);
+      ldap_get_option (esource->connection, LDAP_OPT_ERROR_NUMBER, &ret);
+      gconf_log (GCL_ERR,
+		 _("Error querying LDAP server: %s"),
+		 ldap_err2string (ret));
+      /* Whatever the error number, the connection can't be trusted */
+      drop_ldap_connection (esource);
+      esource->failed_at = time (NULL);
     }
+  else if (ldap_parse_result (esource->connection, result, &ret,
+			      NULL, NULL, NULL, NULL, 0) != LDAP_SUCCESS ||
+	   ret != LDAP_SUCCESS)
+    {
+      gconf_log (GCL_ERR,
+		 _("Error querying LDAP server: %s"),
+		 ldap_err2string (ret));
+      if (ldap_error_is_transport (ret))
+	drop_ldap_connection (esource);
+      esource->failed_at = time (NULL);
+    }
+  else
+    {
+      build_values_from_result (esource, esource->connection, result);
+    }
+
+  if (result != NULL)
+    ldap_msgfree (result);
+
+  wake_waiters (esource);
+
+  return FALSE;
+}
 
-  if (esource->template_calendar != NULL)
+/* Starts the search without waiting for the server; returns FALSE
+ * if that isn't possible, reading then doesn't block either.
+ */
+static gboolean
+start_ldap_search (EvoSource *esource)
+{
+  GError     *error;
+  LDAP       *connection;
+  GIOChannel *channel;
+  int         ret;
+  int         fd;
+
+  error = NULL;
+  if (!parse_conf_file (esource, &error))
     {
-      esource->calendar_value = build_value_from_entries (connection,
-							  entries,
-							  esource->template_calendar);
+      g_error_free (error);
+      return FALSE;
     }
 
-  if (esource->template_tasks != NULL)
+  if (esource->filter_str == NULL)
+    return FALSE;
+
+  error = NULL;
+  if ((connection = get_ldap_connection (esource, &error)) == NULL)
     {
-      esource->tasks_value = build_value_from_entries (connection,
-						       entries,
-						       esource->template_tasks);
+      if (error != NULL)
+	g_error_free (error);
+      return FALSE;
     }
 
-  ldap_msgfree (entries);
+  gconf_log (GCL_DEBUG,
+	     _("Searching for entries using filter: %s"),
+	     esource->filter_str);
+
+  ret = ldap_search_ext (connection,
+			 esource->base_dn,
+			 LDAP_SCOPE_ONELEVEL,
+			 esource->filter_str,
+			 NULL, 0,
+			 NULL, NULL, NULL, 0,
+			 &esource->search_msgid);
+  if (ret != LDAP_SUCCESS)
+    {
+      gconf_log (GCL_ERR,
+		 _("Error querying LDAP server: %s"),
+		 ldap_err2string (ret));
+      esource->search_msgid = -1;
+      if (ldap_error_is_transport (ret))
+	drop_ldap_connection (esource);
+      esource->failed_at = time (NULL);
+      return FALSE;
+    }
+
+  fd = -1;
+  if (ldap_get_option (connection, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS ||
+      fd < 0)
+    {
+      /* No socket to wait on, so the connection is no good to us */
+      drop_ldap_connection (esource);
+      esource->failed_at = time (NULL);
+      return FALSE;
+    }
+
+  channel = g_io_channel_unix_new (fd);
+  esource->search_watch = g_io_add_watch (channel,
+					  G_IO_IN | G_IO_HUP | G_IO_ERR,
+					  search_ready,
+					  esource);
+  g_io_channel_unref (channel);
+
+  return TRUE;
+}
+
+static gboolean
+values_are_stale (EvoSource *esource)
+{
+  return esource->queried_ldap &&
+    esource->cache_ttl > 0 &&
+    time (NULL) - esource->fetched_at >= esource->cache_ttl;
+}
+
+/* Fetches the values if we never did, and starts refreshing them in
+ * the background if they are old; callers answer with what we have
+ * meanwhile.
+ */
+static void
+ensure_values (EvoSource  *esource,
+	       GError    **err)
+{
+  if (!esource->queried_ldap)
+    lookup_values_from_ldap (esource, err);
+  else if (values_are_stale (esource) &&
+	   esource->search_msgid == -1 &&
+	   !ldap_recently_failed (esource))
+    start_ldap_search (esource);
+}
+
+static gboolean
+prepare_read (GConfSource          *source,
+	      const char           *key,
+	      GConfSourceReadyFunc  ready_func,
+	      gpointer              user_data)
+{
+  EvoSource *esource = (EvoSource *) source;
+  Waiter    *waiter;
+
+  /* Everything we answer comes from the search */
+  if (strncmp (key, "/apps/evolution/", 16) != 0)
+    return TRUE;
+
+  if (esource->queried_ldap)
+    {
+      ensure_values (esource, NULL);
+      return TRUE;
+    }
+
+  if (ldap_recently_failed (esource))
+    return TRUE;
+
+  if (esource->search_msgid == -1 && !start_ldap_search (esource))
+    return TRUE;
+
+  waiter = g_new (Waiter, 1);
+  waiter->ready_func = ready_func;
+  waiter->user_data  = user_data;
+
+  esource->waiters = g_slist_prepend (esource->waiters, waiter);
+
+  return FALSE;
+}
+
+static gboolean
+wake_waiter_idle (gpointer data)
+{
+  Waiter *waiter = data;
+
+  (* waiter->ready_func) (waiter->user_data);
+  g_free (waiter);
+
+  return FALSE;
 }
 
 static inline GConfValue *
 query_accounts_value (EvoSource  *esource,
 		      GError    **err)
 {
-  if (!esource->queried_ldap)
-    lookup_values_from_ldap (esource, err);
+  ensure_values (esource, err);
 
   return esource->accounts_value ? gconf_value_copy (esource->accounts_value) : NULL;
 }
@@ -738,8 +1104,7 @@ static inline GConfValue *
 query_addressbook_value (EvoSource  *esource,
 			 GError    **err)
 {
-  if (!esource->queried_ldap)
-    lookup_values_from_ldap (esource, err);
+  ensure_values (esource, err);
 
   return esource->addressbook_value ? gconf_value_copy (esource->addressbook_value) : NULL;
 }
@@ -748,8 +1113,7 @@ static inline GConfValue *
 query_calendar_value (EvoSource  *esource,
 		      GError    **err)
 {
-  if (!esource->queried_ldap)
-    lookup_values_from_ldap (esource, err);
+  ensure_values (esource, err);
 
   return esource->calendar_value ? gconf_value_copy (esource->calendar_value) : NULL;
 }
@@ -758,8 +1122,7 @@ static inline GConfValue *
 query_tasks_value (EvoSource  *esource,
 		   GError    **err)
 {
-  if (!esource->queried_ldap)
-    lookup_values_from_ldap (esource, err);
+  ensure_values (esource, err);
 
   return esource->tasks_value ? gconf_value_copy (esource->tasks_value) : NULL;
 }
@@ -801,7 +1164,7 @@ query_value (GConfSource  *source,
       retval = query_tasks_value (esource, err);
     }
 
-  return retval != NULL ? gconf_value_copy (retval) : NULL;
+  return retval;
 }
 
 static GConfMetaInfo *
@@ -858,7 +1221,7 @@ all_entries (GConfSource  *source,
       key = "/apps/evolution/tasks/sources";
     }
 
-  return value ? g_slist_append (NULL, gconf_entry_new (key, value)) : NULL;
+  return value ? g_slist_append (NULL, gconf_entry_new_nocopy (g_strdup (key), value)) : NULL;
 }
 
 static GSList *
@@ -964,8 +1327,14 @@ static void
 destroy_source (GConfSource *source)
 {
   EvoSource *esource = (EvoSource *) source;
+  GSList    *tmp;
 
-  esource->connection = NULL;
+  drop_ldap_connection (esource);
+
+  /* Don't leave anyone waiting, but call them once we're gone */
+  for (tmp = esource->waiters; tmp != NULL; tmp = tmp->next)
+    g_idle_add (wake_waiter_idle, tmp->data);
+  g_slist_free (esource->waiters);
 
   if (esource->accounts_value != NULL)
     gconf_value_free (esource->accounts_value);
@@ -1014,6 +1383,22 @@ destroy_source (GConfSource *source)
 static void
 clear_cache (GConfSource *source)
 {
+  EvoSource *esource = (EvoSource *) source;
+
+  /* Fetch everything again on the next read */
+  esource->queried_ldap = FALSE;
+  esource->failed_at    = 0;
+}
+
+static void
+set_notify_func (GConfSource           *source,
+		 GConfSourceNotifyFunc  notify_func,
+		 gpointer               user_data)
+{
+  EvoSource *esource = (EvoSource *) source;
+
+  esource->notify_func      = notify_func;
+  esource->notify_user_data = user_data;
 }
 
 static void
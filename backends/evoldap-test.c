@@ -0,0 +1,527 @@
+/* GConf
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Runs the evoldap backend against a fake LDAP library and a fake
+ * clock, to check that values are refreshed once their TTL expires,
+ * that changes found by a refresh are notified, and that a broken
+ * connection is dropped and replaced.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <ldap.h>
+
+#include <gconf/gconf-backend.h>
+#include <gconf/gconf-internals.h>
+
+#define ACCOUNTS_KEY "/apps/evolution/mail/accounts"
+
+#define CACHE_TTL 10
+/* Has to outlast LDAP_RETRY_INTERVAL in evoldap-backend.c */
+#define RETRY_WAIT 61
+
+GConfBackendVTable *gconf_backend_get_vtable (void);
+
+static void
+check (gboolean condition, const char *fmt, ...)
+{
+  va_list  args;
+  char    *description;
+
+  va_start (args, fmt);
+  description = g_strdup_vprintf (fmt, args);
+  va_end (args);
+
+  if (condition)
+    {
+      printf (".");
+      fflush (stdout);
+    }
+  else
+    {
+      fprintf (stderr, "\n*** FAILED: %s\n", description);
+      exit (1);
+    }
+
+  g_free (description);
+}
+
+/*
+ * The fake clock; the backend only uses time() to decide when values
+ * are stale and when to retry the server.
+ */
+static time_t fake_now = 1000000;
+
+time_t
+time (time_t *t)
+{
+  if (t != NULL)
+    *t = fake_now;
+  return fake_now;
+}
+
+/*
+ * The fake LDAP library. There is one server holding a single entry
+ * whose "mail" attribute is server_mail. Asynchronous results are
+ * signalled by writing to a pipe that stands in for the socket.
+ */
+struct ldap
+{
+  int pipe_fds[2];
+  int pending_msgid;
+  int error_number;
+};
+
+struct ldapmsg
+{
+  char           *mail;
+  struct ldapmsg *entry;
+};
+
+static const char *server_mail = "first@example.com";
+static gboolean    server_down = FALSE;
+
+static int n_connections_made = 0;
+static int n_connections_open = 0;
+static int n_searches = 0;
+static int next_msgid = 1;
+
+LDAP *
+ldap_init (const char *host, int port)
+{
+  LDAP *ld;
+
+  ld = g_new0 (LDAP, 1);
+  if (pipe (ld->pipe_fds) < 0)
+    {
+      g_free (ld);
+      return NULL;
+    }
+  ld->pending_msgid = -1;
+
+  n_connections_made += 1;
+  n_connections_open += 1;
+
+  return ld;
+}
+
+int
+ldap_unbind_ext (LDAP *ld, LDAPControl **sctrls, LDAPControl **cctrls)
+{
+  close (ld->pipe_fds[0]);
+  close (ld->pipe_fds[1]);
+  g_free (ld);
+
+  n_connections_open -= 1;
+
+  return LDAP_SUCCESS;
+}
+
+static LDAPMessage *
+make_result (void)
+{
+  LDAPMessage *result;
+
+  result = g_new0 (LDAPMessage, 1);
+  result->entry = g_new0 (LDAPMessage, 1);
+  result->entry->mail = g_strdup (server_mail);
+
+  return result;
+}
+
+int
+ldap_msgfree (LDAPMessage *msg)
+{
+  if (msg->entry != NULL)
+    ldap_msgfree (msg->entry);
+  g_free (msg->mail);
+  g_free (msg);
+
+  return 0;
+}
+
+int
+ldap_search_s (LDAP         *ld,
+	       const char   *base,
+	       int           scope,
+	       const char   *filter,
+	       char        **attrs,
+	       int           attrsonly,
+	       LDAPMessage **res)
+{
+  n_searches += 1;
+
+  *res = NULL;
+  if (server_down)
+    return LDAP_SERVER_DOWN;
+
+  *res = make_result ();
+
+  return LDAP_SUCCESS;
+}
+
+int
+ldap_search_ext (LDAP       *ld,
+		 const char *base,
+		 int         scope,
+		 const char *filter,
+		 char      **attrs,
+		 int         attrsonly,
+		 LDAPControl **sctrls,
+		 LDAPControl **cctrls,
+		 struct timeval *timeout,
+		 int         sizelimit,
+		 int        *msgidp)
+{
+  n_searches += 1;
+
+  ld->pending_msgid = next_msgid++;
+  *msgidp = ld->pending_msgid;
+
+  /* The answer, or the hangup, is there right away */
+  if (write (ld->pipe_fds[1], "x", 1) != 1)
+    return LDAP_SERVER_DOWN;
+
+  return LDAP_SUCCESS;
+}
+
+int
+ldap_result (LDAP            *ld,
+	     int              msgid,
+	     int              all,
+	     struct timeval  *timeout,
+	     LDAPMessage    **result)
+{
+  char c;
+
+  *result = NULL;
+
+  if (msgid != ld->pending_msgid)
+    return 0;
+
+  if (read (ld->pipe_fds[0], &c, 1) != 1)
+    return 0;
+
+  ld->pending_msgid = -1;
+
+  if (server_down)
+    {
+      ld->error_number = LDAP_SERVER_DOWN;
+      return -1;
+    }
+
+  *result = make_result ();
+
+  return LDAP_RES_SEARCH_RESULT;
+}
+
+int
+ldap_abandon_ext (LDAP *ld, int msgid, LDAPControl **sctrls,
+		  LDAPControl **cctrls)
+{
+  ld->pending_msgid = -1;
+
+  return LDAP_SUCCESS;
+}
+
+int
+ldap_parse_result (LDAP         *ld,
+		   LDAPMessage  *res,
+		   int          *errcodep,
+		   char        **matcheddnp,
+		   char        **errmsgp,
+		   char       ***referralsp,
+		   LDAPControl ***sctrls,
+		   int           freeit)
+{
+  *errcodep = LDAP_SUCCESS;
+
+  return LDAP_SUCCESS;
+}
+
+int
+ldap_get_option (LDAP *ld, int option, void *outvalue)
+{
+  switch (option)
+    {
+    case LDAP_OPT_DESC:
+      *(int *) outvalue = ld->pipe_fds[0];
+      return LDAP_OPT_SUCCESS;
+    case LDAP_OPT_ERROR_NUMBER:
+      *(int *) outvalue = ld->error_number;
+      return LDAP_OPT_SUCCESS;
+    default:
+      return -1;
+    }
+}
+
+char *
+ldap_err2string (int err)
+{
+  return err == LDAP_SUCCESS ? "Success" : "Can't contact LDAP server";
+}
+
+int
+ldap_count_entries (LDAP *ld, LDAPMessage *res)
+{
+  return res->entry != NULL ? 1 : 0;
+}
+
+LDAPMessage *
+ldap_first_entry (LDAP *ld, LDAPMessage *res)
+{
+  return res->entry;
+}
+
+LDAPMessage *
+ldap_next_entry (LDAP *ld, LDAPMessage *entry)
+{
+  return NULL;
+}
+
+char *
+ldap_first_attribute (LDAP *ld, LDAPMessage *entry, BerElement **berptr)
+{
+  *berptr = NULL;
+
+  return "mail";
+}
+
+char *
+ldap_next_attribute (LDAP *ld, LDAPMessage *entry, BerElement *ber)
+{
+  return NULL;
+}
+
+char **
+ldap_get_values (LDAP *ld, LDAPMessage *entry, const char *attr)
+{
+  char **values;
+
+  if (strcmp (attr, "mail") != 0)
+    return NULL;
+
+  values = g_new0 (char *, 2);
+  values[0] = g_strdup (entry->mail);
+
+  return values;
+}
+
+void
+ldap_value_free (char **values)
+{
+  g_strfreev (values);
+}
+
+void
+ber_free (BerElement *ber, int freebuf)
+{
+}
+
+/*
+ * The tests
+ */
+static int n_notifies = 0;
+
+static void
+notify_func (GConfSource *source,
+	     const gchar *location,
+	     gpointer     user_data)
+{
+  check (strcmp (location, ACCOUNTS_KEY) == 0,
+	 "notified about %s rather than " ACCOUNTS_KEY, location);
+
+  n_notifies += 1;
+}
+
+static void
+run_pending (void)
+{
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+}
+
+static char *
+write_conf_file (void)
+{
+  GError *error;
+  char   *filename;
+  char   *contents;
+  int     fd;
+
+  error = NULL;
+  fd = g_file_open_tmp ("evoldap-test-XXXXXX", &filename, &error);
+  check (fd >= 0, "creating the config file: %s",
+	 error ? error->message : "");
+  close (fd);
+
+  contents = g_strdup_printf ("<evoldap>\n"
+			      "  <server>\n"
+			      "    <host>ldap.example.com</host>\n"
+			      "    <base_dn>dc=example,dc=com</base_dn>\n"
+			      "  </server>\n"
+			      "  <cache_ttl>%d</cache_ttl>\n"
+			      "  <template filter=\"(uid=$(USER))\">\n"
+			      "    <account_template>\n"
+			      "      <account name=\"$(LDAP_ATTR_mail)\"/>\n"
+			      "    </account_template>\n"
+			      "  </template>\n"
+			      "</evoldap>\n",
+			      CACHE_TTL);
+
+  check (g_file_set_contents (filename, contents, -1, &error),
+	 "writing the config file: %s", error ? error->message : "");
+
+  g_free (contents);
+
+  return filename;
+}
+
+/* Checks that the one account in the value has the given address */
+static void
+check_account (GConfBackendVTable *vtable,
+	       GConfSource        *source,
+	       const char         *mail)
+{
+  GConfValue *value;
+  GError     *error;
+  GSList     *list;
+
+  error = NULL;
+  value = (* vtable->query_value) (source, ACCOUNTS_KEY, NULL, NULL, &error);
+
+  check (error == NULL, "querying " ACCOUNTS_KEY ": %s",
+	 error ? error->message : "");
+  check (value != NULL && value->type == GCONF_VALUE_LIST,
+	 ACCOUNTS_KEY " isn't a list");
+
+  list = gconf_value_get_list (value);
+  check (g_slist_length (list) == 1,
+	 ACCOUNTS_KEY " has %d accounts rather than 1", g_slist_length (list));
+  check (strstr (gconf_value_get_string (list->data), mail) != NULL,
+	 "account is %s, expected %s",
+	 gconf_value_get_string (list->data), mail);
+
+  gconf_value_free (value);
+}
+
+int
+main (int argc, char **argv)
+{
+  GConfBackendVTable *vtable;
+  GConfSource        *source;
+  GError             *error;
+  char               *conf_file;
+  char               *address;
+
+  conf_file = write_conf_file ();
+  address = g_strconcat ("evoldap:readonly:", conf_file, NULL);
+
+  vtable = gconf_backend_get_vtable ();
+
+  error = NULL;
+  source = (* vtable->resolve_address) (address, &error);
+  check (source != NULL, "resolving %s: %s", address,
+	 error ? error->message : "");
+
+  (* vtable->set_notify_func) (source, notify_func, NULL);
+
+  printf ("\nChecking the first lookup:");
+
+  check_account (vtable, source, "first@example.com");
+  check (n_searches == 1, "%d searches for the first lookup", n_searches);
+  check (n_notifies == 0, "the first lookup was notified");
+
+  printf ("\nChecking TTL expiry:");
+
+  server_mail = "second@example.com";
+
+  /* Still fresh, so nobody asks the server */
+  fake_now += CACHE_TTL - 1;
+  check_account (vtable, source, "first@example.com");
+  run_pending ();
+  check (n_searches == 1, "searched again before the TTL expired");
+
+  /* Stale: answered from the cache while refreshing */
+  fake_now += 1;
+  check_account (vtable, source, "first@example.com");
+  check (n_searches == 2, "didn't search again once the TTL expired");
+
+  printf ("\nChecking the refresh notification:");
+
+  run_pending ();
+  check (n_notifies == 1, "%d notifications for a changed value",
+	 n_notifies);
+  check_account (vtable, source, "second@example.com");
+
+  /* A refresh that finds nothing new stays quiet */
+  fake_now += CACHE_TTL;
+  check_account (vtable, source, "second@example.com");
+  run_pending ();
+  check (n_searches == 3, "didn't refresh an unchanged value");
+  check (n_notifies == 1, "notified about an unchanged value");
+
+  printf ("\nChecking reconnecting after a failure:");
+
+  check (n_connections_made == 1 && n_connections_open == 1,
+	 "%d connections made, %d open, expected one of each",
+	 n_connections_made, n_connections_open);
+
+  server_down = TRUE;
+  server_mail = "third@example.com";
+
+  fake_now += CACHE_TTL;
+  check_account (vtable, source, "second@example.com");
+  run_pending ();
+  check (n_connections_open == 0, "kept the connection after it failed");
+
+  /* Don't hammer a server that just failed */
+  server_down = FALSE;
+  fake_now += CACHE_TTL;
+  check_account (vtable, source, "second@example.com");
+  run_pending ();
+  check (n_connections_made == 1, "reconnected right after a failure");
+
+  fake_now += RETRY_WAIT;
+  check_account (vtable, source, "second@example.com");
+  run_pending ();
+  check (n_connections_made == 2 && n_connections_open == 1,
+	 "%d connections made, %d open after retrying, expected 2 and 1",
+	 n_connections_made, n_connections_open);
+  check (n_notifies == 2, "no notification after reconnecting");
+  check_account (vtable, source, "third@example.com");
+
+  printf ("\nChecking destroying the source:");
+
+  (* vtable->destroy_source) (source);
+  check (n_connections_open == 0, "destroying the source kept the connection");
+
+  printf ("\n\n");
+
+  unlink (conf_file);
+  g_free (conf_file);
+  g_free (address);
+
+  return 0;
+}
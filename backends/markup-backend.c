@@ -64,6 +64,10 @@ typedef struct
   MarkupTree *tree;
   guint dir_mode;
   guint file_mode;
+
+  GConfSourceNotifyFunc notify_func;
+  gpointer notify_user_data;
+
   guint merged : 1;
 } MarkupSource;
 
@@ -130,6 +134,26 @@ static gboolean       sync_all        (GConfSource       *source,
 static void           destroy_source  (GConfSource       *source);
 static void           clear_cache     (GConfSource       *source);
 static void           blow_away_locks (const char        *address);
+static void           set_notify_func (GConfSource           *source,
+                                       GConfSourceNotifyFunc  notify_func,
+                                       gpointer               user_data);
+static void           query_values    (GConfSource       *source,
+                                       const char       **keys,
+                                       guint              n_keys,
+                                       const char       **locales,
+                                       GConfValue       **values,
+                                       char             **schema_names,
+                                       GError           **err);
+static void           set_values      (GConfSource       *source,
+                                       const char       **keys,
+                                       GConfValue * const *values,
+                                       guint              n_keys,
+                                       GError           **err);
+static void           unset_values    (GConfSource       *source,
+                                       const char       **keys,
+                                       guint              n_keys,
+                                       const char        *locale,
+                                       GError           **err);
 
 
 static GConfBackendVTable markup_vtable = {
@@ -153,9 +177,12 @@ static GConfBackendVTable markup_vtable = {
   destroy_source,
   clear_cache,
   blow_away_locks,
-  NULL, /* set_notify_func */
+  set_notify_func,
   NULL, /* add_listener    */
-  NULL  /* remove_listener */
+  NULL, /* remove_listener */
+  query_values,
+  set_values,
+  unset_values
 };
 
 static void          
@@ -411,33 +438,59 @@ resolve_address (const char *address,
   return source;
 }
 
+/* The directory of the last key looked up, so runs of keys in one
+ * directory only walk the tree once.
+ */
+typedef struct
+{
+  char      *parent;
+  MarkupDir *dir;
+} DirCursor;
+
 static MarkupEntry*
-tree_lookup_entry (MarkupTree *tree,
-                   const char *key,
-                   gboolean    create_if_not_found,
-                   GError    **err)
+cursor_lookup_entry (MarkupTree *tree,
+                     DirCursor  *cursor,
+                     const char *key,
+                     gboolean    create_if_not_found,
+                     GError    **err)
 {
-  char* parent;
+  const char *slash;
+  gsize parent_len;
   MarkupDir *dir;
   GError* error = NULL;
 
-  parent = gconf_key_directory (key);
-  
-  g_assert (parent != NULL);
+  slash = strrchr (key, '/');
+  g_assert (slash != NULL);
 
-  if (create_if_not_found)
-    dir = markup_tree_ensure_dir (tree, parent, &error);
-  else
-    dir = markup_tree_lookup_dir (tree, parent, &error);
+  /* The parent of "/foo" is "/" */
+  parent_len = slash == key ? 1 : (gsize) (slash - key);
 
-  if (error != NULL)
+  if (cursor->parent != NULL &&
+      strlen (cursor->parent) == parent_len &&
+      strncmp (cursor->parent, key, parent_len) == 0 &&
+      (cursor->dir != NULL || !create_if_not_found))
     {
-      g_propagate_error (err, error);
-      return NULL;
+      dir = cursor->dir;
+    }
+  else
+    {
+      g_free (cursor->parent);
+      cursor->parent = g_strndup (key, parent_len);
+      cursor->dir = NULL;
+
+      if (create_if_not_found)
+        dir = markup_tree_ensure_dir (tree, cursor->parent, &error);
+      else
+        dir = markup_tree_lookup_dir (tree, cursor->parent, &error);
+
+      if (error != NULL)
+        {
+          g_propagate_error (err, error);
+          return NULL;
+        }
+
+      cursor->dir = dir;
     }
-  
-  g_free (parent);
-  parent = NULL;
   
   if (dir != NULL)
     {
@@ -464,6 +517,22 @@ tree_lookup_entry (MarkupTree *tree,
     return NULL;
 }
 
+static MarkupEntry*
+tree_lookup_entry (MarkupTree *tree,
+                   const char *key,
+                   gboolean    create_if_not_found,
+                   GError    **err)
+{
+  DirCursor cursor = { NULL, NULL };
+  MarkupEntry *entry;
+
+  entry = cursor_lookup_entry (tree, &cursor, key, create_if_not_found, err);
+
+  g_free (cursor.parent);
+
+  return entry;
+}
+
 static GConfValue* 
 query_value (GConfSource *source,
              const char  *key,
@@ -711,6 +780,134 @@ unset_value (GConfSource *source,
   markup_entry_unset_value (entry, locale);
 }
 
+static void
+query_values (GConfSource *source,
+              const char **keys,
+              guint        n_keys,
+              const char **locales,
+              GConfValue **values,
+              char       **schema_names,
+              GError     **err)
+{
+  MarkupSource* ms = (MarkupSource*)source;
+  DirCursor cursor = { NULL, NULL };
+  guint i;
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      MarkupEntry *entry;
+      GError *error;
+
+      values[i] = NULL;
+      if (schema_names)
+        schema_names[i] = NULL;
+
+      error = NULL;
+      entry = cursor_lookup_entry (ms->tree, &cursor, keys[i], FALSE, &error);
+      if (error != NULL)
+        {
+          if (err && *err == NULL)
+            g_propagate_error (err, error);
+          else
+            g_error_free (error);
+          continue;
+        }
+
+      if (entry != NULL)
+        {
+          values[i] = markup_entry_get_value (entry, locales);
+          if (schema_names)
+            schema_names[i] = g_strdup (markup_entry_get_schema_name (entry));
+        }
+    }
+
+  g_free (cursor.parent);
+}
+
+static void
+set_values (GConfSource        *source,
+            const char        **keys,
+            GConfValue * const *values,
+            guint               n_keys,
+            GError            **err)
+{
+  MarkupSource* ms = (MarkupSource*)source;
+  DirCursor cursor = { NULL, NULL };
+  guint i;
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      MarkupEntry *entry;
+      GError *error;
+
+      error = NULL;
+      entry = cursor_lookup_entry (ms->tree, &cursor, keys[i], TRUE, &error);
+      if (error != NULL)
+        {
+          if (err && *err == NULL)
+            g_propagate_error (err, error);
+          else
+            g_error_free (error);
+          continue;
+        }
+
+      /* cursor_lookup_entry() creates missing entries, so this
+       * shouldn't happen; carry on with the other keys
+       */
+      if (entry == NULL)
+        {
+          g_warning ("No entry for key %s", keys[i]);
+          continue;
+        }
+
+      markup_entry_set_value (entry, values[i]);
+    }
+
+  g_free (cursor.parent);
+}
+
+static void
+unset_values (GConfSource *source,
+              const char **keys,
+              guint        n_keys,
+              const char  *locale,
+              GError     **err)
+{
+  MarkupSource* ms = (MarkupSource*)source;
+  DirCursor cursor = { NULL, NULL };
+  guint i;
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      MarkupEntry *entry;
+      GError *error;
+
+      error = NULL;
+      entry = cursor_lookup_entry (ms->tree, &cursor, keys[i], TRUE, &error);
+      if (error != NULL)
+        {
+          if (err && *err == NULL)
+            g_propagate_error (err, error);
+          else
+            g_error_free (error);
+          continue;
+        }
+
+      /* cursor_lookup_entry() creates missing entries, so this
+       * shouldn't happen; carry on with the other keys
+       */
+      if (entry == NULL)
+        {
+          g_warning ("No entry for key %s", keys[i]);
+          continue;
+        }
+
+      markup_entry_unset_value (entry, locale);
+    }
+
+  g_free (cursor.parent);
+}
+
 static gboolean
 dir_exists (GConfSource *source,
             const char  *key,
@@ -855,6 +1052,46 @@ blow_away_locks (const char *address)
 #endif
 }
 
+static void
+tree_changed (MarkupTree   *tree,
+              const char   *key,
+              MarkupSource *ms)
+{
+  if (ms->notify_func == NULL)
+    return;
+
+  /* Values cached from us can't be trusted any more */
+  if (key == NULL)
+    {
+      ((GConfSource *) ms)->flags &= ~GCONF_SOURCE_NOTIFIES_CHANGES;
+      return;
+    }
+
+  (* ms->notify_func) ((GConfSource *) ms, key, ms->notify_user_data);
+}
+
+static void
+set_notify_func (GConfSource           *source,
+                 GConfSourceNotifyFunc  notify_func,
+                 gpointer               user_data)
+{
+  MarkupSource *ms = (MarkupSource*)source;
+
+  if (ms->notify_func == NULL && notify_func != NULL)
+    markup_tree_add_notify (ms->tree, (MarkupTreeNotifyFunc) tree_changed, ms);
+  else if (ms->notify_func != NULL && notify_func == NULL)
+    markup_tree_remove_notify (ms->tree, (MarkupTreeNotifyFunc) tree_changed, ms);
+
+  ms->notify_func = notify_func;
+  ms->notify_user_data = user_data;
+
+  /* Without inotify we can't tell anyone about external edits */
+  if (notify_func != NULL && markup_tree_is_monitored (ms->tree))
+    source->flags |= GCONF_SOURCE_NOTIFIES_CHANGES;
+  else
+    source->flags &= ~GCONF_SOURCE_NOTIFIES_CHANGES;
+}
+
 /* Initializer */
 
 G_MODULE_EXPORT const char*
@@ -949,6 +1186,9 @@ ms_destroy (MarkupSource* ms)
       gconf_log (GCL_ERR, "timeout not found to remove?");
     }
 
+  if (ms->notify_func != NULL)
+    markup_tree_remove_notify (ms->tree, (MarkupTreeNotifyFunc) tree_changed, ms);
+
   markup_tree_unref (ms->tree);
 
   g_free (ms->root_dir);
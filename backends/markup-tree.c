@@ -21,6 +21,7 @@
 #include <glib.h>
 #include <gconf/gconf-internals.h>
 #include <gconf/gconf-schema.h>
+#include <gconf/gconf.h>
 #include "markup-tree.h"
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -32,6 +33,9 @@
 #include <limits.h>
 #include <stdio.h>
 #include <time.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 typedef struct
 {
@@ -69,6 +73,12 @@ static char*      markup_dir_build_path            (MarkupDir  *dir,
                                                     const char *locale);
 static void       markup_dir_set_entries_need_save (MarkupDir  *dir);
 static void       markup_dir_setup_as_subtree_root (MarkupDir  *dir);
+static void       markup_dir_monitor               (MarkupDir  *dir);
+static void       markup_dir_unmonitor             (MarkupDir  *dir);
+static void       markup_dir_remember_data_file    (MarkupDir  *dir);
+
+static void markup_tree_start_monitoring (MarkupTree *tree);
+static void markup_tree_stop_monitoring  (MarkupTree *tree);
 
 static MarkupEntry* markup_entry_new  (MarkupDir   *dir,
 				       const char  *name);
@@ -94,6 +104,17 @@ struct _MarkupTree
 
   guint refcount;
 
+  /* List of MarkupTreeNotify */
+  GSList *notifies;
+
+  /* inotify descriptor, or -1 if we aren't monitoring */
+  int inotify_fd;
+  guint inotify_watch_id;
+  /* Watch descriptor -> MarkupDir */
+  GHashTable *dirs_by_wd;
+  /* Set once some loaded directory couldn't be watched */
+  guint missing_watches : 1;
+
   guint merged : 1;
 };
 
@@ -126,6 +147,7 @@ markup_tree_get (const char *root_dir,
   tree->dir_mode = dir_mode;
   tree->file_mode = file_mode;
   tree->merged = merged != FALSE;
+  tree->inotify_fd = -1;
 
   tree->root = markup_dir_new (tree, NULL, "/");  
 
@@ -155,6 +177,11 @@ markup_tree_unref (MarkupTree *tree)
       trees_by_root_dir = NULL;
     }
 
+  g_slist_foreach (tree->notifies, (GFunc) g_free, NULL);
+  g_slist_free (tree->notifies);
+  tree->notifies = NULL;
+  markup_tree_stop_monitoring (tree);
+
   markup_dir_free (tree->root);
   tree->root = NULL;
 
@@ -185,6 +212,20 @@ struct _MarkupDir
   /* Available %gconf-tree-$(locale).xml files */
   GHashTable *available_local_descs;
 
+  /* inotify watch descriptor, or -1 */
+  int wd;
+
+  /* Identity of our data file when we last read or wrote it,
+   * so we can tell our own writes from external ones
+   */
+  ino_t  data_file_ino;
+  off_t  data_file_size;
+  time_t data_file_mtime;
+  /* An in-place rewrite of the same size within one second only
+   * shows up in the sub-second part of the mtime
+   */
+  long   data_file_mtime_nsec;
+
   /* Have read the existing XML file */
   guint entries_loaded : 1;
   /* Need to rewrite the XML file since we changed
@@ -224,11 +265,12 @@ markup_dir_new (MarkupTree *tree,
 {
   MarkupDir *dir;
 
-  dir = g_new0 (MarkupDir, 1);
+  dir = g_slice_new0 (MarkupDir);
 
   dir->name = g_strdup (name);
   dir->tree = tree;
   dir->parent = parent;
+  dir->wd = -1;
 
   if (parent)
     {
@@ -248,6 +290,8 @@ markup_dir_free (MarkupDir *dir)
 {
   GSList *tmp;
 
+  markup_dir_unmonitor (dir);
+
   if (dir->available_local_descs != NULL)
     {
       g_hash_table_destroy (dir->available_local_descs);
@@ -276,7 +320,7 @@ markup_dir_free (MarkupDir *dir)
 
   g_free (dir->name);
 
-  g_free (dir);
+  g_slice_free (MarkupDir, dir);
 }
 
 static void
@@ -546,6 +590,8 @@ load_entries (MarkupDir *dir)
    */
   dir->entries_loaded = TRUE;
 
+  markup_dir_monitor (dir);
+
   if (!load_subtree (dir))
     {
       GError *tmp_err = NULL;
@@ -598,6 +644,8 @@ load_subdirs (MarkupDir *dir)
    */
   dir->subdirs_loaded = TRUE;
 
+  markup_dir_monitor (dir);
+
   g_assert (dir->subdirs == NULL);
 
   if (load_subtree (dir))
@@ -1175,6 +1223,12 @@ markup_dir_sync (MarkupDir *dir)
           dir->entries_need_save = FALSE;
 	  if (dir->save_as_subtree)
 	    dir->some_subdir_needs_sync = FALSE;
+
+          /* So the change event for our own write is ignored */
+          if (dir->wd >= 0)
+            markup_dir_remember_data_file (dir);
+          else
+            markup_dir_monitor (dir);
         }
     }
 
@@ -1320,6 +1374,868 @@ markup_dir_build_path (MarkupDir  *dir,
   return g_string_free (name, FALSE);
 }
 
+/*
+ * Monitoring for external changes
+ */
+
+typedef struct
+{
+  MarkupTreeNotifyFunc func;
+  gpointer             user_data;
+} MarkupTreeNotify;
+
+void
+markup_tree_add_notify (MarkupTree           *tree,
+                        MarkupTreeNotifyFunc  func,
+                        gpointer              user_data)
+{
+  MarkupTreeNotify *notify;
+
+  g_return_if_fail (tree != NULL);
+  g_return_if_fail (func != NULL);
+
+  notify = g_new0 (MarkupTreeNotify, 1);
+  notify->func = func;
+  notify->user_data = user_data;
+
+  tree->notifies = g_slist_append (tree->notifies, notify);
+
+  if (tree->notifies->next == NULL)
+    markup_tree_start_monitoring (tree);
+}
+
+void
+markup_tree_remove_notify (MarkupTree           *tree,
+                           MarkupTreeNotifyFunc  func,
+                           gpointer              user_data)
+{
+  GSList *tmp;
+
+  g_return_if_fail (tree != NULL);
+
+  tmp = tree->notifies;
+  while (tmp != NULL)
+    {
+      MarkupTreeNotify *notify = tmp->data;
+
+      if (notify->func == func && notify->user_data == user_data)
+        {
+          tree->notifies = g_slist_delete_link (tree->notifies, tmp);
+          g_free (notify);
+          break;
+        }
+
+      tmp = tmp->next;
+    }
+
+  if (tree->notifies == NULL)
+    markup_tree_stop_monitoring (tree);
+}
+
+gboolean
+markup_tree_is_monitored (MarkupTree *tree)
+{
+  return tree->inotify_watch_id != 0 && !tree->missing_watches;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+#define MARKUP_INOTIFY_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+                             IN_CREATE | IN_DELETE | IN_DELETE_SELF |       \
+                             IN_MOVE_SELF)
+
+/* Tell the notify funcs that changes may go unnoticed from now on */
+static void
+markup_tree_lost_monitoring (MarkupTree *tree)
+{
+  GSList *tmp;
+
+  tmp = tree->notifies;
+  while (tmp != NULL)
+    {
+      MarkupTreeNotify *notify = tmp->data;
+
+      (* notify->func) (tree, NULL, notify->user_data);
+
+      tmp = tmp->next;
+    }
+}
+
+static void
+markup_tree_emit_changes (MarkupTree *tree,
+                          GSList     *changed_keys)
+{
+  GSList *tmp;
+
+  tmp = changed_keys;
+  while (tmp != NULL)
+    {
+      const char *key = tmp->data;
+      GSList *l;
+
+      gconf_log (GCL_DEBUG, "Key \"%s\" changed on disk", key);
+
+      l = tree->notifies;
+      while (l != NULL)
+        {
+          MarkupTreeNotify *notify = l->data;
+
+          (* notify->func) (tree, key, notify->user_data);
+
+          l = l->next;
+        }
+
+      tmp = tmp->next;
+    }
+}
+
+static char*
+markup_entry_build_key (MarkupEntry *entry)
+{
+  char *dir_key;
+  char *key;
+
+  dir_key = markup_dir_build_dir_path (entry->dir, FALSE);
+  key = gconf_concat_dir_and_key (dir_key, entry->name);
+  g_free (dir_key);
+
+  return key;
+}
+
+static gboolean
+null_safe_str_equal (const char *a,
+                     const char *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  return strcmp (a, b) == 0;
+}
+
+static gboolean
+null_safe_value_equal (const GConfValue *a,
+                       const GConfValue *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  return gconf_value_compare (a, b) == 0;
+}
+
+/* gconf_value_compare() ignores schema defaults, which we keep
+ * per locale in local_schemas anyway, so compare those as well.
+ */
+static gboolean
+markup_entry_equal (MarkupEntry *a,
+                    MarkupEntry *b)
+{
+  GSList *tmp_a;
+  GSList *tmp_b;
+
+  if (!null_safe_value_equal (a->value, b->value))
+    return FALSE;
+
+  if (!null_safe_str_equal (a->schema_name, b->schema_name))
+    return FALSE;
+
+  tmp_a = a->local_schemas;
+  tmp_b = b->local_schemas;
+  while (tmp_a != NULL && tmp_b != NULL)
+    {
+      LocalSchemaInfo *info_a = tmp_a->data;
+      LocalSchemaInfo *info_b = tmp_b->data;
+
+      if (!null_safe_str_equal (info_a->locale, info_b->locale) ||
+          !null_safe_str_equal (info_a->short_desc, info_b->short_desc) ||
+          !null_safe_str_equal (info_a->long_desc, info_b->long_desc) ||
+          !null_safe_value_equal (info_a->default_value, info_b->default_value))
+        return FALSE;
+
+      tmp_a = tmp_a->next;
+      tmp_b = tmp_b->next;
+    }
+
+  return tmp_a == NULL && tmp_b == NULL;
+}
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+#define STAT_MTIME_NSEC(statbuf) ((statbuf).st_mtim.tv_nsec)
+#else
+#define STAT_MTIME_NSEC(statbuf) 0L
+#endif
+
+static void
+markup_dir_remember_data_file (MarkupDir *dir)
+{
+  struct stat statbuf;
+  char *filename;
+
+  filename = markup_dir_build_file_path (dir, dir->save_as_subtree, NULL);
+
+  if (g_stat (filename, &statbuf) == 0)
+    {
+      dir->data_file_ino   = statbuf.st_ino;
+      dir->data_file_size  = statbuf.st_size;
+      dir->data_file_mtime = statbuf.st_mtime;
+      dir->data_file_mtime_nsec = STAT_MTIME_NSEC (statbuf);
+    }
+  else
+    {
+      dir->data_file_ino   = 0;
+      dir->data_file_size  = 0;
+      dir->data_file_mtime = 0;
+      dir->data_file_mtime_nsec = 0;
+    }
+
+  g_free (filename);
+}
+
+static gboolean
+markup_dir_data_file_changed (MarkupDir  *dir,
+                              const char *name)
+{
+  struct stat statbuf;
+  char *filename;
+  gboolean changed;
+
+  /* Switching between %gconf.xml and %gconf-tree.xml is always
+   * a change
+   */
+  if (strcmp (name, dir->save_as_subtree ? "%gconf-tree.xml" : "%gconf.xml") != 0)
+    return TRUE;
+
+  filename = markup_dir_build_file_path (dir, dir->save_as_subtree, NULL);
+
+  if (g_stat (filename, &statbuf) == 0)
+    changed = (statbuf.st_ino   != dir->data_file_ino  ||
+               statbuf.st_size  != dir->data_file_size ||
+               statbuf.st_mtime != dir->data_file_mtime ||
+               STAT_MTIME_NSEC (statbuf) != dir->data_file_mtime_nsec);
+  else
+    changed = dir->data_file_ino != 0;
+
+  g_free (filename);
+
+  return changed;
+}
+
+static void
+markup_dir_monitor (MarkupDir *dir)
+{
+  MarkupTree *tree;
+  char *fs_dirname;
+
+  tree = dir->tree;
+
+  if (tree->inotify_fd < 0 || dir->wd >= 0)
+    return;
+
+  /* Stored in the data file of some parent */
+  if (dir->not_in_filesystem || dir->is_parser_dummy)
+    return;
+
+  fs_dirname = markup_dir_build_dir_path (dir, TRUE);
+
+  dir->wd = inotify_add_watch (tree->inotify_fd,
+                               fs_dirname,
+                               MARKUP_INOTIFY_MASK);
+  if (dir->wd < 0 && errno == ENOENT)
+    {
+      /* Directories not yet synced; the parent's watch catches
+       * them being created behind our back.
+       */
+      gconf_log (GCL_DEBUG,
+                 "Could not monitor directory \"%s\": %s",
+                 fs_dirname, g_strerror (errno));
+    }
+  else if (dir->wd < 0)
+    {
+      gconf_log (GCL_WARNING,
+                 _("Could not monitor directory \"%s\" for changes: %s"),
+                 fs_dirname, g_strerror (errno));
+
+      if (!tree->missing_watches)
+        {
+          tree->missing_watches = TRUE;
+          markup_tree_lost_monitoring (tree);
+        }
+    }
+  else
+    {
+      g_hash_table_insert (tree->dirs_by_wd, GINT_TO_POINTER (dir->wd), dir);
+      markup_dir_remember_data_file (dir);
+    }
+
+  g_free (fs_dirname);
+}
+
+static void
+markup_dir_unmonitor (MarkupDir *dir)
+{
+  if (dir->wd < 0)
+    return;
+
+  g_hash_table_remove (dir->tree->dirs_by_wd, GINT_TO_POINTER (dir->wd));
+  inotify_rm_watch (dir->tree->inotify_fd, dir->wd);
+  dir->wd = -1;
+}
+
+static void
+markup_dir_monitor_recurse (MarkupDir *dir)
+{
+  GSList *tmp;
+
+  if (dir->entries_loaded || dir->subdirs_loaded)
+    markup_dir_monitor (dir);
+
+  tmp = dir->subdirs;
+  while (tmp != NULL)
+    {
+      markup_dir_monitor_recurse (tmp->data);
+
+      tmp = tmp->next;
+    }
+}
+
+static void
+markup_dir_forget_watches (MarkupDir *dir)
+{
+  GSList *tmp;
+
+  dir->wd = -1;
+
+  tmp = dir->subdirs;
+  while (tmp != NULL)
+    {
+      markup_dir_forget_watches (tmp->data);
+
+      tmp = tmp->next;
+    }
+}
+
+static void
+collect_entries (MarkupDir  *dir,
+                 gboolean    recurse,
+                 GHashTable *entries_by_key)
+{
+  GSList *tmp;
+
+  tmp = dir->entries;
+  while (tmp != NULL)
+    {
+      MarkupEntry *entry = tmp->data;
+
+      g_hash_table_insert (entries_by_key,
+                           markup_entry_build_key (entry),
+                           entry);
+
+      tmp = tmp->next;
+    }
+
+  if (recurse)
+    {
+      tmp = dir->subdirs;
+      while (tmp != NULL)
+        {
+          collect_entries (tmp->data, TRUE, entries_by_key);
+
+          tmp = tmp->next;
+        }
+    }
+}
+
+static void
+collect_keys (MarkupDir  *dir,
+              gboolean    recurse,
+              GSList    **keys)
+{
+  GSList *tmp;
+
+  tmp = dir->entries;
+  while (tmp != NULL)
+    {
+      *keys = g_slist_prepend (*keys, markup_entry_build_key (tmp->data));
+
+      tmp = tmp->next;
+    }
+
+  if (recurse)
+    {
+      tmp = dir->subdirs;
+      while (tmp != NULL)
+        {
+          collect_keys (tmp->data, TRUE, keys);
+
+          tmp = tmp->next;
+        }
+    }
+}
+
+static void
+diff_entries (MarkupDir   *dir,
+              gboolean     recurse,
+              GHashTable  *old_entries,
+              GSList     **changed_keys)
+{
+  GSList *tmp;
+
+  tmp = dir->entries;
+  while (tmp != NULL)
+    {
+      MarkupEntry *entry = tmp->data;
+      MarkupEntry *old_entry;
+      char *key;
+
+      key = markup_entry_build_key (entry);
+
+      old_entry = g_hash_table_lookup (old_entries, key);
+      if (old_entry != NULL)
+        g_hash_table_remove (old_entries, key);
+
+      if (old_entry == NULL || !markup_entry_equal (old_entry, entry))
+        *changed_keys = g_slist_prepend (*changed_keys, key);
+      else
+        g_free (key);
+
+      tmp = tmp->next;
+    }
+
+  if (recurse)
+    {
+      tmp = dir->subdirs;
+      while (tmp != NULL)
+        {
+          diff_entries (tmp->data, TRUE, old_entries, changed_keys);
+
+          tmp = tmp->next;
+        }
+    }
+}
+
+static void
+prepend_removed_key (char    *key,
+                     gpointer entry,
+                     GSList **changed_keys)
+{
+  *changed_keys = g_slist_prepend (*changed_keys, g_strdup (key));
+}
+
+/* Re-read the data file of @dir and figure out which keys changed;
+ * for a %gconf-tree.xml that's the whole subtree.
+ */
+static void
+markup_dir_reload (MarkupDir  *dir,
+                   GSList    **changed_keys)
+{
+  GHashTable *old_entries;
+  GSList *old_entry_list;
+  GSList *old_subdirs;
+  GSList *tmp;
+  char *subtree_file;
+  gboolean as_subtree;
+
+  if (markup_dir_needs_sync (dir))
+    {
+      /* Our unsaved changes are going to overwrite the file anyway */
+      gconf_log (GCL_DEBUG,
+                 "Ignoring external change to directory \"%s\" with unsaved changes",
+                 dir->name);
+      return;
+    }
+
+  subtree_file = markup_dir_build_file_path (dir, TRUE, NULL);
+  as_subtree = dir->save_as_subtree || gconf_file_exists (subtree_file);
+  g_free (subtree_file);
+
+  old_entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  collect_entries (dir, as_subtree, old_entries);
+
+  old_entry_list = dir->entries;
+  dir->entries = NULL;
+  dir->entries_loaded = FALSE;
+
+  old_subdirs = NULL;
+  if (as_subtree)
+    {
+      old_subdirs = dir->subdirs;
+      dir->subdirs = NULL;
+      dir->subdirs_loaded = FALSE;
+
+      if (dir->subtree_root == dir)
+        {
+          g_hash_table_destroy (dir->available_local_descs);
+          dir->available_local_descs = g_hash_table_new_full (g_str_hash,
+                                                              g_str_equal,
+                                                              g_free,
+                                                              NULL);
+          dir->all_local_descs_loaded = TRUE;
+        }
+    }
+
+  load_entries (dir);
+
+  diff_entries (dir, as_subtree, old_entries, changed_keys);
+  g_hash_table_foreach (old_entries, (GHFunc) prepend_removed_key, changed_keys);
+  g_hash_table_destroy (old_entries);
+
+  tmp = old_entry_list;
+  while (tmp != NULL)
+    {
+      markup_entry_free (tmp->data);
+      tmp = tmp->next;
+    }
+  g_slist_free (old_entry_list);
+
+  tmp = old_subdirs;
+  while (tmp != NULL)
+    {
+      markup_dir_free (tmp->data);
+      tmp = tmp->next;
+    }
+  g_slist_free (old_subdirs);
+
+  markup_dir_remember_data_file (dir);
+}
+
+/* A directory we didn't know about appeared; everything in it is new */
+static void
+markup_dir_load_added (MarkupDir  *dir,
+                       GSList    **changed_keys)
+{
+  GSList *tmp;
+
+  markup_dir_monitor (dir);
+
+  if (!dir->entries_loaded)
+    {
+      char *fs_filename;
+      char *fs_subtree;
+
+      /* Wait for the data file to show up, so we don't delete the
+       * directory as useless in the meantime
+       */
+      fs_filename = markup_dir_build_file_path (dir, FALSE, NULL);
+      fs_subtree = markup_dir_build_file_path (dir, TRUE, NULL);
+
+      if (gconf_file_exists (fs_filename) || gconf_file_exists (fs_subtree))
+        load_entries (dir);
+
+      g_free (fs_filename);
+      g_free (fs_subtree);
+    }
+
+  if (dir->entries_loaded)
+    collect_keys (dir, FALSE, changed_keys);
+
+  load_subdirs (dir);
+
+  tmp = dir->subdirs;
+  while (tmp != NULL)
+    {
+      markup_dir_load_added (tmp->data, changed_keys);
+
+      tmp = tmp->next;
+    }
+}
+
+static void
+markup_dir_subdir_added (MarkupDir   *dir,
+                         const char  *name,
+                         GSList     **changed_keys)
+{
+  MarkupDir *subdir;
+  GSList *tmp;
+
+  /* Same rules as load_subdirs() */
+  if (name[0] == '.' || name[0] == '%')
+    return;
+
+  /* If we haven't listed subdirs yet, we'll find it when we do */
+  if (!dir->subdirs_loaded || dir->save_as_subtree)
+    return;
+
+  tmp = dir->subdirs;
+  while (tmp != NULL)
+    {
+      subdir = tmp->data;
+
+      /* Most likely we created it ourselves */
+      if (strcmp (subdir->name, name) == 0)
+        return;
+
+      tmp = tmp->next;
+    }
+
+  subdir = markup_dir_new (dir->tree, dir, name);
+  subdir->filesystem_dir_probably_exists = TRUE;
+
+  markup_dir_load_added (subdir, changed_keys);
+}
+
+static void
+markup_dir_subdir_removed (MarkupDir   *dir,
+                           const char  *name,
+                           GSList     **changed_keys)
+{
+  MarkupDir *subdir;
+  GSList *tmp;
+
+  subdir = NULL;
+  tmp = dir->subdirs;
+  while (tmp != NULL)
+    {
+      subdir = tmp->data;
+
+      if (strcmp (subdir->name, name) == 0)
+        break;
+      else
+        subdir = NULL;
+
+      tmp = tmp->next;
+    }
+
+  if (subdir == NULL)
+    return;
+
+  if (markup_dir_needs_sync (subdir))
+    {
+      /* Keep it, it gets written back when we sync */
+      subdir->filesystem_dir_probably_exists = FALSE;
+      return;
+    }
+
+  collect_keys (subdir, TRUE, changed_keys);
+
+  dir->subdirs = g_slist_remove (dir->subdirs, subdir);
+  markup_dir_free (subdir);
+}
+
+static void
+prepend_wd (gpointer   wd,
+            MarkupDir *dir,
+            GSList   **wds)
+{
+  *wds = g_slist_prepend (*wds, wd);
+}
+
+static void
+markup_tree_handle_event (MarkupTree            *tree,
+                          struct inotify_event  *event,
+                          GSList               **changed_keys)
+{
+  MarkupDir *dir;
+
+  if (event->mask & IN_Q_OVERFLOW)
+    {
+      GSList *wds;
+      GSList *tmp;
+
+      gconf_log (GCL_WARNING,
+                 _("Too many changes to \"%s\" at once, rereading everything"),
+                 tree->dirname);
+
+      /* Directories may go away while we reload, so go by descriptor */
+      wds = NULL;
+      g_hash_table_foreach (tree->dirs_by_wd, (GHFunc) prepend_wd, &wds);
+
+      tmp = wds;
+      while (tmp != NULL)
+        {
+          dir = g_hash_table_lookup (tree->dirs_by_wd, tmp->data);
+          if (dir != NULL && !dir->not_in_filesystem)
+            markup_dir_reload (dir, changed_keys);
+
+          tmp = tmp->next;
+        }
+      g_slist_free (wds);
+
+      return;
+    }
+
+  dir = g_hash_table_lookup (tree->dirs_by_wd, GINT_TO_POINTER (event->wd));
+  if (dir == NULL)
+    return;
+
+  if (event->mask & IN_IGNORED)
+    {
+      /* The kernel dropped the watch */
+      g_hash_table_remove (tree->dirs_by_wd, GINT_TO_POINTER (dir->wd));
+      dir->wd = -1;
+      return;
+    }
+
+  /* Has since been merged into a %gconf-tree.xml higher up */
+  if (dir->not_in_filesystem)
+    return;
+
+  if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+      /* The parent will drop us if it's watching */
+      if (dir->parent == NULL || dir->parent->wd < 0)
+        markup_dir_reload (dir, changed_keys);
+      return;
+    }
+
+  if (event->len == 0)
+    return;
+
+  if (event->mask & IN_ISDIR)
+    {
+      if (event->mask & (IN_CREATE | IN_MOVED_TO))
+        markup_dir_subdir_added (dir, event->name, changed_keys);
+      else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+        markup_dir_subdir_removed (dir, event->name, changed_keys);
+    }
+  else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM))
+    {
+      if (strcmp (event->name, "%gconf.xml") != 0 &&
+          strcmp (event->name, "%gconf-tree.xml") != 0)
+        return;
+
+      if (markup_dir_data_file_changed (dir, event->name))
+        markup_dir_reload (dir, changed_keys);
+    }
+}
+
+static gboolean
+markup_tree_inotify_cb (GIOChannel   *source,
+                        GIOCondition  condition,
+                        gpointer      data)
+{
+  MarkupTree *tree = data;
+  /* gint64 to get the alignment struct inotify_event needs */
+  gint64 buf[512];
+  GSList *changed_keys;
+  ssize_t len;
+
+  if (condition & (G_IO_HUP | G_IO_ERR))
+    {
+      gconf_log (GCL_WARNING,
+                 _("Stopped monitoring \"%s\" for changes"),
+                 tree->dirname);
+      tree->inotify_watch_id = 0;
+      markup_tree_lost_monitoring (tree);
+      return FALSE;
+    }
+
+  changed_keys = NULL;
+
+  while ((len = read (tree->inotify_fd, buf, sizeof (buf))) > 0)
+    {
+      char *p;
+
+      p = (char *) buf;
+      while (p < (char *) buf + len)
+        {
+          struct inotify_event *event = (struct inotify_event *) p;
+
+          markup_tree_handle_event (tree, event, &changed_keys);
+
+          p += sizeof (struct inotify_event) + event->len;
+        }
+    }
+
+  /* Only notify once the tree is consistent again, since the
+   * callbacks will query the new values
+   */
+  changed_keys = g_slist_reverse (changed_keys);
+  markup_tree_emit_changes (tree, changed_keys);
+
+  g_slist_foreach (changed_keys, (GFunc) g_free, NULL);
+  g_slist_free (changed_keys);
+
+  return TRUE;
+}
+
+static void
+markup_tree_start_monitoring (MarkupTree *tree)
+{
+  GIOChannel *channel;
+
+  g_return_if_fail (tree->inotify_fd < 0);
+
+  tree->inotify_fd = inotify_init ();
+  if (tree->inotify_fd < 0)
+    {
+      gconf_log (GCL_WARNING,
+                 _("Could not monitor \"%s\" for changes: %s"),
+                 tree->dirname, g_strerror (errno));
+      return;
+    }
+
+  fcntl (tree->inotify_fd, F_SETFL, O_NONBLOCK);
+  fcntl (tree->inotify_fd, F_SETFD, FD_CLOEXEC);
+
+  tree->dirs_by_wd = g_hash_table_new (NULL, NULL);
+  tree->missing_watches = FALSE;
+
+  channel = g_io_channel_unix_new (tree->inotify_fd);
+  tree->inotify_watch_id = g_io_add_watch (channel,
+                                           G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                           markup_tree_inotify_cb,
+                                           tree);
+  g_io_channel_unref (channel);
+
+  /* Pick up what we've already read */
+  if (tree->root != NULL)
+    markup_dir_monitor_recurse (tree->root);
+}
+
+static void
+markup_tree_stop_monitoring (MarkupTree *tree)
+{
+  if (tree->inotify_fd < 0)
+    return;
+
+  if (tree->inotify_watch_id != 0)
+    {
+      g_source_remove (tree->inotify_watch_id);
+      tree->inotify_watch_id = 0;
+    }
+
+  /* Closing the descriptor drops all the watches */
+  if (tree->root != NULL)
+    markup_dir_forget_watches (tree->root);
+
+  g_hash_table_destroy (tree->dirs_by_wd);
+  tree->dirs_by_wd = NULL;
+
+  close (tree->inotify_fd);
+  tree->inotify_fd = -1;
+}
+
+#else /* !HAVE_SYS_INOTIFY_H */
+
+static void
+markup_dir_remember_data_file (MarkupDir *dir)
+{
+}
+
+static void
+markup_dir_monitor (MarkupDir *dir)
+{
+}
+
+static void
+markup_dir_unmonitor (MarkupDir *dir)
+{
+}
+
+static void
+markup_tree_start_monitoring (MarkupTree *tree)
+{
+  gconf_log (GCL_DEBUG,
+             "No support for monitoring \"%s\" for changes",
+             tree->dirname);
+}
+
+static void
+markup_tree_stop_monitoring (MarkupTree *tree)
+{
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
+
 /*
  * MarkupEntry
  */
@@ -1330,7 +2246,7 @@ markup_entry_new (MarkupDir  *dir,
 {
   MarkupEntry *entry;
 
-  entry = g_new0 (MarkupEntry, 1);
+  entry = g_slice_new0 (MarkupEntry);
 
   entry->name = g_strdup (name);
 
@@ -1355,7 +2271,7 @@ markup_entry_free (MarkupEntry *entry)
 
   g_slist_free (entry->local_schemas);
 
-  g_free (entry);
+  g_slice_free (MarkupEntry, entry);
 }
 
 static void
@@ -4612,7 +5528,7 @@ local_schema_info_new (void)
 {
   LocalSchemaInfo *info;
 
-  info = g_new0 (LocalSchemaInfo, 1);
+  info = g_slice_new0 (LocalSchemaInfo);
 
   return info;
 }
@@ -4625,5 +5541,5 @@ local_schema_info_free (LocalSchemaInfo *info)
   g_free (info->long_desc);
   if (info->default_value)
     gconf_value_free (info->default_value);
-  g_free (info);
+  g_slice_free (LocalSchemaInfo, info);
 }
@@ -27,6 +27,14 @@ typedef struct _MarkupTree  MarkupTree;
 typedef struct _MarkupDir   MarkupDir;
 typedef struct _MarkupEntry MarkupEntry;
 
+/* Called with the full key of each entry whose value or schema
+ * changed on disk behind our back, or with a NULL key once such
+ * changes can no longer all be detected.
+ */
+typedef void (* MarkupTreeNotifyFunc) (MarkupTree *tree,
+                                       const char *key,
+                                       gpointer    user_data);
+
 /* Tree */
 
 MarkupTree* markup_tree_get        (const char *root_dir,
@@ -45,6 +53,18 @@ MarkupDir*  markup_tree_ensure_dir (MarkupTree *tree,
 gboolean    markup_tree_sync       (MarkupTree *tree,
                                     GError    **err);
 
+/* While at least one notify func is installed, the directories
+ * loaded from disk are monitored for external modification.
+ */
+void        markup_tree_add_notify    (MarkupTree           *tree,
+                                       MarkupTreeNotifyFunc  func,
+                                       gpointer              user_data);
+void        markup_tree_remove_notify (MarkupTree           *tree,
+                                       MarkupTreeNotifyFunc  func,
+                                       gpointer              user_data);
+/* Whether external modifications are actually being picked up */
+gboolean    markup_tree_is_monitored  (MarkupTree           *tree);
+
 /* Directories in the tree */
 
 MarkupEntry* markup_dir_lookup_entry  (MarkupDir   *dir,
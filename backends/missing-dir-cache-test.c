@@ -0,0 +1,201 @@
+/* GConf
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "missing-dir-cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+static void
+check(gboolean condition, const gchar* fmt, ...)
+{
+  va_list args;
+  gchar* description;
+
+  va_start (args, fmt);
+  description = g_strdup_vprintf(fmt, args);
+  va_end (args);
+
+  if (condition)
+    {
+      printf(".");
+      fflush(stdout);
+    }
+  else
+    {
+      fprintf(stderr, "\n*** FAILED: %s\n", description);
+      exit(1);
+    }
+
+  g_free(description);
+}
+
+static char*
+numbered_key (int i)
+{
+  return g_strdup_printf ("/apps/test/dir%d", i);
+}
+
+static void
+check_negative_hits (void)
+{
+  MissingDirCache *cache;
+
+  cache = missing_dir_cache_new ();
+
+  check (!missing_dir_cache_contains (cache, "/apps/foo"),
+         "empty cache claims to contain /apps/foo");
+
+  missing_dir_cache_add (cache, "/apps/foo");
+  missing_dir_cache_add (cache, "/apps/foo"); /* twice is harmless */
+
+  check (missing_dir_cache_contains (cache, "/apps/foo"),
+         "/apps/foo not found after adding it");
+  check (!missing_dir_cache_contains (cache, "/apps/fo"),
+         "prefix /apps/fo of an added key found");
+  check (!missing_dir_cache_contains (cache, "/apps/foo/bar"),
+         "child /apps/foo/bar of an added key found");
+
+  missing_dir_cache_clear (cache);
+
+  check (!missing_dir_cache_contains (cache, "/apps/foo"),
+         "/apps/foo still found after clearing");
+
+  missing_dir_cache_free (cache);
+}
+
+static void
+check_eviction (void)
+{
+  MissingDirCache *cache;
+  char *key;
+  int i;
+
+  cache = missing_dir_cache_new ();
+
+  for (i = 0; i < MISSING_DIR_CACHE_MAX_KEYS; i++)
+    {
+      key = numbered_key (i);
+      missing_dir_cache_add (cache, key);
+      g_free (key);
+    }
+
+  /* Touch the oldest one so the second oldest gets evicted instead */
+  key = numbered_key (0);
+  check (missing_dir_cache_contains (cache, key),
+         "%s not found in a full cache", key);
+  g_free (key);
+
+  key = numbered_key (MISSING_DIR_CACHE_MAX_KEYS);
+  missing_dir_cache_add (cache, key);
+  check (missing_dir_cache_contains (cache, key),
+         "%s not found after adding it to a full cache", key);
+  g_free (key);
+
+  key = numbered_key (1);
+  check (!missing_dir_cache_contains (cache, key),
+         "least recently used key %s wasn't evicted", key);
+  g_free (key);
+
+  key = numbered_key (0);
+  check (missing_dir_cache_contains (cache, key),
+         "recently used key %s was evicted", key);
+  g_free (key);
+
+  /* Cycle enough keys through to force the filter to be rebuilt,
+   * and make sure it still knows about the ones we kept
+   */
+  for (i = 0; i < MISSING_DIR_CACHE_MAX_KEYS * 4; i++)
+    {
+      key = numbered_key (MISSING_DIR_CACHE_MAX_KEYS + 1 + i);
+      missing_dir_cache_add (cache, key);
+      g_free (key);
+    }
+
+  for (i = 0; i < MISSING_DIR_CACHE_MAX_KEYS; i++)
+    {
+      key = numbered_key (MISSING_DIR_CACHE_MAX_KEYS * 5 - i);
+      check (missing_dir_cache_contains (cache, key),
+             "%s lost after rebuilding the filter", key);
+      g_free (key);
+    }
+
+  key = numbered_key (0);
+  check (!missing_dir_cache_contains (cache, key),
+         "%s survived %d newer keys", key, MISSING_DIR_CACHE_MAX_KEYS * 4);
+  g_free (key);
+
+  missing_dir_cache_free (cache);
+}
+
+static void
+check_forget_on_create (void)
+{
+  MissingDirCache *cache;
+
+  cache = missing_dir_cache_new ();
+
+  missing_dir_cache_add (cache, "/");
+  missing_dir_cache_add (cache, "/apps");
+  missing_dir_cache_add (cache, "/apps/foo");
+  missing_dir_cache_add (cache, "/apps/foo/bar");
+  missing_dir_cache_add (cache, "/apps/foo/bar/baz");
+  missing_dir_cache_add (cache, "/apps/foobar");
+  missing_dir_cache_add (cache, "/desktop");
+
+  /* Creating /apps/foo/bar means it and its parents exist now */
+  missing_dir_cache_forget (cache, "/apps/foo/bar");
+
+  check (!missing_dir_cache_contains (cache, "/apps/foo/bar"),
+         "created dir /apps/foo/bar still missing");
+  check (!missing_dir_cache_contains (cache, "/apps/foo"),
+         "parent /apps/foo of a created dir still missing");
+  check (!missing_dir_cache_contains (cache, "/apps"),
+         "parent /apps of a created dir still missing");
+  check (!missing_dir_cache_contains (cache, "/"),
+         "root still missing after creating a dir");
+
+  check (missing_dir_cache_contains (cache, "/apps/foo/bar/baz"),
+         "child /apps/foo/bar/baz of a created dir forgotten");
+  check (missing_dir_cache_contains (cache, "/apps/foobar"),
+         "sibling /apps/foobar of a created dir's parent forgotten");
+  check (missing_dir_cache_contains (cache, "/desktop"),
+         "unrelated /desktop forgotten");
+
+  missing_dir_cache_free (cache);
+}
+
+int
+main (int argc, char** argv)
+{
+  printf("\nChecking negative hits:");
+
+  check_negative_hits();
+
+  printf("\nChecking eviction:");
+
+  check_eviction();
+
+  printf("\nChecking invalidation on create:");
+
+  check_forget_on_create();
+
+  printf("\n\n");
+
+  return 0;
+}
@@ -0,0 +1,251 @@
+/* GConf
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "missing-dir-cache.h"
+
+#include <string.h>
+
+/* The keys themselves live in an LRU list with a hash for lookup.
+ * In front of that sits a small bloom filter, so the common case of
+ * a directory we know nothing about is answered without touching
+ * the hash table. The filter can't forget single keys, so it is
+ * rebuilt from the LRU once enough keys have gone through it.
+ */
+
+#define MAX_KEYS MISSING_DIR_CACHE_MAX_KEYS
+
+#define BLOOM_BITS 8192 /* 16 bits per key, power of two */
+#define BLOOM_HASHES 3
+
+/* Rebuild the filter after this many insertions */
+#define BLOOM_MAX_ADDED (MAX_KEYS * 2)
+
+struct _MissingDirCache
+{
+  /* Most recently used first; data is the key */
+  GQueue *lru;
+  /* key -> GList link in lru */
+  GHashTable *links;
+
+  guint32 bloom[BLOOM_BITS / 32];
+  guint bloom_added;
+};
+
+static void
+hash_key (const char *key,
+          guint32    *h1,
+          guint32    *h2)
+{
+  const unsigned char *p;
+  guint32 a = 5381;       /* djb2 */
+  guint32 b = 2166136261u; /* FNV-1a */
+
+  for (p = (const unsigned char *) key; *p != '\0'; p++)
+    {
+      a = (a << 5) + a + *p;
+      b = (b ^ *p) * 16777619u;
+    }
+
+  *h1 = a;
+  *h2 = b | 1; /* odd, so the probes don't collapse */
+}
+
+static void
+bloom_add (MissingDirCache *cache,
+           const char      *key)
+{
+  guint32 h1, h2;
+  int i;
+
+  hash_key (key, &h1, &h2);
+
+  for (i = 0; i < BLOOM_HASHES; i++)
+    {
+      guint32 bit = (h1 + i * h2) & (BLOOM_BITS - 1);
+
+      cache->bloom[bit / 32] |= 1u << (bit % 32);
+    }
+
+  cache->bloom_added += 1;
+}
+
+static gboolean
+bloom_maybe_contains (MissingDirCache *cache,
+                      const char      *key)
+{
+  guint32 h1, h2;
+  int i;
+
+  hash_key (key, &h1, &h2);
+
+  for (i = 0; i < BLOOM_HASHES; i++)
+    {
+      guint32 bit = (h1 + i * h2) & (BLOOM_BITS - 1);
+
+      if ((cache->bloom[bit / 32] & (1u << (bit % 32))) == 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+bloom_rebuild (MissingDirCache *cache)
+{
+  GList *tmp;
+
+  memset (cache->bloom, 0, sizeof (cache->bloom));
+  cache->bloom_added = 0;
+
+  for (tmp = cache->lru->head; tmp != NULL; tmp = tmp->next)
+    bloom_add (cache, tmp->data);
+}
+
+MissingDirCache*
+missing_dir_cache_new (void)
+{
+  MissingDirCache *cache;
+
+  cache = g_new0 (MissingDirCache, 1);
+
+  cache->lru = g_queue_new ();
+  cache->links = g_hash_table_new (g_str_hash, g_str_equal);
+
+  return cache;
+}
+
+void
+missing_dir_cache_free (MissingDirCache *cache)
+{
+  g_return_if_fail (cache != NULL);
+
+  missing_dir_cache_clear (cache);
+
+  g_queue_free (cache->lru);
+  g_hash_table_destroy (cache->links);
+
+  g_free (cache);
+}
+
+gboolean
+missing_dir_cache_contains (MissingDirCache *cache,
+                            const char      *key)
+{
+  GList *link;
+
+  if (!bloom_maybe_contains (cache, key))
+    return FALSE;
+
+  link = g_hash_table_lookup (cache->links, key);
+  if (link == NULL)
+    return FALSE;
+
+  /* Move to the front */
+  g_queue_unlink (cache->lru, link);
+  g_queue_push_head_link (cache->lru, link);
+
+  return TRUE;
+}
+
+void
+missing_dir_cache_add (MissingDirCache *cache,
+                       const char      *key)
+{
+  GList *link;
+
+  if (missing_dir_cache_contains (cache, key))
+    return;
+
+  if (cache->lru->length >= MAX_KEYS)
+    {
+      char *oldest;
+
+      oldest = g_queue_pop_tail (cache->lru);
+      g_hash_table_remove (cache->links, oldest);
+      g_free (oldest);
+    }
+
+  link = g_list_alloc ();
+  link->data = g_strdup (key);
+  g_queue_push_head_link (cache->lru, link);
+  g_hash_table_insert (cache->links, link->data, link);
+
+  if (cache->bloom_added >= BLOOM_MAX_ADDED)
+    bloom_rebuild (cache);
+  else
+    bloom_add (cache, key);
+}
+
+static void
+forget_one (MissingDirCache *cache,
+            const char      *key)
+{
+  GList *link;
+
+  if (!bloom_maybe_contains (cache, key))
+    return;
+
+  link = g_hash_table_lookup (cache->links, key);
+  if (link == NULL)
+    return;
+
+  g_hash_table_remove (cache->links, key);
+  g_free (link->data);
+  g_queue_delete_link (cache->lru, link);
+}
+
+void
+missing_dir_cache_forget (MissingDirCache *cache,
+                          const char      *key)
+{
+  char *parent;
+  char *slash;
+
+  g_return_if_fail (key != NULL);
+
+  if (cache->lru->length == 0)
+    return;
+
+  forget_one (cache, key);
+
+  /* If a directory exists, so do all its parents */
+  parent = g_strdup (key);
+  while ((slash = strrchr (parent, '/')) != NULL && slash != parent)
+    {
+      *slash = '\0';
+      forget_one (cache, parent);
+    }
+  g_free (parent);
+
+  forget_one (cache, "/");
+}
+
+void
+missing_dir_cache_clear (MissingDirCache *cache)
+{
+  char *key;
+
+  while ((key = g_queue_pop_head (cache->lru)) != NULL)
+    g_free (key);
+
+  g_hash_table_destroy (cache->links);
+  cache->links = g_hash_table_new (g_str_hash, g_str_equal);
+
+  memset (cache->bloom, 0, sizeof (cache->bloom));
+  cache->bloom_added = 0;
+}
@@ -0,0 +1,47 @@
+/* GConf
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GCONF_MISSING_DIR_CACHE_H
+#define GCONF_MISSING_DIR_CACHE_H
+
+#include <glib.h>
+
+/* Remembers a bounded number of directory keys that were looked up
+ * and found not to exist, so backends don't have to go to the disk
+ * again for them. Only the most recently used ones are kept, so
+ * clients probing lots of random keys can't grow it forever.
+ */
+
+/* How many keys are remembered at most */
+#define MISSING_DIR_CACHE_MAX_KEYS 512
+
+typedef struct _MissingDirCache MissingDirCache;
+
+MissingDirCache* missing_dir_cache_new      (void);
+void             missing_dir_cache_free     (MissingDirCache *cache);
+
+gboolean         missing_dir_cache_contains (MissingDirCache *cache,
+                                             const char      *key);
+void             missing_dir_cache_add      (MissingDirCache *cache,
+                                             const char      *key);
+/* Forgets key and all its parents, call when key starts to exist */
+void             missing_dir_cache_forget   (MissingDirCache *cache,
+                                             const char      *key);
+void             missing_dir_cache_clear    (MissingDirCache *cache);
+
+#endif
@@ -207,6 +207,26 @@ static void          clear_cache     (GConfSource* source);
 
 static void          blow_away_locks (const char *address);
 
+static void          query_values    (GConfSource* source,
+                                      const gchar** keys,
+                                      guint n_keys,
+                                      const gchar** locales,
+                                      GConfValue** values,
+                                      gchar** schema_names,
+                                      GError** err);
+
+static void          set_values      (GConfSource* source,
+                                      const gchar** keys,
+                                      GConfValue* const* values,
+                                      guint n_keys,
+                                      GError** err);
+
+static void          unset_values    (GConfSource* source,
+                                      const gchar** keys,
+                                      guint n_keys,
+                                      const gchar* locale,
+                                      GError** err);
+
 static GConfBackendVTable xml_vtable = {
   sizeof (GConfBackendVTable),
   x_shutdown,
@@ -230,7 +250,10 @@ static GConfBackendVTable xml_vtable = {
   blow_away_locks,
   NULL, /* set_notify_func */
   NULL, /* add_listener    */
-  NULL  /* remove_listener */
+  NULL, /* remove_listener */
+  query_values,
+  set_values,
+  unset_values
 };
 
 static void          
@@ -660,6 +683,158 @@ unset_value     (GConfSource* source,
     }
 }
 
+/* The directory of the last key looked up, so runs of keys in one
+   directory only go through the cache once */
+typedef struct {
+  gchar* parent;
+  Dir* dir;
+  gboolean created;
+} DirCursor;
+
+static Dir*
+cursor_lookup_dir (XMLSource* xs, DirCursor* cursor, const gchar* key,
+                   gboolean create_if_missing, GError** err)
+{
+  const gchar* slash;
+  gsize parent_len;
+
+  slash = strrchr(key, '/');
+  g_assert(slash != NULL);
+
+  /* The parent of "/foo" is "/" */
+  parent_len = slash == key ? 1 : (gsize)(slash - key);
+
+  if (cursor->parent != NULL &&
+      strlen(cursor->parent) == parent_len &&
+      strncmp(cursor->parent, key, parent_len) == 0 &&
+      (cursor->created || !create_if_missing))
+    return cursor->dir;
+
+  g_free(cursor->parent);
+  cursor->parent = g_strndup(key, parent_len);
+  cursor->dir = cache_lookup(xs->cache, cursor->parent, create_if_missing, err);
+  cursor->created = create_if_missing && cursor->dir != NULL;
+
+  return cursor->dir;
+}
+
+static void
+query_values (GConfSource* source,
+              const gchar** keys,
+              guint n_keys,
+              const gchar** locales,
+              GConfValue** values,
+              gchar** schema_names,
+              GError** err)
+{
+  XMLSource* xs = (XMLSource*)source;
+  DirCursor cursor = { NULL, NULL, FALSE };
+  guint i;
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      GError* error = NULL;
+      Dir* dir;
+
+      values[i] = NULL;
+      if (schema_names)
+        schema_names[i] = NULL;
+
+      dir = cursor_lookup_dir(xs, &cursor, keys[i], FALSE, &error);
+
+      /* Like query_value(), only log these */
+      if (error != NULL)
+        {
+          gconf_log(GCL_WARNING, "%s", error->message);
+          g_error_free(error);
+          error = NULL;
+        }
+
+      if (dir == NULL)
+        continue;
+
+      values[i] = dir_get_value(dir, gconf_key_key(keys[i]), locales,
+                                schema_names ? &schema_names[i] : NULL,
+                                &error);
+
+      if (error != NULL)
+        {
+          gconf_log(GCL_WARNING, "%s", error->message);
+          g_error_free(error);
+        }
+    }
+
+  g_free(cursor.parent);
+}
+
+static void
+set_values (GConfSource* source,
+            const gchar** keys,
+            GConfValue* const* values,
+            guint n_keys,
+            GError** err)
+{
+  XMLSource* xs = (XMLSource*)source;
+  DirCursor cursor = { NULL, NULL, FALSE };
+  guint i;
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      GError* error = NULL;
+      Dir* dir;
+
+      dir = cursor_lookup_dir(xs, &cursor, keys[i], TRUE, &error);
+
+      if (dir != NULL)
+        dir_set_value(dir, gconf_key_key(keys[i]), values[i], &error);
+
+      if (error != NULL)
+        {
+          if (err && *err == NULL)
+            g_propagate_error(err, error);
+          else
+            g_error_free(error);
+        }
+    }
+
+  g_free(cursor.parent);
+}
+
+static void
+unset_values (GConfSource* source,
+              const gchar** keys,
+              guint n_keys,
+              const gchar* locale,
+              GError** err)
+{
+  XMLSource* xs = (XMLSource*)source;
+  DirCursor cursor = { NULL, NULL, FALSE };
+  guint i;
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      GError* error = NULL;
+      Dir* dir;
+
+      gconf_log(GCL_DEBUG, "XML backend: unset value `%s'", keys[i]);
+
+      dir = cursor_lookup_dir(xs, &cursor, keys[i], FALSE, &error);
+
+      if (dir != NULL)
+        dir_unset_value(dir, gconf_key_key(keys[i]), locale, &error);
+
+      if (error != NULL)
+        {
+          if (err && *err == NULL)
+            g_propagate_error(err, error);
+          else
+            g_error_free(error);
+        }
+    }
+
+  g_free(cursor.parent);
+}
+
 static gboolean
 dir_exists      (GConfSource*source,
                  const gchar* key,
@@ -18,6 +18,7 @@
  */
 
 #include "xml-cache.h"
+#include "missing-dir-cache.h"
 #include <gconf/gconf-internals.h>
 
 #include <string.h>
@@ -45,13 +46,6 @@ safe_g_hash_table_insert(GHashTable* ht, gpointer key, gpointer value)
 }
 #endif
 
-static gboolean cache_is_nonexistent    (Cache       *cache,
-                                         const gchar *key);
-static void     cache_set_nonexistent   (Cache       *cache,
-                                         const gchar *key,
-                                         gboolean     setting);
-static void     cache_unset_nonexistent (Cache       *cache,
-                                         const gchar *key);
 static void     cache_insert          (Cache       *cache,
                                        Dir         *d);
 
@@ -59,13 +53,16 @@ static void     cache_remove_from_parent (Cache *cache,
                                           Dir   *d);
 static void     cache_add_to_parent      (Cache *cache,
                                           Dir   *d);
+static void     cache_dir_dirty          (Dir      *d,
+                                          gpointer  data);
 
 static GHashTable *caches_by_root_dir = NULL;
 
 struct _Cache {
   gchar* root_dir;
   GHashTable* cache;
-  GHashTable* nonexistent_cache;
+  MissingDirCache* nonexistent_cache;
+  GHashTable* dirty; /* Dir* with a sync pending; subset of cache */
   guint dir_mode;
   guint file_mode;
   guint refcount;
@@ -94,8 +91,8 @@ cache_get (const gchar  *root_dir,
   cache->root_dir = g_strdup(root_dir);
 
   cache->cache = g_hash_table_new(g_str_hash, g_str_equal);
-  cache->nonexistent_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                                   g_free, NULL);
+  cache->nonexistent_cache = missing_dir_cache_new();
+  cache->dirty = g_hash_table_new (NULL, NULL);
 
   cache->dir_mode = dir_mode;
   cache->file_mode = file_mode;
@@ -132,7 +129,8 @@ cache_unref (Cache *cache)
   g_hash_table_foreach(cache->cache, (GHFunc)cache_destroy_foreach,
                        NULL);
   g_hash_table_destroy(cache->cache);
-  g_hash_table_destroy(cache->nonexistent_cache);
+  missing_dir_cache_free(cache->nonexistent_cache);
+  g_hash_table_destroy(cache->dirty);
   
   g_free(cache);
 }
@@ -142,7 +140,7 @@ typedef struct _SyncData SyncData;
 struct _SyncData {
   gboolean failed;
   Cache* dc;
-  gboolean deleted_some;
+  GSList *retry;
 };
 
 static void
@@ -166,6 +164,13 @@ cache_sync_foreach (Dir      *dir,
   if (!dir_sync (dir, &deleted, &error))
     {
       sd->failed = TRUE;
+      /* Still dirty, but dir_mark_dirty() won't report it again
+       * since the flag never got cleared. Put it back in the dirty
+       * set once we're done, so the next sync retries it; doing it
+       * right away would retry it in a loop for as long as the disk
+       * keeps failing.
+       */
+      sd->retry = g_slist_prepend (sd->retry, dir);
       g_return_if_fail (error != NULL);
       gconf_log (GCL_ERR, "%s", error->message);
       g_error_free (error);
@@ -182,11 +187,9 @@ cache_sync_foreach (Dir      *dir,
           cache_remove_from_parent (sd->dc, dir);
           g_hash_table_remove (sd->dc->cache,
                                dir_get_name (dir));
-          cache_set_nonexistent (sd->dc, dir_get_name (dir),
-                                 TRUE);
+          missing_dir_cache_add (sd->dc->nonexistent_cache,
+                                 dir_get_name (dir));
           dir_destroy (dir);
-
-          sd->deleted_some = TRUE;
         }
     }
 }
@@ -248,37 +251,42 @@ gboolean
 cache_sync (Cache    *cache,
             GError  **err)
 {
-  SyncData sd = { FALSE, NULL, FALSE };
+  SyncData sd = { FALSE, NULL, NULL };
   GSList *list;
+  GSList *tmp;
   
   sd.dc = cache;
 
-  gconf_log (GCL_DEBUG, "Syncing the dir cache");
+  gconf_log (GCL_DEBUG, "Syncing the dir cache (%u dirs pending)",
+             g_hash_table_size (cache->dirty));
 
- redo:
-  sd.failed = FALSE;
-  sd.deleted_some = FALSE;
-  
-  /* get a list of everything; we can't filter by
-   * whether a sync is pending since we may make parents
-   * of removed directories dirty when we sync their child
-   * dir.
+  /* Only dirs with a sync pending are in cache->dirty. Syncing a
+   * dir that turns out to be empty deletes it and dirties its
+   * parent, which lands in the dirty set again; keep going until
+   * nothing new gets dirty.
    */
-  list = NULL;
-  g_hash_table_foreach (cache->cache, (GHFunc)listify_foreach, &list);
+  while (g_hash_table_size (cache->dirty) > 0)
+    {
+      list = NULL;
+      g_hash_table_foreach (cache->dirty, (GHFunc)listify_foreach, &list);
+      g_hash_table_destroy (cache->dirty);
+      cache->dirty = g_hash_table_new (NULL, NULL);
 
-  /* sort subdirs before parents */
-  list = g_slist_sort (list, dircmp);
+      /* sort subdirs before parents */
+      list = g_slist_sort (list, dircmp);
 
-  /* sync it all */
-  g_slist_foreach (list, (GFunc) cache_sync_foreach, &sd);
+      g_slist_foreach (list, (GFunc) cache_sync_foreach, &sd);
 
-  /* If we deleted some subdirs, we may now be able to delete
-   * more parent dirs. So go ahead and do the sync again.
-   * Yeah this could be more efficient.
-   */
-  if (!sd.failed && sd.deleted_some)
-    goto redo;
+      g_slist_free (list);
+    }
+
+  tmp = sd.retry;
+  while (tmp != NULL)
+    {
+      g_hash_table_insert (cache->dirty, tmp->data, tmp->data);
+      tmp = tmp->next;
+    }
+  g_slist_free (sd.retry);
   
   if (sd.failed && err && *err == NULL)
     {
@@ -369,7 +377,7 @@ cache_lookup     (Cache        *cache,
     {
       /* Not in cache, check whether we already failed
          to load it */
-      if (cache_is_nonexistent(cache, key))
+      if (missing_dir_cache_contains(cache->nonexistent_cache, key))
         {
           if (!create_if_missing)
             return NULL;
@@ -394,7 +402,7 @@ cache_lookup     (Cache        *cache,
               /* Remember that we failed to load it */
               if (!create_if_missing)
                 {
-                  cache_set_nonexistent(cache, key, TRUE);
+                  missing_dir_cache_add(cache->nonexistent_cache, key);
               
                   return NULL;
                 }
@@ -433,57 +441,14 @@ cache_lookup     (Cache        *cache,
         {
           cache_insert (cache, dir);
           cache_add_to_parent (cache, dir);
-          cache_unset_nonexistent (cache, dir_get_name (dir));
+          missing_dir_cache_forget (cache->nonexistent_cache,
+                                    dir_get_name (dir));
         }
     }
 
   return dir;
 }
 
-static gboolean
-cache_is_nonexistent(Cache* cache,
-                     const gchar* key)
-{
-  return GPOINTER_TO_INT(g_hash_table_lookup(cache->nonexistent_cache,
-                                             key));
-}
-
-static void
-cache_set_nonexistent   (Cache* cache,
-                         const gchar* key,
-                         gboolean setting)
-{
-  if (setting)
-    {
-      /* don't use safe_ here, doesn't matter */
-      g_hash_table_insert(cache->nonexistent_cache,
-                          g_strdup(key),
-                          GINT_TO_POINTER(TRUE));
-    }
-  else
-    g_hash_table_remove(cache->nonexistent_cache, key);
-}
-
-static void
-cache_unset_nonexistent (Cache       *cache,
-                         const gchar *key)
-{
-  char *parent_key;
-
-  g_return_if_fail (key != NULL);
-
-  cache_set_nonexistent (cache, key, FALSE);
-
-  if (strcmp (key, "/") == 0)
-    return;
-
-  parent_key = gconf_key_directory (key);
-
-  cache_unset_nonexistent (cache, parent_key);
-
-  g_free (parent_key);
-}
-
 static void
 cache_insert (Cache* cache,
               Dir* d)
@@ -493,6 +458,19 @@ cache_insert (Cache* cache,
   gconf_log(GCL_DEBUG, "Caching dir %s", dir_get_name(d));
   
   safe_g_hash_table_insert(cache->cache, (gchar*)dir_get_name(d), d);
+
+  dir_set_dirty_func (d, cache_dir_dirty, cache);
+  if (dir_sync_pending (d))
+    g_hash_table_insert (cache->dirty, d, d);
+}
+
+static void
+cache_dir_dirty (Dir      *d,
+                 gpointer  data)
+{
+  Cache *cache = data;
+
+  g_hash_table_insert (cache->dirty, d, d);
 }
 
 static void
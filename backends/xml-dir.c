@@ -70,13 +70,21 @@ struct _Dir {
   gchar* xml_filename;
   guint root_dir_len;
   GTime last_access; /* so we know when to un-cache */
-  xmlDocPtr doc;
   GHashTable* entry_cache; /* store key-value entries */
+  /* Copies of the toplevel nodes we couldn't load, written back
+   * untouched on sync; unparsed_entries maps the entry names
+   * among them to their node. NULL until needed.
+   */
+  xmlDocPtr unparsed;
+  GHashTable* unparsed_entries;
   guint dir_mode;
   guint file_mode;
   GSList *subdir_names;
+  DirDirtyFunc dirty_func;
+  gpointer dirty_data;
   guint dirty : 1;
   guint need_rescan_subdirs : 1;
+  guint entries_loaded : 1;
 };
 
 static void
@@ -86,6 +94,8 @@ static Entry* dir_make_new_entry(Dir* d, const gchar* relative_key);
 
 static gboolean dir_forget_entry_if_useless(Dir* d, Entry* e);
 
+static void dir_mark_dirty (Dir *d);
+
 static Dir*
 dir_blank(const gchar* key)
 {
@@ -108,7 +118,6 @@ dir_blank(const gchar* key)
   d->parent_key = gconf_key_directory (key);
   
   d->last_access = time(NULL);
-  d->doc = NULL;
 
   d->entry_cache = g_hash_table_new (g_str_hash, g_str_equal);
   
@@ -239,8 +248,11 @@ dir_destroy(Dir* d)
   
   g_hash_table_destroy (d->entry_cache);
 
-  if (d->doc != NULL)
-    xmlFreeDoc (d->doc);
+  if (d->unparsed != NULL)
+    {
+      g_hash_table_destroy (d->unparsed_entries);
+      xmlFreeDoc (d->unparsed);
+    }
   
   g_free (d);
 }
@@ -272,9 +284,112 @@ dir_ensure_exists (Dir* d,
 }
 
 static void
-entry_sync_foreach(const gchar* name, Entry* e, gpointer data)
+listify_entry_foreach (const gchar *name,
+                       Entry       *e,
+                       GSList     **list)
+{
+  *list = g_slist_prepend (*list, e);
+}
+
+static int
+entrycmp (gconstpointer a,
+          gconstpointer b)
+{
+  return strcmp (entry_get_name ((Entry*) a), entry_get_name ((Entry*) b));
+}
+
+/* We don't keep the parsed document around, so build a new
+ * one from the entries each time we save.
+ */
+static xmlDocPtr
+dir_build_doc (Dir *d)
+{
+  xmlDocPtr doc;
+  GSList *entries;
+  GSList *tmp;
+
+  doc = xmlNewDoc ("1.0");
+  doc->xmlRootNode = xmlNewDocNode (doc, NULL, "gconf", NULL);
+
+  /* sort so that the file doesn't get shuffled on every save */
+  entries = NULL;
+  g_hash_table_foreach (d->entry_cache, (GHFunc) listify_entry_foreach,
+                        &entries);
+  entries = g_slist_sort (entries, entrycmp);
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      /* Written out below as it was in the file */
+      if (d->unparsed != NULL &&
+          g_hash_table_lookup (d->unparsed_entries,
+                               entry_get_name (tmp->data)) != NULL)
+        continue;
+
+      entry_sync_to_node (tmp->data,
+                          xmlNewChild (doc->xmlRootNode, NULL, "entry", NULL));
+    }
+
+  g_slist_free (entries);
+
+  if (d->unparsed != NULL)
+    {
+      xmlNodePtr node;
+
+      for (node = d->unparsed->xmlRootNode->xmlChildrenNode;
+           node != NULL;
+           node = node->next)
+        xmlAddChild (doc->xmlRootNode, xmlDocCopyNode (node, doc, 1));
+    }
+
+  return doc;
+}
+
+/* Hang on to a node we couldn't make sense of, so that rewriting
+ * the file doesn't lose it
+ */
+static void
+dir_keep_unparsed (Dir        *d,
+                   xmlNodePtr  node,
+                   const char *entry_name)
+{
+  xmlNodePtr copy;
+
+  if (d->unparsed == NULL)
+    {
+      d->unparsed = xmlNewDoc ("1.0");
+      d->unparsed->xmlRootNode = xmlNewDocNode (d->unparsed, NULL,
+                                                "gconf", NULL);
+      d->unparsed_entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, NULL);
+    }
+
+  copy = xmlDocCopyNode (node, d->unparsed, 1);
+  xmlAddChild (d->unparsed->xmlRootNode, copy);
+
+  if (entry_name != NULL &&
+      g_hash_table_lookup (d->unparsed_entries, entry_name) == NULL)
+    g_hash_table_insert (d->unparsed_entries, g_strdup (entry_name), copy);
+}
+
+/* The key is being replaced, so its old node can go */
+static gboolean
+dir_forget_unparsed (Dir        *d,
+                     const char *entry_name)
 {
-  entry_sync_to_node(e);
+  xmlNodePtr node;
+
+  if (d->unparsed == NULL)
+    return FALSE;
+
+  node = g_hash_table_lookup (d->unparsed_entries, entry_name);
+  if (node == NULL)
+    return FALSE;
+
+  g_hash_table_remove (d->unparsed_entries, entry_name);
+  xmlUnlinkNode (node);
+  xmlFreeNode (node);
+
+  return TRUE;
 }
 
 gboolean
@@ -283,6 +398,27 @@ dir_sync_pending (Dir *d)
   return d->dirty;
 }
 
+void
+dir_set_dirty_func (Dir          *d,
+                    DirDirtyFunc  func,
+                    gpointer      user_data)
+{
+  d->dirty_func = func;
+  d->dirty_data = user_data;
+}
+
+static void
+dir_mark_dirty (Dir *d)
+{
+  if (d->dirty)
+    return;
+
+  d->dirty = TRUE;
+
+  if (d->dirty_func)
+    (* d->dirty_func) (d, d->dirty_data);
+}
+
 void
 dir_child_removed (Dir        *d,
                    const char *child_name)
@@ -292,7 +428,7 @@ dir_child_removed (Dir        *d,
   /* dirty because we need to consider removing
    * this directory, it may have become empty.
    */
-  d->dirty = TRUE;
+  dir_mark_dirty (d);
   
   if (d->need_rescan_subdirs)
     return; /* subdir_names is totally invalid anyhow */
@@ -333,7 +469,7 @@ dir_child_added (Dir        *d,
 static gboolean
 dir_useless (Dir *d)
 {
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     dir_load_doc (d, NULL);
 
   if (d->need_rescan_subdirs)
@@ -341,7 +477,9 @@ dir_useless (Dir *d)
   
   return
     d->subdir_names == NULL &&
-    g_hash_table_size (d->entry_cache) == 0;
+    g_hash_table_size (d->entry_cache) == 0 &&
+    (d->unparsed == NULL ||
+     d->unparsed->xmlRootNode->xmlChildrenNode == NULL);
 }
 
 /* for info on why this is used rather than xmlDocDump or xmlSaveFile
@@ -438,13 +576,12 @@ dir_sync (Dir      *d,
       gchar* tmp_filename;
       gchar* old_filename;
       FILE* outfile;
+      xmlDocPtr doc;
 
-      /* We should have a doc if deleted is FALSE */
-      g_assert(d->doc != NULL);
+      /* We should have loaded the entries if deleted is FALSE */
+      g_assert(d->entries_loaded);
       
-      /* First make sure entry values are synced to their
-         XML nodes */
-      g_hash_table_foreach(d->entry_cache, (GHFunc)entry_sync_foreach, NULL);
+      doc = dir_build_doc (d);
       
       tmp_filename = g_strconcat(d->fs_dirname, "/%gconf.xml.tmp", NULL);
       old_filename = g_strconcat(d->fs_dirname, "/%gconf.xml.old", NULL);
@@ -491,7 +628,7 @@ dir_sync (Dir      *d,
         }
 #endif
 
-      if (gconf_xml_doc_dump (outfile, d->doc) < 0)
+      if (gconf_xml_doc_dump (outfile, doc) < 0)
         {
           gconf_set_error (err, GCONF_ERROR_FAILED, 
                            _("Failed to write XML data to `%s': %s"),
@@ -570,6 +707,7 @@ dir_sync (Dir      *d,
 
     failed_end_of_sync:
       
+      xmlFreeDoc(doc);
       g_free(old_filename);
       g_free(tmp_filename);
       if (outfile)
@@ -588,10 +726,10 @@ dir_set_value (Dir* d, const gchar* relative_key,
 {
   Entry* e;
   
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     dir_load_doc(d, err);
 
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     {
       g_return_if_fail( (err == NULL) || (*err != NULL) );
       return;
@@ -602,6 +740,8 @@ dir_set_value (Dir* d, const gchar* relative_key,
   if (e == NULL)
     e = dir_make_new_entry(d, relative_key);
 
+  dir_forget_unparsed (d, relative_key);
+
   entry_set_value(e, value);
 
   d->last_access = time(NULL);
@@ -609,7 +749,7 @@ dir_set_value (Dir* d, const gchar* relative_key,
 
   entry_set_mod_user(e, g_get_user_name());
   
-  d->dirty = TRUE;
+  dir_mark_dirty (d);
 }
 
 GTime
@@ -627,10 +767,10 @@ dir_get_value   (Dir* d,
 {
   Entry* e;
   
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     dir_load_doc(d, err);
 
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     {
       g_return_val_if_fail( (err == NULL) || (*err != NULL), NULL );
       return NULL;
@@ -686,10 +826,10 @@ dir_get_metainfo(Dir* d, const gchar* relative_key, GError** err)
   
   d->last_access = time(NULL);
   
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     dir_load_doc(d, err);
 
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     {
       g_return_val_if_fail( (err == NULL) || (*err != NULL), NULL );
       return NULL;
@@ -711,15 +851,18 @@ dir_unset_value (Dir* d, const gchar* relative_key,
   
   d->last_access = time(NULL);
   
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     dir_load_doc(d, err);
 
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     {
       g_return_if_fail( (err == NULL) || (*err != NULL) );
       return;
     }
   
+  if (dir_forget_unparsed (d, relative_key))
+    dir_mark_dirty (d);
+
   e = g_hash_table_lookup(d->entry_cache, relative_key);
   
   if (e == NULL)     /* nothing to change */
@@ -730,7 +873,7 @@ dir_unset_value (Dir* d, const gchar* relative_key,
       /* If entry_unset() returns TRUE then
          the entry was changed (not already unset) */
       
-      d->dirty = TRUE;
+      dir_mark_dirty (d);
       
       if (dir_forget_entry_if_useless(d, e))
         {
@@ -792,10 +935,10 @@ dir_all_entries (Dir* d, const gchar** locales, GError** err)
 {
   ListifyData ld;
   
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     dir_load_doc(d, err);
 
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     {
       g_return_val_if_fail( (err == NULL) || (*err != NULL), NULL );
       return NULL;
@@ -842,10 +985,10 @@ dir_rescan_subdirs (Dir* d, GError** err)
   guint len;
   guint subdir_len;
   
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     dir_load_doc (d, err);
   
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     {
       g_return_val_if_fail ((err == NULL) || (*err != NULL), FALSE);
       return FALSE;
@@ -932,16 +1075,16 @@ dir_set_schema  (Dir         *d,
 {
   Entry* e;
 
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     dir_load_doc (d, err);
 
-  if (d->doc == NULL)
+  if (!d->entries_loaded)
     {
       g_return_if_fail ((err == NULL) || (*err != NULL));
       return;
     }
   
-  d->dirty = TRUE;
+  dir_mark_dirty (d);
   d->last_access = time (NULL);
   
   e = g_hash_table_lookup (d->entry_cache, relative_key);
@@ -953,6 +1096,16 @@ dir_set_schema  (Dir         *d,
 
   entry_set_schema_name (e, schema_key);
 
+  /* Keep the node we couldn't load in step with the entry */
+  if (d->unparsed != NULL)
+    {
+      xmlNodePtr node;
+
+      node = g_hash_table_lookup (d->unparsed_entries, relative_key);
+      if (node != NULL)
+        my_xmlSetProp (node, "schema", schema_key);
+    }
+
   if (schema_key == NULL)
     dir_forget_entry_if_useless (d, e);
 }
@@ -966,7 +1119,7 @@ dir_last_access (Dir* d)
 /* private Dir functions */
 
 static void
-dir_fill_cache_from_doc(Dir* d);
+dir_fill_cache_from_doc(Dir* d, xmlDocPtr doc);
 
 static void
 dir_load_doc(Dir* d, GError** err)
@@ -974,8 +1127,9 @@ dir_load_doc(Dir* d, GError** err)
   gboolean xml_already_exists = TRUE;
   gboolean need_backup = FALSE;
   struct stat statbuf;
+  xmlDocPtr doc = NULL;
   
-  g_return_if_fail(d->doc == NULL);
+  g_return_if_fail(!d->entries_loaded);
 
   if (stat(d->xml_filename, &statbuf) < 0)
     {
@@ -1013,7 +1167,7 @@ dir_load_doc(Dir* d, GError** err)
 
       error_was_fatal = FALSE;
       tmp_err = NULL;
-      d->doc = my_xml_parse_file (d->xml_filename, &tmp_err);
+      doc = my_xml_parse_file (d->xml_filename, &tmp_err);
 
       if (tmp_err != NULL)
         {
@@ -1031,7 +1185,11 @@ dir_load_doc(Dir* d, GError** err)
         }
 
       if (error_was_fatal)
-        return;
+        {
+          if (doc != NULL)
+            xmlFreeDoc (doc);
+          return;
+        }
     }
   
   /* We recover from parse errors instead of passing them up */
@@ -1049,35 +1207,30 @@ dir_load_doc(Dir* d, GError** err)
    * by the statbuf.st_size == 0 check above.
    */
   
-  if (d->doc == NULL)
+  if (doc == NULL)
     {
       if (xml_already_exists)
         need_backup = TRUE; /* rather uselessly save whatever broken stuff was in the file */
-          
-      /* Create a new doc */
-      
-      d->doc = xmlNewDoc("1.0");
     }
-  
-  if (d->doc->xmlRootNode == NULL)
+  else if (doc->xmlRootNode == NULL)
     {
-      /* fill it in */
-      d->doc->xmlRootNode = xmlNewDocNode(d->doc, NULL, "gconf", NULL);
+      /* nothing to load */
     }
-  else if (strcmp(d->doc->xmlRootNode->name, "gconf") != 0)
+  else if (strcmp(doc->xmlRootNode->name, "gconf") != 0)
     {
-      xmlFreeDoc(d->doc);
-      d->doc = xmlNewDoc("1.0");
-      d->doc->xmlRootNode = xmlNewDocNode(d->doc, NULL, "gconf", NULL);
       need_backup = TRUE; /* save broken stuff */
     }
   else
     {
       /* We had an initial doc with a valid root */
       /* Fill child_cache from entries */
-      dir_fill_cache_from_doc(d);
+      dir_fill_cache_from_doc(d, doc);
     }
 
+  /* The entries hold everything we need from here on */
+  if (doc != NULL)
+    xmlFreeDoc(doc);
+
   if (need_backup)
     {
       /* Back up the file we failed to parse, if it exists,
@@ -1099,9 +1252,8 @@ dir_load_doc(Dir* d, GError** err)
       
       g_free(backup);
     }
-  
-  g_assert(d->doc != NULL);
-  g_assert(d->doc->xmlRootNode != NULL);
+
+  d->entries_loaded = TRUE;
 }
 
 static Entry*
@@ -1109,12 +1261,9 @@ dir_make_new_entry(Dir* d, const gchar* relative_key)
 {
   Entry* e;
 
-  g_return_val_if_fail(d->doc != NULL, NULL);
-  g_return_val_if_fail(d->doc->xmlRootNode != NULL, NULL);
+  g_return_val_if_fail(d->entries_loaded, NULL);
   
   e = entry_new(relative_key);
-
-  entry_set_node(e, xmlNewChild(d->doc->xmlRootNode, NULL, "entry", NULL));
   
   safe_g_hash_table_insert(d->entry_cache, (gchar*)entry_get_name(e), e);
   
@@ -1142,19 +1291,19 @@ dir_forget_entry_if_useless(Dir* d, Entry* e)
 }
 
 static void
-dir_fill_cache_from_doc(Dir* d)
+dir_fill_cache_from_doc(Dir* d, xmlDocPtr doc)
 {
   xmlNodePtr node;
   
-  if (d->doc == NULL ||
-      d->doc->xmlRootNode == NULL ||
-      d->doc->xmlRootNode->xmlChildrenNode == NULL)
+  if (doc == NULL ||
+      doc->xmlRootNode == NULL ||
+      doc->xmlRootNode->xmlChildrenNode == NULL)
     {
       /* Empty document - just return. */
       return;
     }
 
-  node = d->doc->xmlRootNode->xmlChildrenNode;
+  node = doc->xmlRootNode->xmlChildrenNode;
 
   while (node != NULL)
     {
@@ -1170,16 +1319,16 @@ dir_fill_cache_from_doc(Dir* d)
                   gconf_log(GCL_WARNING,
                              _("Duplicate entry `%s' in `%s', ignoring"),
                              attr, d->xml_filename);
+                  dir_keep_unparsed (d, node, NULL);
                 }
               else
                 {
                   Entry* e;
                   
                   e = entry_new(attr);
-
-                  entry_set_node(e, node);
                   
-                  entry_fill_from_node(e);
+                  if (!entry_fill_from_node(e, node))
+                    dir_keep_unparsed (d, node, attr);
                   
                   safe_g_hash_table_insert(d->entry_cache,
                                            (gchar*)entry_get_name(e), e);
@@ -1192,15 +1341,21 @@ dir_fill_cache_from_doc(Dir* d)
               gconf_log(GCL_WARNING,
                          _("Entry with no name in XML file `%s', ignoring"),
                          d->xml_filename);
+              dir_keep_unparsed (d, node, NULL);
             }
         }
       else
         {
           if (node->type == XML_ELEMENT_NODE)
-            gconf_log(GCL_WARNING,
-                      _("A toplevel node in XML file `%s' is <%s> rather than <entry>, ignoring"),
-                      d->xml_filename,
-                      node->name ? (char*) node->name : "unknown");
+            {
+              gconf_log(GCL_WARNING,
+                        _("A toplevel node in XML file `%s' is <%s> rather than <entry>, ignoring"),
+                        d->xml_filename,
+                        node->name ? (char*) node->name : "unknown");
+              dir_keep_unparsed (d, node, NULL);
+            }
+          else if (node->type == XML_COMMENT_NODE)
+            dir_keep_unparsed (d, node, NULL);
         }
       
       node = node->next;
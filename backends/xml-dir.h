@@ -26,6 +26,10 @@
 /* Dir stores the information about a given directory */
 
 typedef struct _Dir Dir;
+
+/* Called when a clean Dir first gets changes that need syncing */
+typedef void (* DirDirtyFunc) (Dir *d, gpointer user_data);
+
 Dir*           dir_new             (const gchar  *keyname,
                                     const gchar  *xml_root_dir,
                                     guint dir_mode,
@@ -73,6 +77,9 @@ void           dir_set_schema      (Dir          *d,
 GTime          dir_get_last_access (Dir          *d);
 
 gboolean       dir_sync_pending    (Dir          *d);
+void           dir_set_dirty_func  (Dir          *d,
+                                    DirDirtyFunc  func,
+                                    gpointer      user_data);
 
 void           dir_child_removed   (Dir          *d,
                                     const char   *child_name);
@@ -24,27 +24,113 @@
 #include <libxml/entities.h>
 #include <libxml/globals.h>
 
-static void
-entry_sync_if_needed(Entry* e);
 static GConfValue*
 node_extract_value(xmlNodePtr node, const gchar** locales, GError** err);
 static xmlNodePtr
 find_schema_subnode_by_locale(xmlNodePtr node, const gchar* locale);
-static void
-node_unset_by_locale(xmlNodePtr node, const gchar* locale);
-static void
-node_unset_value(xmlNodePtr node);
+static GSList*
+schema_node_extract_all_locales(xmlNodePtr node, gboolean* complete);
 
+/* An Entry doesn't keep any XML around; the document is only
+ * parsed when the dir is loaded and rebuilt from the entries
+ * when the dir is synced.
+ */
 struct _Entry {
   gchar* name; /* a relative key */
   gchar* schema_name;
+  /* For schemas this is one of local_schemas, not a separate copy */
   GConfValue* cached_value;
-  xmlNodePtr node;
+  /* Schema values for every locale we have, only for schema entries */
+  GSList* local_schemas;
   gchar* mod_user;
   GTime mod_time;
-  guint dirty : 1;
 };
 
+static void
+entry_free_value (Entry *e)
+{
+  if (e->local_schemas != NULL)
+    {
+      g_slist_foreach (e->local_schemas, (GFunc) gconf_value_free, NULL);
+      g_slist_free (e->local_schemas);
+      e->local_schemas = NULL;
+    }
+  else if (e->cached_value != NULL)
+    gconf_value_free (e->cached_value);
+
+  e->cached_value = NULL;
+}
+
+static gboolean
+locales_equal (const gchar *a,
+               const gchar *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+  else
+    return strcmp (a, b) == 0;
+}
+
+static GSList*
+entry_find_local_schema (Entry       *e,
+                         const gchar *locale)
+{
+  GSList *tmp;
+
+  tmp = e->local_schemas;
+  while (tmp != NULL)
+    {
+      GConfSchema *sc = gconf_value_get_schema (tmp->data);
+
+      if (locales_equal (gconf_schema_get_locale (sc), locale))
+        return tmp;
+
+      tmp = tmp->next;
+    }
+
+  return NULL;
+}
+
+/* Same preference order as schema_node_extract_value() */
+static GConfValue*
+entry_pick_local_schema (Entry        *e,
+                         const gchar **locales)
+{
+  const gchar* default_locales[] = { "C", NULL };
+  GSList *found;
+  guint i;
+
+  g_return_val_if_fail (e->local_schemas != NULL, NULL);
+
+  if (locales == NULL || locales[0] == NULL)
+    locales = default_locales;
+
+  for (i = 0; locales[i] != NULL; i++)
+    {
+      found = entry_find_local_schema (e, locales[i]);
+      if (found != NULL)
+        return found->data;
+    }
+
+  found = entry_find_local_schema (e, NULL);
+  if (found != NULL)
+    return found->data;
+
+  return e->local_schemas->data;
+}
+
+/* Copy the attributes shared by all locales of a schema */
+static void
+schema_copy_shared (GConfSchema       *dest,
+                    const GConfSchema *src)
+{
+  gconf_schema_set_type (dest, gconf_schema_get_type (src));
+  gconf_schema_set_list_type (dest, gconf_schema_get_list_type (src));
+  gconf_schema_set_car_type (dest, gconf_schema_get_car_type (src));
+  gconf_schema_set_cdr_type (dest, gconf_schema_get_cdr_type (src));
+  gconf_schema_set_owner (dest, gconf_schema_get_owner (src));
+}
+
 Entry*
 entry_new (const gchar* relative_name)
 {
@@ -55,8 +141,6 @@ entry_new (const gchar* relative_name)
   e = g_new0(Entry, 1);
 
   e->name = g_strdup(relative_name);
-
-  e->dirty = TRUE;
   
   return e;
 }
@@ -67,18 +151,13 @@ entry_destroy (Entry* e)
   if (e->name)
     g_free(e->name);
 
-  if (e->cached_value)
-    gconf_value_free(e->cached_value);
+  entry_free_value(e);
+
+  if (e->schema_name)
+    g_free(e->schema_name);
 
   if (e->mod_user)
     g_free(e->mod_user);
-
-  if (e->node != NULL)
-    {
-      xmlUnlinkNode(e->node);
-      xmlFreeNode(e->node);
-      e->node = NULL;
-    }
   
   g_free(e);
 }
@@ -89,20 +168,6 @@ entry_get_name(Entry* e)
   return e->name;
 }
 
-void
-entry_set_node (Entry*e, xmlNodePtr node)
-{
-  e->node = node;
-
-  e->dirty = TRUE;
-}
-
-xmlNodePtr
-entry_get_node (Entry*e)
-{
-  return e->node;
-}
-
 GConfValue*
 entry_get_value(Entry* e, const gchar** locales, GError** err)
 {
@@ -135,29 +200,7 @@ entry_get_value(Entry* e, const gchar** locales, GError** err)
   else
     {
       /* We want a locale other than the currently-loaded one */
-      GConfValue* newval;
-      GError* error = NULL;
-
-      entry_sync_if_needed(e);
-      
-      newval = node_extract_value(e->node, locales, &error);
-      if (newval != NULL)
-        {
-          /* We found a schema with an acceptable locale */
-          gconf_value_free(e->cached_value);
-          e->cached_value = newval;
-          g_return_val_if_fail(error == NULL, e->cached_value);
-        }
-      else if (error != NULL)
-        {
-          /* There was an error */
-          gconf_log(GCL_WARNING, _("Ignoring XML node with name `%s': %s"),
-                    e->name, error->message);
-          g_error_free(error);
-
-          /* Fall back to currently-loaded thing if any */
-        }
-      /* else fall back to the currently-loaded schema */
+      e->cached_value = entry_pick_local_schema(e, locales);
     }
 
   return e->cached_value;
@@ -166,16 +209,45 @@ entry_get_value(Entry* e, const gchar** locales, GError** err)
 void
 entry_set_value(Entry* e, const GConfValue* value)
 {
-  g_return_if_fail(e != NULL);
+  GConfValue* newval;
   
-  entry_sync_if_needed(e);
-  
-  if (e->cached_value)
-    gconf_value_free(e->cached_value);
-      
-  e->cached_value = gconf_value_copy(value);
+  g_return_if_fail(e != NULL);
+
+  newval = gconf_value_copy(value);
+
+  if (newval->type == GCONF_VALUE_SCHEMA &&
+      e->local_schemas != NULL)
+    {
+      GConfSchema* sc = gconf_value_get_schema(newval);
+      GSList* tmp;
+
+      /* Replace this locale, keep the others but give them the
+       * new cross-locale attributes.
+       */
+      tmp = entry_find_local_schema(e, gconf_schema_get_locale(sc));
+      if (tmp != NULL)
+        {
+          gconf_value_free(tmp->data);
+          tmp->data = newval;
+        }
+      else
+        e->local_schemas = g_slist_append(e->local_schemas, newval);
 
-  e->dirty = TRUE;
+      for (tmp = e->local_schemas; tmp != NULL; tmp = tmp->next)
+        {
+          if (tmp->data != newval)
+            schema_copy_shared(gconf_value_get_schema(tmp->data), sc);
+        }
+    }
+  else
+    {
+      entry_free_value(e);
+
+      if (newval->type == GCONF_VALUE_SCHEMA)
+        e->local_schemas = g_slist_prepend(NULL, newval);
+    }
+
+  e->cached_value = newval;
 }
 
 gboolean
@@ -188,39 +260,48 @@ entry_unset_value     (Entry        *e,
     {
       if (locale && e->cached_value->type == GCONF_VALUE_SCHEMA)
         {
-          GError* error = NULL;
-          
-          /* Remove the localized node from the XML tree */
-          g_assert(e->node != NULL);
-          node_unset_by_locale(e->node, locale);
+          GSList* found;
 
-          /* e->cached_value is always non-NULL if some value is
-             available; in the schema case there may be leftover
-             values */
-          gconf_value_free(e->cached_value);
-          e->cached_value = node_extract_value(e->node, NULL, &error);
+          /* Remove the localized schema */
+          found = entry_find_local_schema(e, locale);
 
-          if (error != NULL)
+          if (found != NULL)
             {
-              gconf_log(GCL_WARNING, "%s", error->message);
-              g_error_free(error);
-              error = NULL;
+              if (e->local_schemas->next == NULL)
+                {
+                  /* Last locale; what remains is a schema with only
+                   * the cross-locale attributes, as if we had
+                   * re-read the file.
+                   */
+                  GConfSchema* sc;
+                  GConfValue* bare;
+
+                  sc = gconf_schema_new();
+                  schema_copy_shared(sc, gconf_value_get_schema(found->data));
+                  bare = gconf_value_new(GCONF_VALUE_SCHEMA);
+                  gconf_value_set_schema_nocopy(bare, sc);
+
+                  gconf_value_free(found->data);
+                  found->data = bare;
+                }
+              else
+                {
+                  gconf_value_free(found->data);
+                  e->local_schemas = g_slist_delete_link(e->local_schemas,
+                                                         found);
+                }
             }
-        }
-      else if (e->cached_value->type == GCONF_VALUE_SCHEMA)
-        {
-          /* if locale == NULL nuke all the locales */
-          if (e->cached_value)
-            gconf_value_free(e->cached_value);
-          e->cached_value = NULL;
+
+          /* e->cached_value is always non-NULL if some value is
+             available; in the schema case there may be leftover
+             values */
+          e->cached_value = entry_pick_local_schema(e, NULL);
         }
       else
         {
-          gconf_value_free(e->cached_value);
-          e->cached_value = NULL;
+          /* if locale == NULL nuke all the locales */
+          entry_free_value(e);
         }
-
-      e->dirty = TRUE;
       
       return TRUE;
     }
@@ -263,8 +344,6 @@ entry_set_schema_name (Entry        *e,
     g_free(e->schema_name);
 
   e->schema_name = name ? g_strdup(name) : NULL;
-  
-  e->dirty = TRUE;
 }
 
 void
@@ -274,7 +353,6 @@ entry_set_mod_time   (Entry        *e,
   g_return_if_fail(e != NULL);
 
   e->mod_time = mod_time;
-  e->dirty = TRUE;
 }
 
 void
@@ -286,36 +364,25 @@ entry_set_mod_user (Entry *e,
   if (e->mod_user)
     g_free(e->mod_user);
   e->mod_user = g_strdup(user);
-
-  e->dirty = TRUE;
 }
 
 /*
  * XML-related cruft
  */
 
-static void
-entry_sync_if_needed(Entry* e)
-{
-  if (!e->dirty)
-    return;
-  
-  if (e->cached_value &&
-      e->cached_value->type == GCONF_VALUE_SCHEMA)
-    {
-      entry_sync_to_node(e);
-    }
-}
-
-void
-entry_fill_from_node(Entry* e)
+/* Returns FALSE if part of the node couldn't be loaded, so
+ * rebuilding it from the entry would lose data
+ */
+gboolean
+entry_fill_from_node(Entry* e, xmlNodePtr node)
 {
   gchar* tmp;
   GError* error = NULL;
+  gboolean complete = TRUE;
 
-  g_return_if_fail(e->node != NULL);
+  g_return_val_if_fail(node != NULL, FALSE);
   
-  tmp = my_xmlGetProp(e->node, "schema");
+  tmp = my_xmlGetProp(node, "schema");
   
   if (tmp != NULL)
     {
@@ -337,7 +404,7 @@ entry_fill_from_node(Entry* e)
       xmlFree(tmp);
     }
       
-  tmp = my_xmlGetProp(e->node, "mtime");
+  tmp = my_xmlGetProp(node, "mtime");
 
   if (tmp != NULL)
     {
@@ -347,7 +414,7 @@ entry_fill_from_node(Entry* e)
   else
     e->mod_time = 0;
 
-  tmp = my_xmlGetProp(e->node, "muser");
+  tmp = my_xmlGetProp(node, "muser");
 
   if (tmp != NULL)
     {
@@ -357,18 +424,27 @@ entry_fill_from_node(Entry* e)
   else
     e->mod_user = NULL;
 
-  entry_sync_if_needed(e);
-  
-  if (e->cached_value != NULL)
-    gconf_value_free(e->cached_value);
+  entry_free_value(e);
+
+  tmp = my_xmlGetProp(node, "type");
+  if (tmp != NULL && strcmp(tmp, "schema") == 0)
+    {
+      /* Keep every locale, since we won't have the node later */
+      xmlFree(tmp);
+      e->local_schemas = schema_node_extract_all_locales(node, &complete);
+      e->cached_value = entry_pick_local_schema(e, NULL);
+      return complete;
+    }
+  if (tmp != NULL)
+    xmlFree(tmp);
   
-  e->cached_value = node_extract_value(e->node, NULL, /* FIXME current locale as a guess */
+  e->cached_value = node_extract_value(node, NULL, /* FIXME current locale as a guess */
                                        &error);
 
   if (e->cached_value)
     {
-      g_return_if_fail(error == NULL);
-      return;
+      g_return_val_if_fail(error == NULL, TRUE);
+      return TRUE;
     }
   else if (error != NULL)
     {
@@ -380,7 +456,10 @@ entry_fill_from_node(Entry* e)
                    _("Ignoring XML node `%s': %s"),
                    e->name, error->message);
       g_error_free(error);
+      complete = FALSE;
     }
+
+  return complete;
 }
 
 static void
@@ -398,42 +477,36 @@ free_childs(xmlNodePtr node)
 }
 
 void
-entry_sync_to_node (Entry* e)
+entry_sync_to_node (Entry* e, xmlNodePtr node)
 {
   g_return_if_fail(e != NULL);
-  g_return_if_fail(e->node != NULL);
-  
-  if (!e->dirty)
-    return;
-
-  /* Unset all properties, so we don't have old cruft. */
-  if (e->node->properties)
-    xmlFreePropList(e->node->properties);
-  e->node->properties = NULL;
+  g_return_if_fail(node != NULL);
   
-  my_xmlSetProp(e->node, "name", e->name);
+  my_xmlSetProp(node, "name", e->name);
 
   if (e->mod_time != 0)
     {
       gchar* str = g_strdup_printf("%u", (guint)e->mod_time);
-      my_xmlSetProp(e->node, "mtime", str);
+      my_xmlSetProp(node, "mtime", str);
       g_free(str);
     }
-  else
-    my_xmlSetProp(e->node, "mtime", NULL); /* Unset */
 
   /* OK if schema_name is NULL, then we unset */
-  my_xmlSetProp(e->node, "schema", e->schema_name);
+  my_xmlSetProp(node, "schema", e->schema_name);
 
   /* OK if mod_user is NULL, since it unsets */
-  my_xmlSetProp(e->node, "muser", e->mod_user);
+  my_xmlSetProp(node, "muser", e->mod_user);
 
-  if (e->cached_value)
-    node_set_value(e->node, e->cached_value);
-  else
-    node_unset_value(e->node);
-  
-  e->dirty = FALSE;
+  if (e->local_schemas)
+    {
+      GSList* tmp;
+
+      /* each one adds its own <local_schema> */
+      for (tmp = e->local_schemas; tmp != NULL; tmp = tmp->next)
+        node_set_value(node, tmp->data);
+    }
+  else if (e->cached_value)
+    node_set_value(node, e->cached_value);
 }
 
 static void
@@ -476,6 +549,15 @@ node_set_schema_value(xmlNodePtr node,
 
   locale = gconf_schema_get_locale(sc);
 
+  /* A schema without any per-locale data, such as one loaded from an
+   * <entry> with no <local_schema>, doesn't need an empty node
+   */
+  if (locale == NULL &&
+      gconf_schema_get_short_desc (sc) == NULL &&
+      gconf_schema_get_long_desc (sc) == NULL &&
+      gconf_schema_get_default_value (sc) == NULL)
+    return;
+
   gconf_log(GCL_DEBUG, "Setting XML node to schema with locale `%s'",
             locale);
   
@@ -643,50 +725,16 @@ find_schema_subnode_by_locale(xmlNodePtr node, const gchar* locale)
   return found;
 }
 
-static void
-node_unset_value(xmlNodePtr node)
-{
-  free_childs(node);
-  my_xmlSetProp(node, "value", NULL);
-  my_xmlSetProp(node, "type", NULL);
-  my_xmlSetProp(node, "stype", NULL);
-  my_xmlSetProp(node, "ltype", NULL);
-  my_xmlSetProp(node, "owner", NULL);
-  my_xmlSetProp(node, "list_type", NULL);
-  my_xmlSetProp(node, "car_type", NULL);
-  my_xmlSetProp(node, "cdr_type", NULL);
-}
-
-static void
-node_unset_by_locale(xmlNodePtr node, const gchar* locale)
-{
-  xmlNodePtr found;
-
-  g_return_if_fail(node != NULL);
-  g_return_if_fail(locale != NULL);
-
-  if (locale != NULL)
-    {
-      found = find_schema_subnode_by_locale(node, locale);
-      
-      if (found != NULL)
-        {
-          xmlUnlinkNode(found);
-          xmlFreeNode(found);
-        }
-    }
-  else
-    {
-      node_unset_value(node);
-    }
-}
-
-static void
+/* Returns FALSE if some child element couldn't be used, so that
+ * the caller can hang on to the original node
+ */
+static gboolean
 schema_subnode_extract_data(xmlNodePtr node, GConfSchema* sc)
 {
   gchar* sd_str;
   gchar* locale_str;
   GError* error = NULL;
+  gboolean complete = TRUE;
   
   sd_str = my_xmlGetProp(node, "short_desc");
   locale_str = my_xmlGetProp(node, "locale");
@@ -713,7 +761,6 @@ schema_subnode_extract_data(xmlNodePtr node, GConfSchema* sc)
     {
       GConfValue* default_value = NULL;
       gchar* ld_str = NULL;
-      GSList* bad_nodes = NULL;
       xmlNodePtr iter = node->xmlChildrenNode;
 
       while (iter != NULL)
@@ -734,7 +781,7 @@ schema_subnode_extract_data(xmlNodePtr node, GConfSchema* sc)
                       g_error_free(error);
                       error = NULL;
                       
-                      bad_nodes = g_slist_prepend(bad_nodes, iter);
+                      complete = FALSE;
                     }
                 }
               else if (ld_str == NULL &&
@@ -744,31 +791,12 @@ schema_subnode_extract_data(xmlNodePtr node, GConfSchema* sc)
                 }
               else
                 {
-                  bad_nodes = g_slist_prepend(bad_nodes, iter);
+                  complete = FALSE;
                 }
             }
-          else
-            bad_nodes = g_slist_prepend(bad_nodes, iter); /* what is this node? */
 
           iter = iter->next;
         }
-      
-
-      /* Remove the bad nodes from the parse tree */
-      if (bad_nodes != NULL)
-        {
-          GSList* tmp = bad_nodes;
-          
-          while (tmp != NULL)
-            {
-              xmlUnlinkNode(tmp->data);
-              xmlFreeNode(tmp->data);
-              
-              tmp = g_slist_next(tmp);
-            }
-          
-          g_slist_free(bad_nodes);
-        }
 
       if (default_value != NULL)
         gconf_schema_set_default_value_nocopy(sc, default_value);
@@ -779,26 +807,22 @@ schema_subnode_extract_data(xmlNodePtr node, GConfSchema* sc)
           xmlFree(ld_str);
         }
     }
+
+  return complete;
 }
 
-static GConfValue*
-schema_node_extract_value(xmlNodePtr node, const gchar** locales)
+/* owner, type are for all locales;
+   default value, descriptions are per-locale
+*/
+static GConfSchema*
+schema_node_extract_shared(xmlNodePtr node)
 {
-  GConfValue* value = NULL;
   gchar* owner_str;
   gchar* stype_str;
   gchar* list_type_str;
   gchar* car_type_str;
   gchar* cdr_type_str;
   GConfSchema* sc;
-  xmlNodePtr iter;
-  guint i;
-  xmlNodePtr* localized_nodes;
-  xmlNodePtr best = NULL;
-  
-  /* owner, type are for all locales;
-     default value, descriptions are per-locale
-  */
 
   owner_str = my_xmlGetProp(node, "owner");
   stype_str = my_xmlGetProp(node, "stype");
@@ -840,7 +864,22 @@ schema_node_extract_value(xmlNodePtr node, const gchar** locales)
       type = gconf_value_type_from_string(cdr_type_str);
       gconf_schema_set_cdr_type(sc, type);
       xmlFree(cdr_type_str);
-    }  
+    }
+
+  return sc;
+}
+
+static GConfValue*
+schema_node_extract_value(xmlNodePtr node, const gchar** locales)
+{
+  GConfValue* value = NULL;
+  GConfSchema* sc;
+  xmlNodePtr iter;
+  guint i;
+  xmlNodePtr* localized_nodes;
+  xmlNodePtr best = NULL;
+
+  sc = schema_node_extract_shared(node);
   
   if (locales != NULL && locales[0])
     {
@@ -928,6 +967,64 @@ schema_node_extract_value(xmlNodePtr node, const gchar** locales)
   return value;
 }
 
+/* One schema value for each <local_schema>, in document order;
+ * clears *complete if anything else was found
+ */
+static GSList*
+schema_node_extract_all_locales(xmlNodePtr node, gboolean* complete)
+{
+  GSList* retval = NULL;
+  GConfSchema* shared;
+  GConfSchema* sc;
+  GConfValue* value;
+  xmlNodePtr iter;
+  xmlNodePtr first = NULL;
+
+  shared = schema_node_extract_shared(node);
+
+  for (iter = node->xmlChildrenNode; iter != NULL; iter = iter->next)
+    {
+      if (iter->type != XML_ELEMENT_NODE)
+        continue;
+
+      if (first == NULL)
+        first = iter;
+
+      if (strcmp(iter->name, "local_schema") != 0)
+        {
+          *complete = FALSE;
+          continue;
+        }
+
+      sc = gconf_schema_new();
+      schema_copy_shared(sc, shared);
+      if (!schema_subnode_extract_data(iter, sc))
+        *complete = FALSE;
+
+      value = gconf_value_new(GCONF_VALUE_SCHEMA);
+      gconf_value_set_schema_nocopy(value, sc);
+      retval = g_slist_prepend(retval, value);
+    }
+
+  if (retval == NULL)
+    {
+      /* Like schema_node_extract_value(), fall back to the first
+       * node, or to no per-locale data at all.
+       */
+      if (first != NULL)
+        schema_subnode_extract_data(first, shared);
+
+      value = gconf_value_new(GCONF_VALUE_SCHEMA);
+      gconf_value_set_schema_nocopy(value, shared);
+
+      return g_slist_prepend(NULL, value);
+    }
+
+  gconf_schema_free(shared);
+
+  return g_slist_reverse(retval);
+}
+
 /* this actually works on any node,
    not just <entry>, such as the <car>
    and <cdr> nodes and the <li> nodes and the
@@ -33,11 +33,12 @@ const gchar*   entry_get_name        (Entry        *entry);
 
 
 /* no set_name, you can't change an entry's name */
-void           entry_set_node        (Entry        *entry,
+
+/* The entry doesn't hold on to the node in either case */
+gboolean       entry_fill_from_node  (Entry        *entry,
+                                      xmlNodePtr    node);
+void           entry_sync_to_node    (Entry        *entry,
                                       xmlNodePtr    node);
-xmlNodePtr     entry_get_node        (Entry        *entry);
-void           entry_fill_from_node  (Entry        *entry);
-void           entry_sync_to_node    (Entry        *entry);
 GConfValue*    entry_get_value       (Entry        *entry,
                                       const gchar **locales,
                                       GError  **err);
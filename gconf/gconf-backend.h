@@ -144,6 +144,48 @@ struct _GConfBackendVTable {
 
   void                (* remove_listener) (GConfSource           *source,
 					   guint                  id);
+
+  /* Optional multi-key versions of query_value, set_value and
+   * unset_value; if NULL, the single-key call is made for each key.
+   * Each handles keys[0] to keys[n_keys - 1] the way the single-key
+   * call would, going on past a failing key and reporting the first
+   * error. Callers keep keys from one directory adjacent so the
+   * backend can resolve the directory once for all of them.
+   *
+   * query_values stores each result in values[i], and the schema
+   * name in schema_names[i] if schema_names isn't NULL.
+   */
+  void                (* query_values)    (GConfSource* source,
+                                           const gchar** keys,
+                                           guint n_keys,
+                                           const gchar** locales,
+                                           GConfValue** values,
+                                           gchar** schema_names,
+                                           GError** err);
+
+  void                (* set_values)      (GConfSource* source,
+                                           const gchar** keys,
+                                           GConfValue* const* values,
+                                           guint n_keys,
+                                           GError** err);
+
+  void                (* unset_values)    (GConfSource* source,
+                                           const gchar** keys,
+                                           guint n_keys,
+                                           const gchar* locale,
+                                           GError** err);
+
+  /* Optional, for sources that may block in query_value or
+   * all_entries, e.g. because they talk to a server. Returns TRUE
+   * if reading key (a key or a directory) won't block. Otherwise
+   * starts fetching in the background, returns FALSE, and later
+   * calls ready_func from the main loop, whether or not the fetch
+   * worked; reading then doesn't block and reports any error.
+   */
+  gboolean            (* prepare_read)    (GConfSource* source,
+                                           const gchar* key,
+                                           GConfSourceReadyFunc ready_func,
+                                           gpointer user_data);
 };
 
 struct _GConfBackend {
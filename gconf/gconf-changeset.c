@@ -414,7 +414,7 @@ change_new    (const gchar* key)
 {
   Change* c;
 
-  c = g_new(Change, 1);
+  c = g_slice_new (Change);
 
   c->key  = g_strdup(key);
   c->type = CHANGE_INVALID;
@@ -433,7 +433,7 @@ change_destroy(Change* c)
   if (c->value)
     gconf_value_free(c->value);
 
-  g_free(c);
+  g_slice_free (Change, c);
 }
 
 void
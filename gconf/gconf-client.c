@@ -81,6 +81,88 @@ struct _Dir {
 static Dir* dir_new(const gchar* name, guint notify_id);
 static void dir_destroy(Dir* d);
 
+/*
+ * Index of the cache by directory, so dropping a key or a subtree
+ * from the cache doesn't have to look at every cached entry
+ */
+
+typedef struct _CacheDir CacheDir;
+
+struct _CacheDir {
+  gchar* name;
+  CacheDir* parent;
+  /* key -> GConfEntry for the cached keys in this directory;
+   * the entries are owned by cache_hash
+   */
+  GHashTable* entries;
+  GSList* subdirs;
+};
+
+/*
+ * Size accounting and least-recently-read order of the cache
+ */
+
+struct _GConfClientPrivate {
+  gsize cache_limit;
+  gsize cache_bytes;
+  /* cached GConfEntry, most recently read first */
+  GQueue cache_lru;
+  /* key -> link in cache_lru, keys owned by the entries */
+  GHashTable* cache_lru_links;
+  guint cache_hits;
+  guint cache_misses;
+  guint cache_evictions;
+  /* key -> list of the GConfEntry handed out by the peek functions,
+   * held until the next notification
+   */
+  GHashTable* peeked;
+  /* key -> AbsentKey for recently read keys outside the watched
+   * directories that turned out to have no value
+   */
+  GHashTable* absent_keys;
+};
+
+/* Keys outside the watched directories get no notifications, so
+ * knowing they are unset is only trusted for this many seconds
+ */
+#define ABSENT_KEY_TTL 5
+#define ABSENT_KEYS_MAX 256
+
+typedef struct {
+  GConfEntry* entry;
+  glong expires;
+} AbsentKey;
+
+#define GCONF_CLIENT_GET_PRIVATE(client) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((client), GCONF_TYPE_CLIENT, GConfClientPrivate))
+
+static void cache_lru_add     (GConfClient *client,
+                               GConfEntry  *entry);
+static void cache_lru_remove  (GConfClient *client,
+                               GConfEntry  *entry);
+static void cache_lru_touch   (GConfClient *client,
+                               GConfEntry  *entry);
+static void cache_enforce_limit (GConfClient *client,
+                                 GConfEntry  *keep);
+
+static void        absent_key_free   (AbsentKey   *absent);
+static GConfEntry* absent_key_lookup (GConfClient *client,
+                                      const gchar *key);
+static void        absent_key_add    (GConfClient *client,
+                                      GConfEntry  *entry);
+static void        absent_key_forget (GConfClient *client,
+                                      const gchar *key,
+                                      gboolean     recursive);
+
+static void release_peeked_entries (GSList *entries);
+
+static void cache_index_add    (GConfClient *client,
+                                GConfEntry  *entry);
+static void cache_index_remove (GConfClient *client,
+                                const gchar *key);
+static void cache_remove_subtree (GConfClient *client,
+                                  const gchar *key);
+
 /*
  * Listener object
  */
@@ -222,6 +304,8 @@ gconf_client_class_init (GConfClientClass *class)
 
   object_class->finalize  = gconf_client_finalize;
 
+  g_type_class_add_private (class, sizeof (GConfClientPrivate));
+
   if (g_getenv ("GCONF_DEBUG_TRACE_CLIENT") != NULL)
     do_trace = TRUE;
 }
@@ -233,6 +317,15 @@ gconf_client_init (GConfClient *client)
   client->error_mode = GCONF_CLIENT_HANDLE_UNRETURNED;
   client->dir_hash = g_hash_table_new (g_str_hash, g_str_equal);
   client->cache_hash = g_hash_table_new (g_str_hash, g_str_equal);
+  client->cache_dirs = g_hash_table_new (g_str_hash, g_str_equal);
+  client->priv = GCONF_CLIENT_GET_PRIVATE (client);
+  client->priv->cache_lru_links = g_hash_table_new (g_str_hash, g_str_equal);
+  client->priv->peeked = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free,
+                                                (GDestroyNotify) release_peeked_entries);
+  client->priv->absent_keys = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                     NULL,
+                                                     (GDestroyNotify) absent_key_free);
   /* We create the listeners only if they're actually used */
   client->listeners = NULL;
   client->notify_list = NULL;
@@ -310,6 +403,19 @@ gconf_client_finalize (GObject* object)
   g_hash_table_destroy (client->cache_hash);
   client->cache_hash = NULL;
 
+  g_hash_table_destroy (client->cache_dirs);
+  client->cache_dirs = NULL;
+
+  g_assert (client->priv->cache_lru.length == 0);
+  g_hash_table_destroy (client->priv->cache_lru_links);
+  client->priv->cache_lru_links = NULL;
+
+  g_hash_table_destroy (client->priv->peeked);
+  client->priv->peeked = NULL;
+
+  g_hash_table_destroy (client->priv->absent_keys);
+  client->priv->absent_keys = NULL;
+
   unregister_client (client);
 
   set_engine (client, NULL);
@@ -402,12 +508,15 @@ notify_from_server_callback (GConfEngine* conf, guint cnxn_id,
 
   trace ("Received notify of change to '%s' from server\n",
          entry->key);
+
+  absent_key_forget (client, entry->key, FALSE);
   
   /* First do the caching, so that state is sane for the
    * listeners or functions connected to value_changed.
    * We know this key is under a directory in our dir list.
    */
-  changed = gconf_client_cache (client, FALSE, entry, TRUE);
+  changed = gconf_client_cache (client, TRUE,
+                                gconf_entry_copy_shared (entry), TRUE);
 
   if (!changed)
     return; /* don't do the notify */
@@ -590,6 +699,9 @@ gconf_client_add_dir     (GConfClient* client,
 
       g_hash_table_insert (client->dir_hash, d->name, d);
 
+      /* keys below are cached from now on */
+      absent_key_forget (client, d->name, TRUE);
+
       gconf_client_preload (client, dirname, preload, &error);
 
       handle_error (client, error, err);
@@ -644,18 +756,6 @@ foreach_add_notifies(gpointer key, gpointer value, gpointer user_data)
     }
 }
 
-static gboolean
-clear_dir_cache_foreach (char* key, GConfEntry* entry, char *dir)
-{
-  if (gconf_key_is_below (dir, key))
-    {
-      gconf_entry_free (entry);
-      return TRUE;
-    }
-  else
-    return FALSE;
-}
-
 static void
 gconf_client_real_remove_dir    (GConfClient* client,
                                  Dir* d,
@@ -679,9 +779,7 @@ gconf_client_real_remove_dir    (GConfClient* client,
       d->notify_id = 0;
     }
   
-  g_hash_table_foreach_remove (client->cache_hash,
-                               (GHRFunc)clear_dir_cache_foreach,
-                               d->name);
+  cache_remove_subtree (client, d->name);
 
   dir_destroy(d);
 
@@ -793,6 +891,7 @@ gconf_client_set_error_handling(GConfClient* client,
 static gboolean
 clear_cache_foreach (char* key, GConfEntry* entry, GConfClient* client)
 {
+  cache_lru_remove (client, entry);
   gconf_entry_free (entry);
 
   return TRUE;
@@ -805,6 +904,9 @@ gconf_client_clear_cache(GConfClient* client)
   g_return_if_fail(GCONF_IS_CLIENT(client));
 
   trace ("Clearing cache\n");
+
+  absent_key_forget (client, "/", TRUE);
+  cache_remove_subtree (client, "/");
   
   g_hash_table_foreach_remove (client->cache_hash, (GHRFunc)clear_cache_foreach,
                                client);
@@ -978,52 +1080,29 @@ gconf_client_preload    (GConfClient* client,
  * Basic key-manipulation facilities
  */
 
-static gboolean
-remove_key_from_cache_foreach (const gchar *cached_key,
-                               GConfEntry  *entry,
-                               const gchar *key)
-{
-  if (strcmp (cached_key, key) == 0)
-    {
-      gconf_entry_free (entry);
-      return TRUE;
-    }
-  
-  return FALSE;
-}
-
-static gboolean
-remove_key_from_cache_recursively_foreach (const gchar *cached_key,
-                                           GConfEntry  *entry,
-                                           const gchar *key)
-{
-  if (gconf_key_is_below (cached_key, key) == 0 || strcmp (cached_key, key) == 0)
-    {
-      /* Not sure why a null entry would be in the cache, but it happens
-       * sometimes, workaround for now to avoid crashing.
-       */
-      if (entry)
-        gconf_entry_free (entry);
-      return TRUE;
-    }
-  
-  return FALSE;
-}
-
 static void
 remove_key_from_cache (GConfClient *client, const gchar *key)
 {
-  g_hash_table_foreach_remove (client->cache_hash,
-                               (GHRFunc) remove_key_from_cache_foreach,
-                               (char *) key);
+  GConfEntry *entry;
+
+  absent_key_forget (client, key, FALSE);
+
+  entry = g_hash_table_lookup (client->cache_hash, key);
+  if (entry == NULL)
+    return;
+
+  cache_index_remove (client, key);
+  cache_lru_remove (client, entry);
+  g_hash_table_remove (client->cache_hash, key);
+
+  gconf_entry_free (entry);
 }
 
 static void
 remove_key_from_cache_recursively (GConfClient *client, const gchar *key)
 {
-  g_hash_table_foreach_remove (client->cache_hash,
-                               (GHRFunc) remove_key_from_cache_recursively_foreach,
-                               (char *) key);
+  absent_key_forget (client, key, TRUE);
+  cache_remove_subtree (client, key);
 }
 
 void
@@ -1246,7 +1325,7 @@ gconf_client_key_is_writable (GConfClient* client,
 }
 
 static gboolean
-check_type(const gchar* key, GConfValue* val, GConfValueType t, GError** err)
+check_type(const gchar* key, const GConfValue* val, GConfValueType t, GError** err)
 {
   if (val->type != t)
     {
@@ -1261,14 +1340,22 @@ check_type(const gchar* key, GConfValue* val, GConfValueType t, GError** err)
     return TRUE;
 }
 
+/* Returns the entry for key, straight from the cache when it's
+ * there. If *owned is FALSE on return the entry belongs to the
+ * cache and must be neither freed nor kept past the next change
+ * to the cache.
+ */
 static GConfEntry*
-get (GConfClient *client,
-     const gchar *key,
-     gboolean     use_default,
-     GError     **error)
+get_borrowed (GConfClient *client,
+              const gchar *key,
+              gboolean     use_default,
+              gboolean    *owned,
+              GError     **error)
 {
   GConfEntry *entry = NULL;
   
+  *owned = FALSE;
+
   g_return_val_if_fail (client != NULL, NULL);
   g_return_val_if_fail (GCONF_IS_CLIENT(client), NULL);
   g_return_val_if_fail (error != NULL, NULL);
@@ -1280,15 +1367,30 @@ get (GConfClient *client,
       trace ("%s was in the client-side cache\n", key);
       
       g_assert (entry != NULL);
+
+      client->priv->cache_hits += 1;
+      cache_lru_touch (client, entry);
       
       if (gconf_entry_get_is_default (entry) && !use_default)
         return NULL;
       else
-        return gconf_entry_copy (entry);
+        return entry;
     }
       
   g_assert (entry == NULL); /* if it was in the cache we should have returned */
 
+  entry = absent_key_lookup (client, key);
+  if (entry != NULL)
+    {
+      trace ("%s is known to be unset\n", key);
+
+      client->priv->cache_hits += 1;
+
+      return entry;
+    }
+
+  client->priv->cache_misses += 1;
+
   /* Check the GConfEngine */
   trace ("Doing remote query for %s\n", key);
   PUSH_USE_ENGINE (client);
@@ -1313,17 +1415,73 @@ get (GConfClient *client,
           /* cache a copy of val */
           gconf_client_cache (client, FALSE, entry, FALSE);
         }
+      else if (gconf_entry_get_value (entry) == NULL)
+        {
+          /* remember for a while that it's unset */
+          absent_key_add (client, entry);
+        }
 
       /* We don't own the entry, we're returning this copy belonging
        * to the caller
        */
       if (gconf_entry_get_is_default (entry) && !use_default)
-        return NULL;
+        {
+          gconf_entry_free (entry);
+          return NULL;
+        }
       else
-        return entry;
+        {
+          *owned = TRUE;
+          return entry;
+        }
     }
 }
      
+static GConfEntry*
+get (GConfClient *client,
+     const gchar *key,
+     gboolean     use_default,
+     GError     **error)
+{
+  GConfEntry *entry;
+  gboolean owned;
+
+  entry = get_borrowed (client, key, use_default, &owned, error);
+
+  if (entry != NULL && !owned)
+    entry = gconf_entry_copy (entry);
+
+  return entry;
+}
+
+/* The value of key for the typed getters, without copying it out of
+ * the cache. *owner is set to the entry to free once done with the
+ * value, or NULL if the value belongs to the cache.
+ */
+static const GConfValue*
+get_value_borrowed (GConfClient *client,
+                    const gchar *key,
+                    GConfEntry **owner,
+                    GError     **error)
+{
+  GConfEntry *entry;
+  gboolean owned;
+
+  *owner = NULL;
+
+  g_return_val_if_fail (key != NULL, NULL);
+
+  entry = get_borrowed (client, key, TRUE, &owned, error);
+
+  if (entry == NULL)
+    return NULL;
+
+  if (owned)
+    *owner = entry;
+
+  return gconf_entry_get_value (entry);
+}
+
 static GConfValue*
 gconf_client_get_full        (GConfClient* client,
                               const gchar* key, const gchar* locale,
@@ -1333,14 +1491,15 @@ gconf_client_get_full        (GConfClient* client,
   GError* error = NULL;
   GConfEntry *entry;
   GConfValue *retval;
+  gboolean owned;
   
   g_return_val_if_fail (err == NULL || *err == NULL, NULL);
 
   if (locale != NULL)
     g_warning ("haven't implemented getting a specific locale in GConfClient");
   
-  entry = get (client, key, use_schema_default,
-               &error);
+  entry = get_borrowed (client, key, use_schema_default,
+                        &owned, &error);
 
   if (entry == NULL && error != NULL)
     handle_error(client, error, err);
@@ -1349,12 +1508,14 @@ gconf_client_get_full        (GConfClient* client,
 
   retval = NULL;
   
-  if (entry && gconf_entry_get_value (entry))
+  if (entry != NULL && owned)
+    {
+      retval = gconf_entry_steal_value (entry);
+      gconf_entry_free (entry);
+    }
+  else if (entry && gconf_entry_get_value (entry))
     retval = gconf_value_copy (gconf_entry_get_value (entry));
 
-  if (entry != NULL)
-    gconf_entry_free (entry);
-
   return retval;
 }
 
@@ -1459,39 +1620,94 @@ gconf_client_get_default_from_schema (GConfClient* client,
     }
 }
 
+/* Keeps the entry a peeked value belongs to alive until the next
+ * notification. owner is the entry if it isn't cached.
+ */
+static void
+hold_peeked_entry (GConfClient *client,
+                   const gchar *key,
+                   GConfEntry  *owner,
+                   gboolean     peeked)
+{
+  GConfEntry *entry;
+  GSList *held;
+
+  if (!peeked)
+    {
+      if (owner != NULL)
+        gconf_entry_free (owner);
+      return;
+    }
+
+  held = g_hash_table_lookup (client->priv->peeked, key);
+
+  entry = owner;
+  if (entry == NULL)
+    {
+      entry = g_hash_table_lookup (client->cache_hash, key);
+      g_assert (entry != NULL);
+
+      /* already held for an earlier peek */
+      if (g_slist_find (held, entry) != NULL)
+        return;
+
+      gconf_entry_ref (entry);
+    }
+
+  /* Values from earlier peeks of the key stay valid too */
+  if (held != NULL)
+    g_slist_append (held, entry);
+  else
+    g_hash_table_insert (client->priv->peeked,
+                         g_strdup (key),
+                         g_slist_prepend (NULL, entry));
+}
+
+static void
+release_peeked_entries (GSList *entries)
+{
+  g_slist_foreach (entries, (GFunc) gconf_entry_unref, NULL);
+  g_slist_free (entries);
+}
+
+static gboolean
+release_peeked_foreach (gpointer key,
+                        gpointer value,
+                        gpointer user_data)
+{
+  return TRUE;
+}
+
 gdouble
 gconf_client_get_float (GConfClient* client, const gchar* key,
                         GError** err)
 {
   static const gdouble def = 0.0;
   GError* error = NULL;
-  GConfValue *val;
+  GConfEntry* owner;
+  const GConfValue* val;
+  gdouble retval = def;
 
-  g_return_val_if_fail (err == NULL || *err == NULL, 0.0);
+  g_return_val_if_fail (err == NULL || *err == NULL, def);
 
-  val = gconf_client_get (client, key, &error);
+  val = get_value_borrowed (client, key, &owner, &error);
 
   if (val != NULL)
     {
-      gdouble retval = def;
-
-      g_assert(error == NULL);
+      g_assert (error == NULL);
       
       if (check_type (key, val, GCONF_VALUE_FLOAT, &error))
         retval = gconf_value_get_float (val);
       else
         handle_error (client, error, err);
+    }
+  else if (error != NULL)
+    handle_error (client, error, err);
 
-      gconf_value_free (val);
+  if (owner != NULL)
+    gconf_entry_free (owner);
 
-      return retval;
-    }
-  else
-    {
-      if (error != NULL)
-        handle_error (client, error, err);
-      return def;
-    }
+  return retval;
 }
 
 gint
@@ -1500,33 +1716,30 @@ gconf_client_get_int   (GConfClient* client, const gchar* key,
 {
   static const gint def = 0;
   GError* error = NULL;
-  GConfValue* val;
+  GConfEntry* owner;
+  const GConfValue* val;
+  gint retval = def;
 
-  g_return_val_if_fail (err == NULL || *err == NULL, 0);
+  g_return_val_if_fail (err == NULL || *err == NULL, def);
 
-  val = gconf_client_get (client, key, &error);
+  val = get_value_borrowed (client, key, &owner, &error);
 
   if (val != NULL)
     {
-      gint retval = def;
-
-      g_assert(error == NULL);
+      g_assert (error == NULL);
       
       if (check_type (key, val, GCONF_VALUE_INT, &error))
-        retval = gconf_value_get_int(val);
+        retval = gconf_value_get_int (val);
       else
         handle_error (client, error, err);
+    }
+  else if (error != NULL)
+    handle_error (client, error, err);
 
-      gconf_value_free (val);
+  if (owner != NULL)
+    gconf_entry_free (owner);
 
-      return retval;
-    }
-  else
-    {
-      if (error != NULL)
-        handle_error (client, error, err);
-      return def;
-    }
+  return retval;
 }
 
 gchar*
@@ -1534,35 +1747,61 @@ gconf_client_get_string(GConfClient* client, const gchar* key,
                         GError** err)
 {
   GError* error = NULL;
-  GConfValue* val;
+  GConfEntry* owner;
+  const GConfValue* val;
+  gchar* retval = NULL;
 
   g_return_val_if_fail (err == NULL || *err == NULL, NULL);
 
-  val = gconf_client_get (client, key, &error);
+  val = get_value_borrowed (client, key, &owner, &error);
 
   if (val != NULL)
     {
-      gchar* retval = NULL;
-
-      g_assert(error == NULL);
+      g_assert (error == NULL);
       
       if (check_type (key, val, GCONF_VALUE_STRING, &error))
-        retval = gconf_value_steal_string (val);
+        retval = g_strdup (gconf_value_get_string (val));
       else
         handle_error (client, error, err);
-      
-      gconf_value_free (val);
-
-      return retval;
     }
-  else
+  else if (error != NULL)
+    handle_error (client, error, err);
+
+  if (owner != NULL)
+    gconf_entry_free (owner);
+
+  return retval;
+}
+
+const gchar*
+gconf_client_peek_string (GConfClient* client, const gchar* key,
+                          GError** err)
+{
+  GError* error = NULL;
+  GConfEntry* owner;
+  const GConfValue* val;
+  const gchar* retval = NULL;
+
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  val = get_value_borrowed (client, key, &owner, &error);
+
+  if (val != NULL)
     {
-      if (error != NULL)
+      g_assert (error == NULL);
+      
+      if (check_type (key, val, GCONF_VALUE_STRING, &error))
+        retval = gconf_value_get_string (val);
+      else
         handle_error (client, error, err);
-      return NULL;
     }
-}
+  else if (error != NULL)
+    handle_error (client, error, err);
 
+  hold_peeked_entry (client, key, owner, retval != NULL);
+
+  return retval;
+}
 
 gboolean
 gconf_client_get_bool  (GConfClient* client, const gchar* key,
@@ -1570,33 +1809,30 @@ gconf_client_get_bool  (GConfClient* client, const gchar* key,
 {
   static const gboolean def = FALSE;
   GError* error = NULL;
-  GConfValue* val;
+  GConfEntry* owner;
+  const GConfValue* val;
+  gboolean retval = def;
 
-  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, def);
 
-  val = gconf_client_get (client, key, &error);
+  val = get_value_borrowed (client, key, &owner, &error);
 
   if (val != NULL)
     {
-      gboolean retval = def;
-
       g_assert (error == NULL);
       
       if (check_type (key, val, GCONF_VALUE_BOOL, &error))
         retval = gconf_value_get_bool (val);
       else
         handle_error (client, error, err);
+    }
+  else if (error != NULL)
+    handle_error (client, error, err);
 
-      gconf_value_free (val);
+  if (owner != NULL)
+    gconf_entry_free (owner);
 
-      return retval;
-    }
-  else
-    {
-      if (error != NULL)
-        handle_error (client, error, err);
-      return def;
-    }
+  return retval;
 }
 
 GConfSchema*
@@ -1604,33 +1840,56 @@ gconf_client_get_schema  (GConfClient* client,
                           const gchar* key, GError** err)
 {
   GError* error = NULL;
-  GConfValue* val;
+  GConfEntry* owner;
+  const GConfValue* val;
+  GConfSchema* retval = NULL;
 
   g_return_val_if_fail (err == NULL || *err == NULL, NULL);
 
-  val = gconf_client_get (client, key, &error);
+  val = get_value_borrowed (client, key, &owner, &error);
 
   if (val != NULL)
     {
-      GConfSchema* retval = NULL;
-
-      g_assert(error == NULL);
+      g_assert (error == NULL);
       
       if (check_type (key, val, GCONF_VALUE_SCHEMA, &error))
-        retval = gconf_value_steal_schema (val);
+        retval = gconf_schema_copy (gconf_value_get_schema (val));
       else
         handle_error (client, error, err);
-      
-      gconf_value_free (val);
-
-      return retval;
     }
-  else
+  else if (error != NULL)
+    handle_error (client, error, err);
+
+  if (owner != NULL)
+    gconf_entry_free (owner);
+
+  return retval;
+}
+
+/* Value for the list and pair getters, which need a value of their
+ * own to convert; steals it from the entry when the entry isn't
+ * cached, so the value is only copied on cache hits
+ */
+static GConfValue*
+get_value_for_conversion (GConfClient *client,
+                          const gchar *key,
+                          GError     **error)
+{
+  GConfEntry* owner;
+  const GConfValue* val;
+  GConfValue* retval;
+
+  val = get_value_borrowed (client, key, &owner, error);
+
+  if (owner != NULL)
     {
-      if (error != NULL)
-        handle_error (client, error, err);
-      return NULL;
+      retval = gconf_entry_steal_value (owner);
+      gconf_entry_free (owner);
     }
+  else
+    retval = val ? gconf_value_copy (val) : NULL;
+
+  return retval;
 }
 
 GSList*
@@ -1642,7 +1901,7 @@ gconf_client_get_list    (GConfClient* client, const gchar* key,
 
   g_return_val_if_fail (err == NULL || *err == NULL, NULL);
 
-  val = gconf_client_get (client, key, &error);
+  val = get_value_for_conversion (client, key, &error);
 
   if (val != NULL)
     {
@@ -1670,6 +1929,47 @@ gconf_client_get_list    (GConfClient* client, const gchar* key,
     }
 }
 
+const GSList*
+gconf_client_peek_list   (GConfClient* client, const gchar* key,
+                          GConfValueType list_type, GError** err)
+{
+  GError* error = NULL;
+  GConfEntry* owner;
+  const GConfValue* val;
+  const GSList* retval = NULL;
+
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  val = get_value_borrowed (client, key, &owner, &error);
+
+  if (val != NULL)
+    {
+      g_assert (error == NULL);
+
+      if (check_type (key, val, GCONF_VALUE_LIST, &error))
+        {
+          if (gconf_value_get_list_type (val) == list_type)
+            retval = gconf_value_get_list (val);
+          else
+            {
+              error = gconf_error_new (GCONF_ERROR_TYPE_MISMATCH,
+                                       _("Expected list of %s, got list of %s"),
+                                       gconf_value_type_to_string (list_type),
+                                       gconf_value_type_to_string (gconf_value_get_list_type (val)));
+              handle_error (client, error, err);
+            }
+        }
+      else
+        handle_error (client, error, err);
+    }
+  else if (error != NULL)
+    handle_error (client, error, err);
+
+  hold_peeked_entry (client, key, owner, retval != NULL);
+
+  return retval;
+}
+
 gboolean
 gconf_client_get_pair    (GConfClient* client, const gchar* key,
                           GConfValueType car_type, GConfValueType cdr_type,
@@ -1681,7 +1981,7 @@ gconf_client_get_pair    (GConfClient* client, const gchar* key,
 
   g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
 
-  val = gconf_client_get (client, key, &error);
+  val = get_value_for_conversion (client, key, &error);
 
   if (val != NULL)
     {
@@ -2005,9 +2305,15 @@ gconf_client_cache (GConfClient *client,
           g_hash_table_replace (client->cache_hash,
                                 new_entry->key,
                                 new_entry);
+          cache_index_add (client, new_entry);
+
+          cache_lru_remove (client, entry);
+          cache_lru_add (client, new_entry);
 
           /* oldkey is inside entry */
           gconf_entry_free (entry);
+
+          cache_enforce_limit (client, new_entry);
         }
       else
         {
@@ -2027,6 +2333,9 @@ gconf_client_cache (GConfClient *client,
         new_entry = gconf_entry_copy (new_entry);
       
       g_hash_table_insert (client->cache_hash, new_entry->key, new_entry);
+      cache_index_add (client, new_entry);
+      cache_lru_add (client, new_entry);
+      cache_enforce_limit (client, new_entry);
       trace ("Added value of '%s' to the cache\n",
              new_entry->key);
 
@@ -2051,6 +2360,456 @@ gconf_client_lookup (GConfClient *client,
   return entry != NULL;
 }
 
+static CacheDir*
+cache_dir_ensure (GConfClient *client,
+                  const gchar *name)
+{
+  CacheDir *cd;
+
+  cd = g_hash_table_lookup (client->cache_dirs, name);
+  if (cd != NULL)
+    return cd;
+
+  cd = g_new0 (CacheDir, 1);
+  cd->name = g_strdup (name);
+  cd->entries = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_hash_table_insert (client->cache_dirs, cd->name, cd);
+
+  if (!(name[0] == '/' && name[1] == '\0'))
+    {
+      gchar *parent_name;
+
+      parent_name = gconf_key_directory (name);
+      cd->parent = cache_dir_ensure (client, parent_name);
+      g_free (parent_name);
+
+      cd->parent->subdirs = g_slist_prepend (cd->parent->subdirs, cd);
+    }
+
+  return cd;
+}
+
+static CacheDir*
+cache_dir_of_key (GConfClient *client,
+                  const gchar *key)
+{
+  CacheDir *cd;
+  gchar *parent_name;
+
+  parent_name = gconf_key_directory (key);
+  if (parent_name == NULL)
+    return NULL;
+
+  cd = g_hash_table_lookup (client->cache_dirs, parent_name);
+  g_free (parent_name);
+
+  return cd;
+}
+
+static void
+cache_dir_free (GConfClient *client,
+                CacheDir    *cd)
+{
+  g_hash_table_remove (client->cache_dirs, cd->name);
+  g_hash_table_destroy (cd->entries);
+  g_slist_free (cd->subdirs);
+  g_free (cd->name);
+  g_free (cd);
+}
+
+/* Drops cd and its parents for as long as they are empty */
+static void
+cache_dir_prune (GConfClient *client,
+                 CacheDir    *cd)
+{
+  while (cd != NULL &&
+         cd->subdirs == NULL &&
+         g_hash_table_size (cd->entries) == 0)
+    {
+      CacheDir *parent = cd->parent;
+
+      if (parent != NULL)
+        parent->subdirs = g_slist_remove (parent->subdirs, cd);
+
+      cache_dir_free (client, cd);
+
+      cd = parent;
+    }
+}
+
+static void
+cache_index_add (GConfClient *client,
+                 GConfEntry  *entry)
+{
+  CacheDir *cd;
+  gchar *parent_name;
+
+  parent_name = gconf_key_directory (entry->key);
+  g_return_if_fail (parent_name != NULL);
+
+  cd = cache_dir_ensure (client, parent_name);
+  g_free (parent_name);
+
+  /* replaces an older entry for the same key */
+  g_hash_table_replace (cd->entries, entry->key, entry);
+}
+
+static void
+cache_index_remove (GConfClient *client,
+                    const gchar *key)
+{
+  CacheDir *cd;
+
+  cd = cache_dir_of_key (client, key);
+  if (cd == NULL)
+    return;
+
+  g_hash_table_remove (cd->entries, key);
+  cache_dir_prune (client, cd);
+}
+
+static void
+free_cached_entry_foreach (gpointer key,
+                           gpointer value,
+                           gpointer user_data)
+{
+  GConfClient *client = user_data;
+  GConfEntry *entry = value;
+
+  cache_lru_remove (client, entry);
+  g_hash_table_remove (client->cache_hash, entry->key);
+  gconf_entry_free (entry);
+}
+
+/* Drops everything cached in cd and below, and cd itself */
+static void
+cache_dir_clear (GConfClient *client,
+                 CacheDir    *cd)
+{
+  GSList *tmp;
+
+  g_hash_table_foreach (cd->entries, free_cached_entry_foreach, client);
+
+  for (tmp = cd->subdirs; tmp != NULL; tmp = tmp->next)
+    cache_dir_clear (client, tmp->data);
+
+  cache_dir_free (client, cd);
+}
+
+/* Drops key and everything below it from the cache */
+static void
+cache_remove_subtree (GConfClient *client,
+                      const gchar *key)
+{
+  CacheDir *cd;
+  CacheDir *parent;
+
+  remove_key_from_cache (client, key);
+
+  cd = g_hash_table_lookup (client->cache_dirs, key);
+  if (cd == NULL)
+    return;
+
+  parent = cd->parent;
+  if (parent != NULL)
+    parent->subdirs = g_slist_remove (parent->subdirs, cd);
+
+  cache_dir_clear (client, cd);
+
+  cache_dir_prune (client, parent);
+}
+
+static gsize
+value_cache_size (const GConfValue *value)
+{
+  gsize size;
+
+  if (value == NULL)
+    return 0;
+
+  /* GConfValue is smaller than the real value struct */
+  size = 4 * sizeof (gpointer);
+
+  switch (value->type)
+    {
+    case GCONF_VALUE_STRING:
+      size += strlen (gconf_value_get_string (value)) + 1;
+      break;
+
+    case GCONF_VALUE_LIST:
+      {
+        GSList *tmp;
+
+        for (tmp = gconf_value_get_list (value); tmp != NULL; tmp = tmp->next)
+          size += sizeof (GSList) + value_cache_size (tmp->data);
+      }
+      break;
+
+    case GCONF_VALUE_PAIR:
+      size += value_cache_size (gconf_value_get_car (value));
+      size += value_cache_size (gconf_value_get_cdr (value));
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema *schema = gconf_value_get_schema (value);
+        const gchar *str;
+
+        size += 8 * sizeof (gpointer);
+
+        if ((str = gconf_schema_get_locale (schema)) != NULL)
+          size += strlen (str) + 1;
+        if ((str = gconf_schema_get_short_desc (schema)) != NULL)
+          size += strlen (str) + 1;
+        if ((str = gconf_schema_get_long_desc (schema)) != NULL)
+          size += strlen (str) + 1;
+        if ((str = gconf_schema_get_owner (schema)) != NULL)
+          size += strlen (str) + 1;
+
+        size += value_cache_size (gconf_schema_get_default_value (schema));
+      }
+      break;
+
+    default:
+      break;
+    }
+
+  return size;
+}
+
+/* Rough estimate of the memory a cached entry keeps alive, including
+ * the bookkeeping in cache_hash, the directory index and the LRU list
+ */
+static gsize
+entry_cache_size (const GConfEntry *entry)
+{
+  gsize size;
+
+  size = sizeof (GConfEntry) + strlen (entry->key) + 1;
+
+  if (gconf_entry_get_schema_name (entry))
+    size += strlen (gconf_entry_get_schema_name (entry)) + 1;
+
+  size += value_cache_size (gconf_entry_get_value (entry));
+
+  /* hash nodes in cache_hash, the CacheDir and cache_lru_links,
+   * and the GList link in cache_lru
+   */
+  size += 3 * 3 * sizeof (gpointer) + sizeof (GList);
+
+  return size;
+}
+
+static void
+cache_lru_add (GConfClient *client,
+               GConfEntry  *entry)
+{
+  GConfClientPrivate *priv = client->priv;
+
+  g_queue_push_head (&priv->cache_lru, entry);
+  g_hash_table_insert (priv->cache_lru_links, entry->key,
+                       priv->cache_lru.head);
+
+  priv->cache_bytes += entry_cache_size (entry);
+}
+
+static void
+cache_lru_remove (GConfClient *client,
+                  GConfEntry  *entry)
+{
+  GConfClientPrivate *priv = client->priv;
+  GList *link;
+
+  link = g_hash_table_lookup (priv->cache_lru_links, entry->key);
+  if (link == NULL || link->data != entry)
+    return;
+
+  g_hash_table_remove (priv->cache_lru_links, entry->key);
+  g_queue_delete_link (&priv->cache_lru, link);
+
+  priv->cache_bytes -= entry_cache_size (entry);
+}
+
+static void
+cache_lru_touch (GConfClient *client,
+                 GConfEntry  *entry)
+{
+  GConfClientPrivate *priv = client->priv;
+  GList *link;
+
+  link = g_hash_table_lookup (priv->cache_lru_links, entry->key);
+  if (link == NULL || link == priv->cache_lru.head)
+    return;
+
+  g_queue_unlink (&priv->cache_lru, link);
+  g_queue_push_head_link (&priv->cache_lru, link);
+}
+
+/* Drops the least recently read entries until the cache fits in its
+ * limit again; keep is the entry just added and is never dropped
+ */
+static void
+cache_enforce_limit (GConfClient *client,
+                     GConfEntry  *keep)
+{
+  GConfClientPrivate *priv = client->priv;
+
+  if (priv->cache_limit == 0)
+    return;
+
+  while (priv->cache_bytes > priv->cache_limit &&
+         priv->cache_lru.tail != NULL &&
+         priv->cache_lru.tail->data != keep)
+    {
+      GConfEntry *entry = priv->cache_lru.tail->data;
+
+      trace ("Evicting '%s' from the cache\n", entry->key);
+
+      remove_key_from_cache (client, entry->key);
+      priv->cache_evictions += 1;
+    }
+}
+
+void
+gconf_client_set_cache_limit (GConfClient *client,
+                              gsize        max_bytes)
+{
+  g_return_if_fail (GCONF_IS_CLIENT (client));
+
+  client->priv->cache_limit = max_bytes;
+
+  cache_enforce_limit (client, NULL);
+}
+
+gsize
+gconf_client_get_cache_limit (GConfClient *client)
+{
+  g_return_val_if_fail (GCONF_IS_CLIENT (client), 0);
+
+  return client->priv->cache_limit;
+}
+
+void
+gconf_client_get_cache_stats (GConfClient *client,
+                              guint       *hits,
+                              guint       *misses,
+                              guint       *evictions,
+                              gsize       *n_bytes)
+{
+  GConfClientPrivate *priv;
+
+  g_return_if_fail (GCONF_IS_CLIENT (client));
+
+  priv = client->priv;
+
+  if (hits)
+    *hits = priv->cache_hits;
+  if (misses)
+    *misses = priv->cache_misses;
+  if (evictions)
+    *evictions = priv->cache_evictions;
+  if (n_bytes)
+    *n_bytes = priv->cache_bytes;
+}
+
+static void
+absent_key_free (AbsentKey *absent)
+{
+  gconf_entry_unref (absent->entry);
+  g_free (absent);
+}
+
+static glong
+absent_key_now (void)
+{
+  GTimeVal now;
+
+  g_get_current_time (&now);
+
+  return now.tv_sec;
+}
+
+static GConfEntry*
+absent_key_lookup (GConfClient *client,
+                   const gchar *key)
+{
+  AbsentKey *absent;
+
+  absent = g_hash_table_lookup (client->priv->absent_keys, key);
+  if (absent == NULL)
+    return NULL;
+
+  if (absent->expires <= absent_key_now ())
+    {
+      g_hash_table_remove (client->priv->absent_keys, key);
+      return NULL;
+    }
+
+  return absent->entry;
+}
+
+static gboolean
+absent_key_expired_foreach (gpointer key,
+                            gpointer value,
+                            gpointer user_data)
+{
+  AbsentKey *absent = value;
+  glong *now = user_data;
+
+  return absent->expires <= *now;
+}
+
+static void
+absent_key_add (GConfClient *client,
+                GConfEntry  *entry)
+{
+  GHashTable *absent_keys = client->priv->absent_keys;
+  AbsentKey *absent;
+  glong now;
+
+  now = absent_key_now ();
+
+  if (g_hash_table_size (absent_keys) >= ABSENT_KEYS_MAX)
+    g_hash_table_foreach_remove (absent_keys,
+                                 absent_key_expired_foreach, &now);
+
+  if (g_hash_table_size (absent_keys) >= ABSENT_KEYS_MAX)
+    return;
+
+  absent = g_new (AbsentKey, 1);
+  /* a copy, since the caller gets entry */
+  absent->entry = gconf_entry_copy (entry);
+  absent->expires = now + ABSENT_KEY_TTL;
+
+  g_hash_table_replace (absent_keys, absent->entry->key, absent);
+}
+
+static gboolean
+absent_key_below_foreach (gpointer key,
+                          gpointer value,
+                          gpointer user_data)
+{
+  return gconf_key_is_below (user_data, key);
+}
+
+static void
+absent_key_forget (GConfClient *client,
+                   const gchar *key,
+                   gboolean     recursive)
+{
+  GHashTable *absent_keys = client->priv->absent_keys;
+
+  if (g_hash_table_size (absent_keys) == 0)
+    return;
+
+  if (recursive)
+    g_hash_table_foreach_remove (absent_keys,
+                                 absent_key_below_foreach, (gchar*) key);
+  else
+    g_hash_table_remove (absent_keys, key);
+}
+
 /*
  * Dir
  */
@@ -2209,6 +2968,41 @@ gconf_client_commit_change_set   (GConfClient* client,
     }
 }
 
+/* Like gconf_client_get_without_default(), but shares the cached
+ * value instead of copying it
+ */
+static GConfValue*
+get_value_shared (GConfClient *client,
+                  const gchar *key,
+                  GError     **err)
+{
+  GError *error = NULL;
+  GConfEntry *entry;
+  GConfValue *retval;
+  gboolean owned;
+
+  entry = get_borrowed (client, key, FALSE, &owned, &error);
+
+  if (entry == NULL)
+    {
+      if (error != NULL)
+        handle_error (client, error, err);
+      return NULL;
+    }
+
+  if (owned)
+    {
+      retval = gconf_entry_steal_value (entry);
+      gconf_entry_free (entry);
+    }
+  else if (gconf_entry_get_value (entry) != NULL)
+    retval = gconf_value_ref (gconf_entry_get_value (entry));
+  else
+    retval = NULL;
+
+  return retval;
+}
+
 struct RevertData {
   GConfClient* client;
   GError* error;
@@ -2230,7 +3024,7 @@ revert_foreach (GConfChangeSet* cs,
   if (rd->error != NULL)
     return;
 
-  old_value = gconf_client_get_without_default(rd->client, key, &error);
+  old_value = get_value_shared (rd->client, key, &error);
 
   if (error != NULL)
     {
@@ -2305,7 +3099,7 @@ gconf_client_change_set_from_currentv (GConfClient* client,
       GError* error = NULL;
       const gchar* key = *keyp;
       
-      old_value = gconf_client_get_without_default(client, key, &error);
+      old_value = get_value_shared (client, key, &error);
 
       if (error != NULL)
         {
@@ -2501,6 +3295,10 @@ gconf_client_flush_notifies (GConfClient *client)
   GConfEntry *last_entry;
 
   trace ("Flushing notify queue\n");
+
+  /* Values handed out by the peek functions are only valid until now */
+  g_hash_table_foreach_remove (client->priv->peeked,
+                               release_peeked_foreach, NULL);
   
   /* Adopt notify list and clear it, to avoid reentrancy concerns.
    * Sort it to compress duplicates, and keep people from relying on
@@ -68,6 +68,7 @@ typedef enum { /*< prefix=GCONF_CLIENT >*/
 
 
 typedef struct _GConfClient       GConfClient;
+typedef struct _GConfClientPrivate GConfClientPrivate;
 typedef struct _GConfClientClass  GConfClientClass;
 
 
@@ -100,8 +101,8 @@ struct _GConfClient
   GSList *notify_list;
   guint notify_handler;
   int pending_notify_count;
-  gpointer pad1;
-  int pad2;  
+  GHashTable* cache_dirs;
+  GConfClientPrivate* priv;
 };
 
 struct _GConfClientClass
@@ -214,6 +215,28 @@ void              gconf_client_set_global_default_error_handler(GConfClientError
  */
 void              gconf_client_clear_cache(GConfClient* client);
 
+/*
+ * Put an upper bound, in bytes, on the memory used by the cache.
+ * Once the cache grows past it the least recently read entries are
+ * dropped; they are fetched again the next time they are read.
+ * The sizes are estimates. 0, the default, means no limit.
+ */
+void              gconf_client_set_cache_limit (GConfClient* client,
+                                                gsize        max_bytes);
+gsize             gconf_client_get_cache_limit (GConfClient* client);
+
+/*
+ * Counters to help size the cache: reads answered from the cache,
+ * reads that had to go to the server, entries dropped to stay under
+ * the limit, and the estimated size of the cache. Any of the
+ * pointers may be NULL.
+ */
+void              gconf_client_get_cache_stats (GConfClient* client,
+                                                guint*       hits,
+                                                guint*       misses,
+                                                guint*       evictions,
+                                                gsize*       n_bytes);
+
 /*
  * Preload a directory; the directory must have been added already.
  * This is only useful as an optimization if you clear the cache,
@@ -309,6 +332,21 @@ gboolean     gconf_client_get_pair    (GConfClient* client, const gchar* key,
                                        gpointer car_retloc, gpointer cdr_retloc,
                                        GError** err);
 
+/*
+ * Like gconf_client_get_string() and gconf_client_get_list(), but
+ * return the client's own copy instead of allocating one. The result
+ * must not be modified or freed, and stays valid until the client
+ * dispatches its next change notification. The list returned by
+ * gconf_client_peek_list() holds GConfValue elements of list_type.
+ * Meant for keys under a directory added with gconf_client_add_dir();
+ * for other keys each peek keeps a fetched value alive until then.
+ */
+const gchar*  gconf_client_peek_string (GConfClient* client, const gchar* key,
+                                        GError** err);
+
+const GSList* gconf_client_peek_list   (GConfClient* client, const gchar* key,
+                                        GConfValueType list_type, GError** err);
+
 /* No convenience functions for lists or pairs, since there are too
    many combinations of types possible
 */
@@ -369,7 +407,8 @@ gboolean        gconf_client_commit_change_set   (GConfClient* client,
                                                   GError** err);
 
 /* Create a change set that would revert the given change set
-   for the given GConfClient */
+   for the given GConfClient. The values in change sets created
+   by these functions may be shared with the client's cache. */
 GConfChangeSet* gconf_client_reverse_change_set  (GConfClient* client,
                                                          GConfChangeSet* cs,
                                                          GError** err);
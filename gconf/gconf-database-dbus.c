@@ -28,10 +28,13 @@
 #define DATABASE_OBJECT_PATH "/org/gnome/GConf/Database"
 
 static gint object_nr = 0;
+static guint next_notification_id = 0;
 
 typedef struct {
-  char  *namespace_section;
+  const GConfKeyAtom *namespace_section;
   GList *clients;
+  /* Listener id passed on to the sources */
+  guint  id;
 } NotificationData;
 
 typedef struct {
@@ -74,7 +77,8 @@ static void     database_handle_dir_exists        (DBusConnection   *conn,
 						   GConfDatabase    *db);
 static void     database_handle_get_all_entries   (DBusConnection   *conn,
 						   DBusMessage      *message,
-						   GConfDatabase    *db);
+						   GConfDatabase    *db,
+						   gboolean          binary);
 static void     database_handle_get_all_dirs      (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
@@ -84,6 +88,9 @@ static void     database_handle_set_schema        (DBusConnection   *conn,
 static void     database_handle_suggest_sync      (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
+static void     database_handle_set_locale        (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
 static void     database_handle_add_notify        (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
@@ -157,7 +164,12 @@ database_message_func (DBusConnection *connection,
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
 					GCONF_DBUS_DATABASE_GET_ALL_ENTRIES)) {
-    database_handle_get_all_entries (connection, message, db);
+    database_handle_get_all_entries (connection, message, db, FALSE);
+  }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_GET_ALL_ENTRIES_BINARY)) {
+    database_handle_get_all_entries (connection, message, db, TRUE);
   }
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
@@ -174,6 +186,11 @@ database_message_func (DBusConnection *connection,
 					GCONF_DBUS_DATABASE_SUGGEST_SYNC)) {
     database_handle_suggest_sync (connection, message, db);
   }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_SET_LOCALE)) {
+    database_handle_set_locale (connection, message, db);
+  }
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
 					GCONF_DBUS_DATABASE_ADD_NOTIFY)) {
@@ -268,6 +285,130 @@ database_handle_name_owner_changed (DBusConnection *connection,
   return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
     
+static void
+database_resume_request (gpointer user_data)
+{
+  DBusMessage    *message = user_data;
+  DBusConnection *conn;
+  GConfDatabase  *db;
+  
+  conn = gconfd_dbus_get_connection ();
+
+  /* The database may have been dropped while we waited */
+  db = NULL;
+  if (dbus_connection_get_object_path_data (conn,
+					    dbus_message_get_path (message),
+					    (void **) &db) &&
+      db != NULL)
+    database_message_func (conn, message, db);
+  else
+    {
+      GError *gerror = NULL;
+
+      gconf_set_error (&gerror, GCONF_ERROR_FAILED,
+		       _("The configuration database was closed while the request was pending"));
+      gconfd_dbus_set_exception (conn, message, &gerror);
+    }
+
+  dbus_message_unref (message);
+}
+
+/* Puts the request aside if reading key would block on a slow
+ * source; it is handled again once the sources are ready. Returns
+ * TRUE if it did.
+ */
+static gboolean
+database_suspend_request (DBusMessage   *message,
+			  GConfDatabase *db,
+			  const gchar   *key)
+{
+  if (gconf_sources_prepare_read (db->sources, key,
+				  database_resume_request, message))
+    return FALSE;
+
+  /* ready_func only runs from the main loop, so this is in time */
+  dbus_message_ref (message);
+
+  return TRUE;
+}
+
+/* Reads the key (or dir) and locale arguments shared by the lookup
+ * methods, plus the use_schema_default flag if asked for.  The locale
+ * is either a string or an id from SetLocale.
+ */
+static gboolean
+database_get_locale_args (DBusConnection   *conn,
+			  DBusMessage      *message,
+			  gchar           **key,
+			  GConfLocaleList **locales,
+			  gboolean         *use_schema_default)
+{
+  DBusMessageIter iter;
+  DBusMessage *reply;
+  const gchar *locale;
+  dbus_uint32_t id;
+  dbus_bool_t flag;
+
+  if (!dbus_message_iter_init (message, &iter) ||
+      dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_STRING)
+    goto malformed;
+
+  dbus_message_iter_get_basic (&iter, key);
+  dbus_message_iter_next (&iter);
+
+  switch (dbus_message_iter_get_arg_type (&iter))
+    {
+    case DBUS_TYPE_STRING:
+      dbus_message_iter_get_basic (&iter, &locale);
+
+      /* The cache keeps its own reference until it expires, which
+       * can't happen while this request is handled.
+       */
+      *locales = gconfd_locale_cache_lookup (locale);
+      gconf_locale_list_unref (*locales);
+      break;
+
+    case DBUS_TYPE_UINT32:
+      dbus_message_iter_get_basic (&iter, &id);
+
+      *locales = gconfd_locale_id_lookup (id);
+      if (*locales == NULL)
+	{
+	  reply = dbus_message_new_error (message,
+					  GCONF_DBUS_ERROR_UNKNOWN_LOCALE_ID,
+					  _("Unknown locale id"));
+	  dbus_connection_send (conn, reply, NULL);
+	  dbus_message_unref (reply);
+	  return FALSE;
+	}
+      break;
+
+    default:
+      goto malformed;
+    }
+
+  if (use_schema_default)
+    {
+      dbus_message_iter_next (&iter);
+
+      if (dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_BOOLEAN)
+	goto malformed;
+
+      dbus_message_iter_get_basic (&iter, &flag);
+      *use_schema_default = flag;
+    }
+
+  return TRUE;
+
+ malformed:
+  reply = dbus_message_new_error (message, GCONF_DBUS_ERROR_FAILED,
+				  _("Got a malformed message."));
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+
+  return FALSE;
+}
+
 static void
 database_handle_lookup (DBusConnection *conn,
                         DBusMessage    *message,
@@ -276,20 +417,17 @@ database_handle_lookup (DBusConnection *conn,
   GConfValue *value;
   DBusMessage *reply;
   gchar *key;
-  gchar *locale;
   GConfLocaleList *locales;
   gboolean use_schema_default;
   GError *gerror = NULL;
   DBusMessageIter iter;
   
-  if (!gconfd_dbus_get_message_args (conn, message,
-				     DBUS_TYPE_STRING, &key,
-				     DBUS_TYPE_STRING, &locale,
-				     DBUS_TYPE_BOOLEAN, &use_schema_default,
-				     DBUS_TYPE_INVALID))
+  if (!database_get_locale_args (conn, message, &key, &locales,
+				 &use_schema_default))
+    return;
+
+  if (database_suspend_request (message, db, key))
     return;
-  
-  locales = gconfd_locale_cache_lookup (locale);
   
   value = gconf_database_query_value (db, key, locales->list, 
 				      use_schema_default,
@@ -322,20 +460,17 @@ database_handle_lookup_ext (DBusConnection *conn,
   gboolean value_is_writable;
   DBusMessage *reply;
   gchar *key;
-  gchar *locale;
   GConfLocaleList *locales;
   gboolean use_schema_default;
   GError *gerror = NULL;
   DBusMessageIter iter;
   
-  if (!gconfd_dbus_get_message_args (conn, message,
-				     DBUS_TYPE_STRING, &key,
-				     DBUS_TYPE_STRING, &locale,
-				     DBUS_TYPE_BOOLEAN, &use_schema_default,
-				     DBUS_TYPE_INVALID))
+  if (!database_get_locale_args (conn, message, &key, &locales,
+				 &use_schema_default))
+    return;
+
+  if (database_suspend_request (message, db, key))
     return;
-  
-  locales = gconfd_locale_cache_lookup (locale);
   
   value = gconf_database_query_value (db, key, locales->list,
 				      use_schema_default,
@@ -375,19 +510,13 @@ database_handle_lookup_default (DBusConnection *conn,
   GConfValue *value;
   DBusMessage *reply;
   gchar *key;
-  gchar *locale;
   GConfLocaleList *locales;
   GError *gerror = NULL;
   DBusMessageIter iter;
   
-  if (!gconfd_dbus_get_message_args (conn, message,
-				     DBUS_TYPE_STRING, &key,
-				     DBUS_TYPE_STRING, &locale,
-				     DBUS_TYPE_INVALID))
+  if (!database_get_locale_args (conn, message, &key, &locales, NULL))
     return;
 
-  locales = gconfd_locale_cache_lookup (locale);
-
   value = gconf_database_query_default_value (db, key, locales->list,
 					      NULL,
 					      &gerror);
@@ -538,23 +667,21 @@ database_handle_dir_exists (DBusConnection *conn,
 static void
 database_handle_get_all_entries (DBusConnection *conn,
                                  DBusMessage    *message,
-                                 GConfDatabase  *db)
+                                 GConfDatabase  *db,
+                                 gboolean        binary)
 {
   GSList *entries, *l;
   gchar  *dir;
-  gchar  *locale;
   GError *gerror = NULL;
   GConfLocaleList* locales;
   DBusMessage *reply;
   DBusMessageIter iter;
 
-  if (!gconfd_dbus_get_message_args (conn, message, 
-				     DBUS_TYPE_STRING, &dir,
-				     DBUS_TYPE_STRING, &locale,
-				     DBUS_TYPE_INVALID)) 
+  if (!database_get_locale_args (conn, message, &dir, &locales, NULL))
     return;
 
-  locales = gconfd_locale_cache_lookup (locale);
+  if (database_suspend_request (message, db, dir))
+    return;
 
   entries = gconf_database_all_entries (db, dir, 
 					locales->list, &gerror);
@@ -566,7 +693,7 @@ database_handle_get_all_entries (DBusConnection *conn,
 
   dbus_message_iter_init_append (reply, &iter);
 
-  gconf_dbus_utils_append_entries (&iter, entries);
+  gconf_dbus_utils_append_entries (&iter, entries, binary);
 
   for (l = entries; l; l = l->next)
     {
@@ -679,6 +806,33 @@ database_handle_suggest_sync (DBusConnection *conn,
   dbus_message_unref (reply);
 }
 
+static void
+database_handle_set_locale (DBusConnection *conn,
+			    DBusMessage    *message,
+			    GConfDatabase  *db)
+{
+  gchar *locale;
+  dbus_uint32_t id;
+  DBusMessage *reply;
+
+  if (!gconfd_dbus_get_message_args (conn, message,
+				     DBUS_TYPE_STRING, &locale,
+				     DBUS_TYPE_INVALID))
+    return;
+
+  /* Ids are shared by all clients and databases, so each distinct
+   * locale only has its fallback list computed once.
+   */
+  id = gconfd_locale_id_register (locale);
+
+  reply = dbus_message_new_method_return (message);
+  dbus_message_append_args (reply,
+			    DBUS_TYPE_UINT32, &id,
+			    DBUS_TYPE_INVALID);
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+}
+
 static void
 database_handle_add_notify (DBusConnection    *conn,
                             DBusMessage       *message,
@@ -689,6 +843,7 @@ database_handle_add_notify (DBusConnection    *conn,
   const char *sender;
   NotificationData *notification;
   ListeningClientData *client;
+  const GConfKeyAtom *atom;
 
   if (!gconfd_dbus_get_message_args (conn, message,
 				     DBUS_TYPE_STRING, &namespace_section,
@@ -707,15 +862,28 @@ database_handle_add_notify (DBusConnection    *conn,
       client->nr_of_notifications++;
     }
   
-  notification = g_hash_table_lookup (db->notifications, namespace_section);
+  atom = gconf_key_atom_intern (namespace_section);
+  notification = g_hash_table_lookup (db->notifications, atom);
   
-  if (notification == NULL)
+  if (notification != NULL)
+    {
+      /* The notification already holds a reference */
+      gconf_key_atom_unref (atom);
+    }
+  else
     {
       notification = g_new0 (NotificationData, 1);
-      notification->namespace_section = g_strdup (namespace_section);
+      notification->namespace_section = atom;
+      notification->id = ++next_notification_id;
 
-      g_hash_table_insert (db->notifications,
-			   notification->namespace_section, notification);
+      g_hash_table_insert (db->notifications, (gpointer) atom, notification);
+
+      /* Lets backends that can detect external changes know what
+       * we're interested in.
+       */
+      gconf_sources_add_listener (db->sources,
+				  notification->id,
+				  atom->full_name);
     }
   
   notification->clients = g_list_prepend (notification->clients,
@@ -741,10 +909,12 @@ database_remove_notification_data (GConfDatabase *db,
   notification->clients = g_list_remove_link (notification->clients, element);
   if (notification->clients == NULL)
     {
+      gconf_sources_remove_listener (db->sources, notification->id);
+
       g_hash_table_remove (db->notifications,
 			   notification->namespace_section);
 
-      g_free (notification->namespace_section);
+      gconf_key_atom_unref (notification->namespace_section);
       g_free (notification);
     }
   
@@ -764,6 +934,7 @@ database_handle_remove_notify (DBusConnection    *conn,
   const char *sender;
   NotificationData *notification;
   ListeningClientData *client;
+  const GConfKeyAtom *atom;
   
   if (!gconfd_dbus_get_message_args (conn, message,
 				     DBUS_TYPE_STRING, &namespace_section,
@@ -772,7 +943,9 @@ database_handle_remove_notify (DBusConnection    *conn,
 
   sender = dbus_message_get_sender (message);
   
-  notification = g_hash_table_lookup (db->notifications, namespace_section);
+  /* A namespace that was never interned was never registered either */
+  atom = gconf_key_atom_lookup (namespace_section);
+  notification = atom ? g_hash_table_lookup (db->notifications, atom) : NULL;
 
   client = g_hash_table_lookup (db->listening_clients, sender);
   if (client) {
@@ -858,7 +1031,7 @@ gconf_database_dbus_setup (GConfDatabase *db)
 					&database_vtable,
 					db);
 
-  db->notifications = g_hash_table_new (g_str_hash, g_str_equal);
+  db->notifications = g_hash_table_new (g_direct_hash, g_direct_equal);
   db->listening_clients = g_hash_table_new (g_str_hash, g_str_equal);
  
   dbus_connection_add_filter (conn,
@@ -889,6 +1062,61 @@ gconf_database_dbus_get_path (GConfDatabase *db)
   return db->object_path;
 }
 
+/* Find the innermost interned directory containing the key; any
+ * namespace a client listens on is interned, so nothing below it
+ * can have listeners.  Usually the key or its parent is already
+ * known and no string needs to be copied.
+ */
+static const GConfKeyAtom *
+lookup_innermost_atom (const gchar *key)
+{
+  const GConfKeyAtom *atom;
+  char *dir, *sep;
+
+  atom = gconf_key_atom_lookup (key);
+  if (atom != NULL)
+    return atom;
+
+  dir = g_strdup (key);
+
+  while (atom == NULL)
+    {
+      sep = strrchr (dir, '/');
+      if (sep == NULL)
+	break;
+
+      /* Special case to catch notifications on the root. */
+      if (sep == dir)
+	sep[1] = '\0';
+      else
+	*sep = '\0';
+
+      atom = gconf_key_atom_lookup (dir);
+
+      if (sep == dir)
+	break;
+    }
+
+  g_free (dir);
+
+  return atom;
+}
+
+gboolean
+gconf_database_dbus_has_listeners (GConfDatabase *db,
+				   const gchar   *key)
+{
+  const GConfKeyAtom *atom;
+
+  for (atom = lookup_innermost_atom (key); atom != NULL; atom = atom->parent)
+    {
+      if (g_hash_table_lookup (db->notifications, atom) != NULL)
+	return TRUE;
+    }
+
+  return FALSE;
+}
+
 void
 gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 				      GConfSources     *modified_sources,
@@ -898,75 +1126,56 @@ gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 				      gboolean          is_writable,
 				      gboolean          notify_others)
 {
-  char             *dir, *sep;
   GList            *l;
   NotificationData *notification;
   DBusMessage      *message;
-  gboolean          last;
-  
-  dir = g_strdup (key);
+  const GConfKeyAtom *atom;
+
+  atom = lookup_innermost_atom (key);
 
-  /* Lookup the key in the namespace hierarchy, start with the full key and then
-   * remove the leaf, lookup again, remove the leaf, and so on until a match is
-   * found. Notify the clients (identified by their base service) that
-   * correspond to the found namespace.
+  /* Walk up the namespace hierarchy from there, notifying the clients
+   * (identified by their base service) of each namespace that has a
+   * listener.
    */
-  last = FALSE;
-  while (1)
+  for (; atom != NULL; atom = atom->parent)
     {
-      notification = g_hash_table_lookup (db->notifications, dir);
+      notification = g_hash_table_lookup (db->notifications, atom);
 
-      if (notification)
+      if (notification == NULL)
+	continue;
+
+      for (l = notification->clients; l; l = l->next)
 	{
-	  for (l = notification->clients; l; l = l->next)
-	    {
-	      const char *base_service = l->data;
-	      DBusMessageIter iter;
-	      
-	      message = dbus_message_new_method_call (base_service,
-						      GCONF_DBUS_CLIENT_OBJECT,
-						      GCONF_DBUS_CLIENT_INTERFACE,
-						      "Notify");
-
-	      dbus_message_append_args (message,
-					DBUS_TYPE_STRING, &db->object_path,
-					DBUS_TYPE_STRING, &dir,
-					DBUS_TYPE_INVALID);
-
-	      dbus_message_iter_init_append (message, &iter);
-	      
-	      gconf_dbus_utils_append_entry_values (&iter,
-						    key,
-						    value,
-						    is_default,
-						    is_writable,
-						    NULL);
-	      
-	      dbus_message_set_no_reply (message, TRUE);
-	      
-	      dbus_connection_send (gconfd_dbus_get_connection (), message, NULL);
-	      dbus_message_unref (message);
-	    }
-	}
+	  const char *base_service = l->data;
+	  const char *namespace_section = atom->full_name;
+	  DBusMessageIter iter;
 
-      if (last)
-	break;
-      
-      sep = strrchr (dir, '/');
+	  message = dbus_message_new_method_call (base_service,
+						  GCONF_DBUS_CLIENT_OBJECT,
+						  GCONF_DBUS_CLIENT_INTERFACE,
+						  "Notify");
 
-      /* Special case to catch notifications on the root. */
-      if (sep == dir)
-	{
-	  last = TRUE;
-	  sep[1] = '\0';
+	  dbus_message_append_args (message,
+				    DBUS_TYPE_STRING, &db->object_path,
+				    DBUS_TYPE_STRING, &namespace_section,
+				    DBUS_TYPE_INVALID);
+
+	  dbus_message_iter_init_append (message, &iter);
+
+	  gconf_dbus_utils_append_entry_values (&iter,
+						key,
+						value,
+						is_default,
+						is_writable,
+						NULL);
+
+	  dbus_message_set_no_reply (message, TRUE);
+
+	  dbus_connection_send (gconfd_dbus_get_connection (), message, NULL);
+	  dbus_message_unref (message);
 	}
-      else
-	*sep = '\0';
     }
 
-    
-  g_free (dir);
-
   if (modified_sources)
     {
       if (notify_others)
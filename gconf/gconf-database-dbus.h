@@ -33,5 +33,8 @@ void         gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 						   gboolean          is_default,
 						   gboolean          is_writable,
 						   gboolean          notify_others);
+/* Whether some client listens on key or a directory above it */
+gboolean     gconf_database_dbus_has_listeners    (GConfDatabase    *db,
+						   const gchar      *key);
 
 #endif
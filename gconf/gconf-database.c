@@ -1028,6 +1028,33 @@ gconf_database_schedule_sync(GConfDatabase* db)
   db->sync_timeout = g_timeout_add(SYNC_TIMEOUT, (GSourceFunc)gconf_database_sync_timeout, db);
 }
 
+#ifdef HAVE_CORBA
+static void
+has_listeners_cb (GConfListeners *listeners,
+		  const gchar    *all_above_key,
+		  guint           cnxn_id,
+		  gpointer        listener_data,
+		  gpointer        user_data)
+{
+  *(gboolean *) user_data = TRUE;
+}
+#endif
+
+static gboolean
+database_has_listeners (GConfDatabase *db,
+			const gchar   *key)
+{
+#ifdef HAVE_CORBA
+  gboolean found = FALSE;
+
+  gconf_listeners_notify (db->listeners, key, has_listeners_cb, &found);
+
+  return found;
+#else
+  return gconf_database_dbus_has_listeners (db, key);
+#endif
+}
+
 static void
 source_notify_cb (GConfSource   *source,
 		  const gchar   *location,
@@ -1037,6 +1064,12 @@ source_notify_cb (GConfSource   *source,
   g_return_if_fail (location != NULL);
   g_return_if_fail (db != NULL);
 
+  gconf_sources_invalidate (db->sources, location);
+
+  /* Don't look up the new value if nobody is listening to it */
+  if (!database_has_listeners (db, location))
+    return;
+
   if (gconf_sources_is_affected (db->sources, source, location))
     {
       GConfValue  *value;
@@ -1088,7 +1121,8 @@ source_notify_cb (GConfSource   *source,
 					    is_writable,
 					    FALSE);
 #endif
-      gconf_value_free (value);
+      if (value != NULL)
+        gconf_value_free (value);
     }
 }
 
@@ -1947,6 +1981,67 @@ gconfd_locale_cache_drop(void)
     }
 }
 
+/*
+ * Locale ids
+ */
+
+/* Clients rarely use more than one locale, so this is only a guard
+ * against a client registering arbitrary strings.
+ */
+#define MAX_LOCALE_IDS 256
+
+/* Indexed by id - locale_id_base; each entry holds a reference, so
+ * ids stay valid when the locale cache above expires.
+ */
+static GPtrArray*  locale_id_lists = NULL;
+static GHashTable* locale_ids = NULL;
+
+/* Ids start at a random base, so that an id a client got from an
+ * earlier daemon is very unlikely to name a locale in this one.
+ */
+static guint32     locale_id_base = 0;
+
+guint
+gconfd_locale_id_register (const gchar *locale)
+{
+  GConfLocaleList* locale_list;
+  guint id;
+
+  if (locale_ids == NULL)
+    {
+      locale_ids = g_hash_table_new (g_str_hash, g_str_equal);
+      locale_id_lists = g_ptr_array_new ();
+      /* Never 0, and no id can wrap around */
+      locale_id_base = 1 + g_random_int () % (G_MAXUINT32 - MAX_LOCALE_IDS);
+    }
+
+  id = GPOINTER_TO_UINT (g_hash_table_lookup (locale_ids, locale));
+  if (id != 0)
+    return id;
+
+  if (locale_id_lists->len >= MAX_LOCALE_IDS)
+    return 0;
+
+  locale_list = gconfd_locale_cache_lookup (locale);
+  id = locale_id_base + locale_id_lists->len;
+  g_ptr_array_add (locale_id_lists, locale_list);
+
+  g_hash_table_insert (locale_ids, g_strdup (locale), GUINT_TO_POINTER (id));
+
+  return id;
+}
+
+GConfLocaleList*
+gconfd_locale_id_lookup (guint id)
+{
+  if (locale_id_lists == NULL ||
+      id < locale_id_base ||
+      id - locale_id_base >= locale_id_lists->len)
+    return NULL;
+
+  return g_ptr_array_index (locale_id_lists, id - locale_id_base);
+}
+
 #ifdef HAVE_CORBA
 /*
  * The listener object
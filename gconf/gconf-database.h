@@ -150,6 +150,13 @@ GConfLocaleList* gconfd_locale_cache_lookup(const gchar* locale);
 void gconfd_locale_cache_expire (void);
 void gconfd_locale_cache_drop  (void);
 
+/* Ids that clients use in place of a locale string.  They are only
+ * valid for this daemon instance, which starts them at a random base;
+ * 0 is never a valid id.
+ */
+guint            gconfd_locale_id_register (const gchar *locale);
+GConfLocaleList* gconfd_locale_id_lookup   (guint        id);
+
 const gchar* gconf_database_get_persistent_name (GConfDatabase *db);
 
 #ifdef HAVE_CORBA
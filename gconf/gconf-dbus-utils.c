@@ -25,6 +25,21 @@
  *
  */
 
+/* Binary entry, as sent by AllEntriesBinary:
+ *
+ * struct {
+ *   string      key;
+ *   array<byte> value;    (gconf_value_encode_binary(), empty if unset)
+ *
+ *   boolean schema_name_set;
+ *   string  schema_name;
+ *
+ *   boolean is_default;
+ *   boolean is_writable;
+ * };
+ *
+ */
+
 /* Pair:
  *
  * struct {
@@ -557,6 +572,56 @@ utils_append_entry_values_stringified (DBusMessageIter  *main_iter,
     g_error ("Out of memory");
 }
 
+/* Writes an entry with the value in the binary encoding, which
+ * unlike the text one needs no quoting or UTF-8 pass over the whole
+ * value.
+ */
+static void
+utils_append_entry_values_binary (DBusMessageIter  *main_iter,
+				  const gchar      *key,
+				  const GConfValue *value,
+				  gboolean          is_default,
+				  gboolean          is_writable,
+				  const gchar      *schema_name)
+{
+  DBusMessageIter  struct_iter;
+  DBusMessageIter  array_iter;
+  guchar          *encoded;
+  gsize            len;
+
+  d(g_print ("Appending entry %s\n", key));
+
+  dbus_message_iter_open_container (main_iter,
+				    DBUS_TYPE_STRUCT,
+				    NULL, /* for structs */
+				    &struct_iter);
+
+  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING, &key);
+
+  encoded = NULL;
+  len = 0;
+  if (value)
+    encoded = gconf_value_encode_binary (value, &len);
+
+  dbus_message_iter_open_container (&struct_iter,
+				    DBUS_TYPE_ARRAY,
+				    DBUS_TYPE_BYTE_AS_STRING,
+				    &array_iter);
+  dbus_message_iter_append_fixed_array (&array_iter, DBUS_TYPE_BYTE,
+					&encoded, len);
+  dbus_message_iter_close_container (&struct_iter, &array_iter);
+  g_free (encoded);
+
+  utils_append_optional_string (&struct_iter, schema_name);
+
+  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_BOOLEAN, &is_default);
+
+  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_BOOLEAN, &is_writable);
+
+  if (!dbus_message_iter_close_container (main_iter, &struct_iter))
+    g_error ("Out of memory");
+}
+
 gboolean
 gconf_dbus_utils_get_entry_values (DBusMessageIter  *main_iter,
 				   gchar           **key_p,
@@ -669,6 +734,75 @@ utils_get_entry_values_stringified (DBusMessageIter  *main_iter,
   return TRUE;
 }
 
+static gboolean
+utils_get_entry_values_binary (DBusMessageIter  *main_iter,
+			       gchar           **key_p,
+			       GConfValue      **value_p,
+			       gboolean         *is_default_p,
+			       gboolean         *is_writable_p,
+			       gchar           **schema_name_p)
+{
+  DBusMessageIter  struct_iter;
+  DBusMessageIter  array_iter;
+  gchar           *key;
+  const guchar    *encoded;
+  int              len;
+  GConfValue      *value;
+  gboolean         is_default;
+  gboolean         is_writable;
+  gchar           *schema_name;
+
+  dbus_message_iter_recurse (main_iter, &struct_iter);
+  dbus_message_iter_get_basic (&struct_iter, &key);
+
+  d(g_print ("Getting entry %s\n", key));
+
+  dbus_message_iter_next (&struct_iter);
+  dbus_message_iter_recurse (&struct_iter, &array_iter);
+  dbus_message_iter_get_fixed_array (&array_iter, &encoded, &len);
+  value = NULL;
+  if (len > 0)
+    {
+      GError *error = NULL;
+
+      value = gconf_value_decode_binary (encoded, len, &error);
+      if (error != NULL)
+	{
+	  gconf_log (GCL_ERR, _("Failed to decode the value of %s: %s"),
+		     key, error->message);
+	  g_error_free (error);
+	}
+    }
+
+  dbus_message_iter_next (&struct_iter);
+  schema_name = (gchar *) utils_get_optional_string (&struct_iter);
+
+  dbus_message_iter_next (&struct_iter);
+  dbus_message_iter_get_basic (&struct_iter, &is_default);
+
+  dbus_message_iter_next (&struct_iter);
+  dbus_message_iter_get_basic (&struct_iter, &is_writable);
+
+  if (key_p)
+    *key_p = key;
+
+  if (value_p)
+    *value_p = value;
+  else if (value)
+    gconf_value_free (value);
+
+  if (schema_name_p)
+    *schema_name_p = schema_name;
+
+  if (is_default_p)
+    *is_default_p = is_default;
+
+  if (is_writable_p)
+    *is_writable_p = is_writable;
+
+  return TRUE;
+}
+
 
 /*
  * Getters
@@ -1048,16 +1182,29 @@ gconf_dbus_utils_append_entry_values (DBusMessageIter  *iter,
 			     schema_name);
 }
 
-/* Append the list of entries as an array. */
+/* Append the list of entries as an array, with the values in the
+ * binary encoding if binary is TRUE and as text otherwise.
+ */
 void
 gconf_dbus_utils_append_entries (DBusMessageIter *iter,
-				 GSList          *entries)
+				 GSList          *entries,
+				 gboolean         binary)
 {
   DBusMessageIter array_iter;
   GSList *l;
 
   dbus_message_iter_open_container (iter,
 				    DBUS_TYPE_ARRAY,
+				    binary ?
+				    DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+				    DBUS_TYPE_STRING_AS_STRING
+				    DBUS_TYPE_ARRAY_AS_STRING
+				    DBUS_TYPE_BYTE_AS_STRING
+				    DBUS_TYPE_BOOLEAN_AS_STRING
+				    DBUS_TYPE_STRING_AS_STRING
+				    DBUS_TYPE_BOOLEAN_AS_STRING
+				    DBUS_TYPE_BOOLEAN_AS_STRING
+				    DBUS_STRUCT_END_CHAR_AS_STRING :
 				    DBUS_STRUCT_BEGIN_CHAR_AS_STRING
 				    DBUS_TYPE_STRING_AS_STRING
 				    DBUS_TYPE_STRING_AS_STRING
@@ -1072,20 +1219,32 @@ gconf_dbus_utils_append_entries (DBusMessageIter *iter,
     {
       GConfEntry *entry = l->data;
 
-      utils_append_entry_values_stringified (&array_iter,
-					     entry->key,
-					     gconf_entry_get_value (entry),
-					     gconf_entry_get_is_default (entry),
-					     gconf_entry_get_is_writable (entry),
-					     gconf_entry_get_schema_name (entry));
+      if (binary)
+	utils_append_entry_values_binary (&array_iter,
+					  entry->key,
+					  gconf_entry_get_value (entry),
+					  gconf_entry_get_is_default (entry),
+					  gconf_entry_get_is_writable (entry),
+					  gconf_entry_get_schema_name (entry));
+      else
+	utils_append_entry_values_stringified (&array_iter,
+					       entry->key,
+					       gconf_entry_get_value (entry),
+					       gconf_entry_get_is_default (entry),
+					       gconf_entry_get_is_writable (entry),
+					       gconf_entry_get_schema_name (entry));
     }
 
   dbus_message_iter_close_container (iter, &array_iter);
 }
 
-/* Get a list of entries from an array. */
+/* Get a list of entries from an array written by
+ * gconf_dbus_utils_append_entries() with the same binary flag.
+ */
 GSList *
-gconf_dbus_utils_get_entries (DBusMessageIter *iter, const gchar *dir)
+gconf_dbus_utils_get_entries (DBusMessageIter *iter,
+			      const gchar     *dir,
+			      gboolean         binary)
 {
   GSList *entries;
   DBusMessageIter array_iter;
@@ -1103,13 +1262,23 @@ gconf_dbus_utils_get_entries (DBusMessageIter *iter, const gchar *dir)
       gboolean    is_writable;
       gchar      *schema_name;
       GConfEntry *entry;
-
-      if (!utils_get_entry_values_stringified (&array_iter,
-					       &key,
-					       &value,
-					       &is_default,
-					       &is_writable,
-					       &schema_name))
+      gboolean    got_entry;
+
+      if (binary)
+	got_entry = utils_get_entry_values_binary (&array_iter,
+						   &key,
+						   &value,
+						   &is_default,
+						   &is_writable,
+						   &schema_name);
+      else
+	got_entry = utils_get_entry_values_stringified (&array_iter,
+							&key,
+							&value,
+							&is_default,
+							&is_writable,
+							&schema_name);
+      if (!got_entry)
 	break;
 
       entry = gconf_entry_new_nocopy (gconf_concat_dir_and_key (dir, key), value);
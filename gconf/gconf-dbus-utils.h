@@ -44,9 +44,21 @@
 #define GCONF_DBUS_DATABASE_RECURSIVE_UNSET "RecursiveUnset"
 #define GCONF_DBUS_DATABASE_DIR_EXISTS      "DirExists"
 #define GCONF_DBUS_DATABASE_GET_ALL_ENTRIES "AllEntries"
+/* Like AllEntries, but the values are sent in the binary encoding
+ * (see gconf_value_encode_binary()) instead of as text.  Clients
+ * fall back to AllEntries with daemons that don't know it.
+ */
+#define GCONF_DBUS_DATABASE_GET_ALL_ENTRIES_BINARY "AllEntriesBinary"
 #define GCONF_DBUS_DATABASE_GET_ALL_DIRS    "AllDirs"
 #define GCONF_DBUS_DATABASE_SET_SCHEMA      "SetSchema"
 #define GCONF_DBUS_DATABASE_SUGGEST_SYNC    "SuggestSync"
+/* Takes a locale string and returns a uint32 id for it, which Lookup,
+ * LookupExtended, LookupDefault and AllEntries accept in place of the
+ * locale string.  An id of 0 means the daemon gave none out.  Ids
+ * are only valid for the daemon instance that gave them out, others
+ * fail with GCONF_DBUS_ERROR_UNKNOWN_LOCALE_ID.
+ */
+#define GCONF_DBUS_DATABASE_SET_LOCALE      "SetLocale"
 
 #define GCONF_DBUS_DATABASE_ADD_NOTIFY      "AddNotify"
 #define GCONF_DBUS_DATABASE_REMOVE_NOTIFY   "RemoveNotify"
@@ -72,6 +84,8 @@
 #define GCONF_DBUS_ERROR_IN_SHUTDOWN          "org.gnome.GConf.Error.InShutdown"
 #define GCONF_DBUS_ERROR_OVERRIDDEN           "org.gnome.GConf.Error.Overriden"
 #define GCONF_DBUS_ERROR_LOCK_FAILED          "org.gnome.GConf.Error.LockFailed"
+/* A locale id from SetLocale that this daemon didn't give out */
+#define GCONF_DBUS_ERROR_UNKNOWN_LOCALE_ID    "org.gnome.GConf.Error.UnknownLocaleId"
 
 void        gconf_dbus_utils_append_value     (DBusMessageIter   *iter,
 					       const GConfValue  *value);
@@ -91,9 +105,12 @@ gboolean    gconf_dbus_utils_get_entry_values   (DBusMessageIter   *iter,
 						 gchar            **schema_name);
 
 void gconf_dbus_utils_append_entries (DBusMessageIter *iter,
-				      GSList          *entries);
+				      GSList          *entries,
+				      gboolean         binary);
 
-GSList *gconf_dbus_utils_get_entries (DBusMessageIter *iter, const gchar *dir);
+GSList *gconf_dbus_utils_get_entries (DBusMessageIter *iter,
+				      const gchar     *dir,
+				      gboolean         binary);
 
 
 #endif/* GCONF_DBUS_UTILS_H */
@@ -107,6 +107,19 @@ static GHashTable     *engines_by_db = NULL;
 static GHashTable     *engines_by_address = NULL;
 static gboolean        dbus_disconnected = FALSE;
 
+/* Fallback lists for local engines, by locale */
+static GConfLocaleCache *local_locale_cache = NULL;
+
+/* The id the daemon gave us for the current locale, see
+ * get_server_locale_id().
+ */
+static gchar          *server_locale = NULL;
+static dbus_uint32_t   server_locale_id = 0;
+static gboolean        server_locale_ids_unsupported = FALSE;
+
+/* Set once the daemon turned out not to know AllEntriesBinary */
+static gboolean        server_binary_entries_unsupported = FALSE;
+
 static gboolean     ensure_dbus_connection      (void);
 static gboolean     ensure_service              (gboolean          start_if_not_found,
 						 GError          **err);
@@ -190,6 +203,7 @@ dbus_error_name_to_gconf_errno (const char *name)
     { GCONF_DBUS_ERROR_LOCK_FAILED, GCONF_ERROR_LOCK_FAILED },
     { GCONF_DBUS_ERROR_NO_WRITABLE_DATABASE, GCONF_ERROR_NO_WRITABLE_DATABASE },
     { GCONF_DBUS_ERROR_IN_SHUTDOWN, GCONF_ERROR_IN_SHUTDOWN },
+    { GCONF_DBUS_ERROR_UNKNOWN_LOCALE_ID, GCONF_ERROR_FAILED },
   };
 
   for (i = 0; i < G_N_ELEMENTS (errors); i++)
@@ -240,7 +254,7 @@ gconf_handle_dbus_exception (DBusMessage *message, DBusError *derr, GError **ger
   if (derr)
     dbus_error_free (derr);
 
-  name = dbus_message_get_member (message);
+  name = dbus_message_get_error_name (message);
 
   dbus_message_get_args (message, NULL,
 			 DBUS_TYPE_STRING, &error_string,
@@ -1103,6 +1117,175 @@ gconf_engine_notify_remove (GConfEngine* conf,
   dbus_message_unref (reply);
 }
 
+static GConfLocaleList *
+get_local_locale_list (const gchar *locale)
+{
+  if (local_locale_cache == NULL)
+    local_locale_cache = gconf_locale_cache_new ();
+
+  return gconf_locale_cache_get_list (local_locale_cache, locale);
+}
+
+/* Asks the daemon for an id for locale the first time it is used, so
+ * that later requests don't make it parse the locale again.  Returns
+ * 0 if the daemon has no id to give.
+ */
+static dbus_uint32_t
+get_server_locale_id (const gchar *db,
+		      const gchar *locale)
+{
+  DBusMessage *message, *reply;
+  DBusError error;
+  dbus_uint32_t id;
+
+  if (server_locale_ids_unsupported)
+    return 0;
+
+  if (server_locale != NULL && strcmp (server_locale, locale) == 0)
+    return server_locale_id;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_SET_LOCALE);
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &locale,
+			    DBUS_TYPE_INVALID);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  dbus_message_unref (message);
+
+  if (reply == NULL)
+    {
+      /* Older daemons only take locale strings */
+      if (dbus_error_has_name (&error, DBUS_ERROR_UNKNOWN_METHOD))
+	server_locale_ids_unsupported = TRUE;
+
+      dbus_error_free (&error);
+
+      /* Remember the failure below like a 0 id, so that each request
+       * doesn't ask again until the daemon changes.
+       */
+      id = 0;
+    }
+  else
+    {
+      if (!dbus_message_get_args (reply, NULL,
+				  DBUS_TYPE_UINT32, &id,
+				  DBUS_TYPE_INVALID))
+	id = 0;
+
+      dbus_message_unref (reply);
+    }
+
+  g_free (server_locale);
+  server_locale = g_strdup (locale);
+  server_locale_id = id;
+
+  return id;
+}
+
+static void
+forget_server_locale_id (void)
+{
+  g_free (server_locale);
+  server_locale = NULL;
+  server_locale_id = 0;
+}
+
+/* Locale ids are only valid for the daemon instance that gave them
+ * out, and the next daemon may support more methods.
+ */
+static void
+forget_server_state (void)
+{
+  forget_server_locale_id ();
+  server_locale_ids_unsupported = FALSE;
+  server_binary_entries_unsupported = FALSE;
+}
+
+/* Appends the locale argument of the lookup methods, using the locale
+ * id when the locale is the current one and use_id is TRUE.  Returns
+ * whether it used the id.
+ */
+static gboolean
+append_locale_arg (DBusMessage *message,
+		   const gchar *db,
+		   const gchar *locale,
+		   gboolean     use_id)
+{
+  dbus_uint32_t id = 0;
+
+  if (locale == NULL)
+    locale = gconf_current_locale ();
+
+  if (use_id && strcmp (locale, gconf_current_locale ()) == 0)
+    id = get_server_locale_id (db, locale);
+
+  if (id != 0)
+    dbus_message_append_args (message,
+			      DBUS_TYPE_UINT32, &id,
+			      DBUS_TYPE_INVALID);
+  else
+    dbus_message_append_args (message,
+			      DBUS_TYPE_STRING, &locale,
+			      DBUS_TYPE_INVALID);
+
+  return id != 0;
+}
+
+/* Sends one of the lookup methods, which take a key (or dir), the
+ * locale and, if use_schema_default isn't NULL, that flag.  If the
+ * daemon doesn't know our locale id, which can happen when it was
+ * restarted before we noticed, the id is forgotten and the request
+ * is sent again with the locale string.
+ */
+static DBusMessage *
+send_locale_request (const gchar    *db,
+		     const gchar    *method,
+		     const gchar    *key,
+		     const gchar    *locale,
+		     const gboolean *use_schema_default,
+		     DBusError      *error)
+{
+  DBusMessage *message, *reply;
+  gboolean use_id = TRUE;
+
+  while (TRUE)
+    {
+      gboolean used_id;
+
+      message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					      db,
+					      GCONF_DBUS_DATABASE_INTERFACE,
+					      method);
+
+      dbus_message_append_args (message,
+				DBUS_TYPE_STRING, &key,
+				DBUS_TYPE_INVALID);
+      used_id = append_locale_arg (message, db, locale, use_id);
+      if (use_schema_default != NULL)
+	dbus_message_append_args (message,
+				  DBUS_TYPE_BOOLEAN, use_schema_default,
+				  DBUS_TYPE_INVALID);
+
+      reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, error);
+      dbus_message_unref (message);
+
+      if (reply == NULL && used_id &&
+	  dbus_error_has_name (error, GCONF_DBUS_ERROR_UNKNOWN_LOCALE_ID))
+	{
+	  forget_server_locale_id ();
+	  dbus_error_free (error);
+	  use_id = FALSE;
+	  continue;
+	}
+
+      return reply;
+    }
+}
+
 GConfValue *
 gconf_engine_get_fuller (GConfEngine *conf,
                          const gchar *key,
@@ -1118,7 +1301,7 @@ gconf_engine_get_fuller (GConfEngine *conf,
   gboolean is_default = FALSE;
   gboolean is_writable = TRUE;
   gchar *schema_name = NULL;
-  DBusMessage *message, *reply;
+  DBusMessage *reply;
   DBusError error;
   DBusMessageIter iter;
   gboolean success;
@@ -1134,21 +1317,20 @@ gconf_engine_get_fuller (GConfEngine *conf,
 
   if (gconf_engine_is_local (conf))
     {
-      gchar **locale_list;
+      GConfLocaleList *locale_list;
       
-      locale_list = gconf_split_locale (locale);
+      locale_list = get_local_locale_list (locale);
       
       val = gconf_sources_query_value (conf->local_sources,
 				       key,
-				       (const gchar**)locale_list,
+				       locale_list->list,
 				       use_schema_default,
 				       &is_default,
 				       &is_writable,
 				       schema_name_p ? &schema_name : NULL,
 				       err);
 
-      if (locale_list != NULL)
-        g_strfreev(locale_list);
+      gconf_locale_list_unref (locale_list);
       
       if (is_default_p)
         *is_default_p = is_default;
@@ -1161,7 +1343,8 @@ gconf_engine_get_fuller (GConfEngine *conf,
       else
         g_free (schema_name);
       
-      return val;
+      /* the value may be shared with the sources' cache */
+      return val ? gconf_value_make_writable (val) : NULL;
     }
 
   g_assert (!gconf_engine_is_local (conf));
@@ -1177,22 +1360,9 @@ gconf_engine_get_fuller (GConfEngine *conf,
   if (schema_name_p)
     *schema_name_p = NULL;
 
-  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
-					  db,
-					  GCONF_DBUS_DATABASE_INTERFACE,
-					  GCONF_DBUS_DATABASE_LOOKUP_EXTENDED);
-
-  locale = locale ? locale : gconf_current_locale();
-  
-  dbus_message_append_args (message,
-			    DBUS_TYPE_STRING, &key,
-			    DBUS_TYPE_STRING, &locale,
-			    DBUS_TYPE_BOOLEAN, &use_schema_default,
-			    DBUS_TYPE_INVALID);
-
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
-  dbus_message_unref (message);
+  reply = send_locale_request (db, GCONF_DBUS_DATABASE_LOOKUP_EXTENDED,
+			       key, locale, &use_schema_default, &error);
 
   if (gconf_handle_dbus_exception (reply, &error, err))
     return NULL;
@@ -1323,8 +1493,7 @@ gconf_engine_get_default_from_schema (GConfEngine* conf,
 {
   GConfValue* val;
   const gchar *db;
-  const gchar *locale;
-  DBusMessage *message, *reply;
+  DBusMessage *reply;
   DBusError error;
   DBusMessageIter iter;
   
@@ -1339,20 +1508,19 @@ gconf_engine_get_default_from_schema (GConfEngine* conf,
 
   if (gconf_engine_is_local(conf))
     {
-      gchar** locale_list;
+      GConfLocaleList* locale_list;
 
-      locale_list = gconf_split_locale(gconf_current_locale());
+      locale_list = get_local_locale_list (gconf_current_locale ());
       
       val = gconf_sources_query_default_value(conf->local_sources,
                                               key,
-                                              (const gchar**)locale_list,
+                                              locale_list->list,
                                               NULL,
                                               err);
 
-      if (locale_list != NULL)
-        g_strfreev(locale_list);
+      gconf_locale_list_unref (locale_list);
       
-      return val;
+      return val ? gconf_value_make_writable (val) : NULL;
     }
 
   g_assert (!gconf_engine_is_local (conf));
@@ -1365,21 +1533,9 @@ gconf_engine_get_default_from_schema (GConfEngine* conf,
       return NULL;
     }
 
-  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
-					  db,
-					  GCONF_DBUS_DATABASE_INTERFACE,
-					  GCONF_DBUS_DATABASE_LOOKUP_DEFAULT);
-
-  locale = gconf_current_locale();
-  
-  dbus_message_append_args (message,
-			    DBUS_TYPE_STRING, &key,
-			    DBUS_TYPE_STRING, &locale,
-			    DBUS_TYPE_INVALID);
-
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
-  dbus_message_unref (message);
+  reply = send_locale_request (db, GCONF_DBUS_DATABASE_LOOKUP_DEFAULT,
+			       key, NULL, NULL, &error);
 
   if (gconf_handle_dbus_exception (reply, &error, err))
     return NULL;
@@ -1494,6 +1650,167 @@ gconf_engine_set (GConfEngine* conf, const gchar* key,
   return TRUE;
 }
 
+/* Reports error as the error of key i */
+static void
+set_values_error (GError **errors,
+		  guint    i,
+		  GError  *error)
+{
+  if (errors != NULL)
+    errors[i] = error;
+  else
+    g_error_free (error);
+}
+
+gboolean
+gconf_engine_set_values (GConfEngine* conf, const gchar** keys,
+                         GConfValue* const* values, guint n_keys,
+                         GError** errors)
+{
+  const gchar *db;
+  DBusPendingCall **pending;
+  gboolean *valid;
+  GError *error;
+  gboolean retval;
+  guint i;
+
+  g_return_val_if_fail(conf != NULL, FALSE);
+  g_return_val_if_fail(keys != NULL || n_keys == 0, FALSE);
+  g_return_val_if_fail(values != NULL || n_keys == 0, FALSE);
+
+  CHECK_OWNER_USE (conf);
+
+  if (gconf_engine_is_local (conf))
+    {
+      GError **local_errors;
+
+      /* The backends resolve each directory once for a run of keys
+       * in it; invalid keys and values are reported there too.
+       */
+      local_errors = errors != NULL ? errors : g_new0 (GError*, n_keys);
+
+      gconf_sources_set_values (conf->local_sources, keys, values, n_keys,
+                                NULL, local_errors);
+
+      retval = TRUE;
+      for (i = 0; i < n_keys; ++i)
+        {
+          if (local_errors[i] != NULL)
+            {
+              retval = FALSE;
+              if (errors == NULL)
+                g_error_free (local_errors[i]);
+            }
+        }
+
+      if (errors == NULL)
+        g_free (local_errors);
+
+      return retval;
+    }
+
+  g_assert (!gconf_engine_is_local (conf));
+
+  /* Invalid keys and values are reported and left out; they don't
+   * keep the rest of the batch from being set.
+   */
+  retval = TRUE;
+  valid = g_new (gboolean, n_keys);
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      error = NULL;
+      valid[i] = (gconf_key_check (keys[i], &error) &&
+		  gconf_value_validate (values[i], &error));
+      if (!valid[i])
+	{
+	  retval = FALSE;
+	  set_values_error (errors, i, error);
+	}
+    }
+
+  error = NULL;
+  db = gconf_engine_get_database (conf, TRUE, &error);
+
+  if (db == NULL)
+    {
+      g_return_val_if_fail(error != NULL, FALSE);
+
+      for (i = 0; i < n_keys; ++i)
+	{
+	  if (valid[i])
+	    set_values_error (errors, i, g_error_copy (error));
+	}
+
+      g_error_free (error);
+      g_free (valid);
+
+      return FALSE;
+    }
+
+  /* Send every request before waiting for the first reply, so the
+   * batch costs one round trip rather than one per key.
+   */
+  pending = g_new0 (DBusPendingCall*, n_keys);
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      DBusMessage *message;
+      DBusMessageIter iter;
+
+      if (!valid[i])
+	continue;
+
+      message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					      db,
+					      GCONF_DBUS_DATABASE_INTERFACE,
+					      GCONF_DBUS_DATABASE_SET);
+
+      dbus_message_append_args (message,
+				DBUS_TYPE_STRING, &keys[i],
+				DBUS_TYPE_INVALID);
+
+      dbus_message_iter_init_append (message, &iter);
+      gconf_dbus_utils_append_value (&iter, values[i]);
+
+      if (!dbus_connection_send_with_reply (global_conn, message,
+					    &pending[i], -1))
+	pending[i] = NULL;
+
+      dbus_message_unref (message);
+    }
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      DBusMessage *reply = NULL;
+
+      if (!valid[i])
+	continue;
+
+      if (pending[i] != NULL)
+	{
+	  dbus_pending_call_block (pending[i]);
+	  reply = dbus_pending_call_steal_reply (pending[i]);
+	  dbus_pending_call_unref (pending[i]);
+	}
+
+      /* A NULL reply is reported as an unknown error */
+      error = NULL;
+      if (gconf_handle_dbus_exception (reply, NULL, &error))
+	{
+	  retval = FALSE;
+	  set_values_error (errors, i, error);
+	}
+      else
+	dbus_message_unref (reply);
+    }
+
+  g_free (pending);
+  g_free (valid);
+
+  return retval;
+}
+
 gboolean
 gconf_engine_unset (GConfEngine* conf, const gchar* key, GError** err)
 {
@@ -1758,15 +2075,33 @@ qualify_entries (GSList *entries, const char *dir)
     }
 }
 
+/* Values from the local sources may be shared with their cache */
+static void
+unshare_entry_values (GSList *entries)
+{
+  GSList *tmp = entries;
+  
+  while (tmp != NULL)
+    {
+      GConfEntry *entry = tmp->data;
+
+      if (gconf_entry_get_value (entry) != NULL)
+        gconf_entry_set_value_nocopy (entry,
+                                      gconf_value_make_writable (gconf_entry_steal_value (entry)));
+
+      tmp = g_slist_next (tmp);
+    }
+}
+
 GSList*      
 gconf_engine_all_entries (GConfEngine* conf, const gchar* dir, GError** err)
 {
   GSList* entries = NULL;
   const gchar *db;
-  DBusMessage *message, *reply;
+  DBusMessage *reply;
   DBusError error;
   DBusMessageIter iter;
-  const gchar *locale;
+  gboolean binary;
 
   g_return_val_if_fail(conf != NULL, NULL);
   g_return_val_if_fail(dir != NULL, NULL);
@@ -1780,18 +2115,17 @@ gconf_engine_all_entries (GConfEngine* conf, const gchar* dir, GError** err)
   if (gconf_engine_is_local(conf))
     {
       GError* error = NULL;
-      gchar** locale_list;
+      GConfLocaleList* locale_list;
       GSList* retval;
       
-      locale_list = gconf_split_locale(gconf_current_locale());
+      locale_list = get_local_locale_list (gconf_current_locale ());
       
       retval = gconf_sources_all_entries(conf->local_sources,
                                          dir,
-                                         (const gchar**)locale_list,
+                                         locale_list->list,
                                          &error);
 
-      if (locale_list)
-        g_strfreev(locale_list);
+      gconf_locale_list_unref (locale_list);
       
       if (error != NULL)
         {
@@ -1808,6 +2142,7 @@ gconf_engine_all_entries (GConfEngine* conf, const gchar* dir, GError** err)
         }
 
       qualify_entries (retval, dir);
+      unshare_entry_values (retval);
       
       return retval;
     }
@@ -1823,20 +2158,30 @@ gconf_engine_all_entries (GConfEngine* conf, const gchar* dir, GError** err)
       return NULL;
     }
 
-  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
-					  db,
-					  GCONF_DBUS_DATABASE_INTERFACE,
-					  GCONF_DBUS_DATABASE_GET_ALL_ENTRIES);
+  /* Ask for binary values, unless the daemon is known to predate
+   * AllEntriesBinary; then stick to AllEntries and text values.
+   */
+  while (TRUE)
+    {
+      binary = !server_binary_entries_unsupported;
 
-  locale = gconf_current_locale ();
-  dbus_message_append_args (message,
-			    DBUS_TYPE_STRING, &dir,
-			    DBUS_TYPE_STRING, &locale,
-			    DBUS_TYPE_INVALID);
-  
-  dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
-  dbus_message_unref (message);
+      dbus_error_init (&error);
+      reply = send_locale_request (db,
+				   binary ?
+				   GCONF_DBUS_DATABASE_GET_ALL_ENTRIES_BINARY :
+				   GCONF_DBUS_DATABASE_GET_ALL_ENTRIES,
+				   dir, NULL, NULL, &error);
+
+      if (reply == NULL && binary &&
+	  dbus_error_has_name (&error, DBUS_ERROR_UNKNOWN_METHOD))
+	{
+	  server_binary_entries_unsupported = TRUE;
+	  dbus_error_free (&error);
+	  continue;
+	}
+
+      break;
+    }
   
   if (gconf_handle_dbus_exception (reply, &error, err))
     return NULL;
@@ -1845,7 +2190,7 @@ gconf_engine_all_entries (GConfEngine* conf, const gchar* dir, GError** err)
 
   dbus_message_iter_init (reply, &iter);
   
-  entries = gconf_dbus_utils_get_entries (&iter, dir);
+  entries = gconf_dbus_utils_get_entries (&iter, dir, binary);
   
   dbus_message_unref (reply);
 
@@ -2257,6 +2602,7 @@ gconf_dbus_message_filter (DBusConnection    *dbus_conn,
       global_conn = NULL;
       service_running = FALSE;
       dbus_disconnected = TRUE;
+      forget_server_state ();
 
       g_warning ("Got Disconnected from DBus.\n");
 
@@ -2301,6 +2647,7 @@ gconf_dbus_message_filter (DBusConnection    *dbus_conn,
 	  /* GConfd is gone, set the state so we can detect that we're down. */
 	  service_running = FALSE;
 	  needs_reconnect = TRUE;
+	  forget_server_state ();
   
 	  d(g_print ("*** GConf Service deleted\n"));
 	}
@@ -2397,7 +2744,8 @@ handle_notify (DBusConnection *connection,
 	{
 	  d(g_print ("yes: %s\n", key));
 	  
-	  entry = gconf_entry_new (key, value);
+	  entry = gconf_entry_new_nocopy (g_strdup (key),
+					  value ? gconf_value_ref (value) : NULL);
 	  gconf_cnxn_notify (cnxn, entry);
 	  gconf_entry_free (entry);
 	  
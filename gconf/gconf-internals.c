@@ -123,6 +123,114 @@ gconf_key_key        (const gchar* key)
   return end;
 }
 
+/*
+ *  Key atoms
+ */
+
+static GHashTable* key_atoms = NULL;
+
+const GConfKeyAtom*
+gconf_key_atom_lookup (const gchar* key)
+{
+  g_return_val_if_fail (key != NULL, NULL);
+
+  if (key_atoms == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (key_atoms, key);
+}
+
+const GConfKeyAtom*
+gconf_key_atom_intern (const gchar* key)
+{
+  GConfKeyAtom* atom;
+  const gchar* end;
+  gchar* full_name;
+  gsize len;
+
+  g_return_val_if_fail (key != NULL, NULL);
+
+  if (key_atoms == NULL)
+    key_atoms = g_hash_table_new (g_str_hash, g_str_equal);
+  else
+    {
+      atom = g_hash_table_lookup (key_atoms, key);
+      if (atom != NULL)
+        {
+          atom->refcount += 1;
+          return atom;
+        }
+    }
+
+  /* The atom and its name share a single block, so they are
+   * freed together.
+   */
+  len = strlen (key);
+  atom = g_malloc (sizeof (GConfKeyAtom) + len + 1);
+  full_name = (gchar*) (atom + 1);
+  memcpy (full_name, key, len + 1);
+
+  atom->full_name = full_name;
+  atom->parent = NULL;
+  atom->refcount = 1;
+
+  end = strrchr (full_name, '/');
+  if (end == NULL)
+    atom->name = full_name;
+  else
+    {
+      atom->name = end + 1;
+
+      if (end == full_name)
+        {
+          if (len > 1)
+            atom->parent = gconf_key_atom_intern ("/");
+          else
+            atom->name = full_name; /* the root itself */
+        }
+      else
+        {
+          gchar* dir;
+
+          dir = g_strndup (full_name, end - full_name);
+          atom->parent = gconf_key_atom_intern (dir);
+          g_free (dir);
+        }
+    }
+
+  g_hash_table_insert (key_atoms, full_name, atom);
+
+  return atom;
+}
+
+void
+gconf_key_atom_unref (const GConfKeyAtom* const_atom)
+{
+  GConfKeyAtom* atom = (GConfKeyAtom*) const_atom;
+
+  g_return_if_fail (atom != NULL);
+  g_return_if_fail (atom->refcount > 0);
+
+  /* Dropping the last reference to a key releases its reference
+   * on the parent directory, and so on up the tree.
+   */
+  while (atom != NULL)
+    {
+      GConfKeyAtom* parent;
+
+      atom->refcount -= 1;
+      if (atom->refcount > 0)
+        break;
+
+      parent = (GConfKeyAtom*) atom->parent;
+
+      g_hash_table_remove (key_atoms, atom->full_name);
+      g_free (atom);
+
+      atom = parent;
+    }
+}
+
 /*
  *  Random stuff 
  */
@@ -2222,6 +2330,547 @@ gconf_value_encode (GConfValue* val)
   return retval;
 }
 
+/*
+ * Binary value codec.
+ *
+ * The encoding starts with a version byte, GCONF_VALUE_BINARY_VERSION,
+ * followed by the value.  A value is its type byte (as for the text
+ * format above) and a payload:
+
+     int     4 bytes, little endian
+     bool    1 byte, 0 or 1
+     float   8 bytes, IEEE 754 double, little endian
+     string  length-prefixed string
+     schema  type, list type, car type and cdr type bytes; locale,
+             short desc, long desc and owner as length-prefixed
+             strings; default value, or a lone 'v' byte if none
+     list    list type byte, 4 byte little endian element count,
+             then each element as a value
+     pair    car value, then cdr value
+
+ * A length-prefixed string is a 4 byte little endian length followed
+ * by that many bytes of UTF-8 without a trailing nul.  In schemas,
+ * a length of 0xffffffff means the string is NULL.
+ *
+ * Unlike the text format nothing is quoted, so decoding is a single
+ * bounds-checked pass over the input that only allocates the value
+ * being built.
+ */
+
+#define BINARY_NULL_STRING 0xffffffffU
+/* Schemas nest a default value, which can hold schemas again */
+#define BINARY_MAX_DEPTH 8
+
+static gsize
+binary_string_size (const gchar* str)
+{
+  return 4 + (str ? strlen (str) : 0);
+}
+
+static gsize
+binary_value_size (const GConfValue* val)
+{
+  gsize size = 1;
+
+  switch (val->type)
+    {
+    case GCONF_VALUE_INT:
+      size += 4;
+      break;
+
+    case GCONF_VALUE_BOOL:
+      size += 1;
+      break;
+
+    case GCONF_VALUE_FLOAT:
+      size += 8;
+      break;
+
+    case GCONF_VALUE_STRING:
+      size += binary_string_size (gconf_value_get_string (val));
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema* sc = gconf_value_get_schema (val);
+        GConfValue* default_value = gconf_schema_get_default_value (sc);
+
+        size += 4;
+        size += binary_string_size (gconf_schema_get_locale (sc));
+        size += binary_string_size (gconf_schema_get_short_desc (sc));
+        size += binary_string_size (gconf_schema_get_long_desc (sc));
+        size += binary_string_size (gconf_schema_get_owner (sc));
+        size += default_value ? binary_value_size (default_value) : 1;
+      }
+      break;
+
+    case GCONF_VALUE_LIST:
+      {
+        GSList* tmp;
+
+        size += 1 + 4;
+        for (tmp = gconf_value_get_list (val); tmp != NULL; tmp = tmp->next)
+          size += binary_value_size (tmp->data);
+      }
+      break;
+
+    case GCONF_VALUE_PAIR:
+      size += binary_value_size (gconf_value_get_car (val));
+      size += binary_value_size (gconf_value_get_cdr (val));
+      break;
+
+    default:
+      g_assert_not_reached ();
+      break;
+    }
+
+  return size;
+}
+
+static guchar*
+binary_put_uint32 (guchar* p, guint32 n)
+{
+  p[0] = n & 0xff;
+  p[1] = (n >> 8) & 0xff;
+  p[2] = (n >> 16) & 0xff;
+  p[3] = (n >> 24) & 0xff;
+
+  return p + 4;
+}
+
+static guchar*
+binary_put_string (guchar* p, const gchar* str, gboolean nullable)
+{
+  gsize len;
+
+  if (str == NULL)
+    return binary_put_uint32 (p, nullable ? BINARY_NULL_STRING : 0);
+
+  len = strlen (str);
+  p = binary_put_uint32 (p, len);
+  memcpy (p, str, len);
+
+  return p + len;
+}
+
+static guchar*
+binary_put_value (guchar* p, const GConfValue* val)
+{
+  *p++ = type_byte (val->type);
+
+  switch (val->type)
+    {
+    case GCONF_VALUE_INT:
+      p = binary_put_uint32 (p, (guint32) gconf_value_get_int (val));
+      break;
+
+    case GCONF_VALUE_BOOL:
+      *p++ = gconf_value_get_bool (val) ? 1 : 0;
+      break;
+
+    case GCONF_VALUE_FLOAT:
+      {
+        union { gdouble d; guint64 n; } u;
+
+        u.d = gconf_value_get_float (val);
+        p = binary_put_uint32 (p, (guint32) (u.n & 0xffffffff));
+        p = binary_put_uint32 (p, (guint32) (u.n >> 32));
+      }
+      break;
+
+    case GCONF_VALUE_STRING:
+      p = binary_put_string (p, gconf_value_get_string (val), FALSE);
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema* sc = gconf_value_get_schema (val);
+        GConfValue* default_value = gconf_schema_get_default_value (sc);
+
+        *p++ = type_byte (gconf_schema_get_type (sc));
+        *p++ = type_byte (gconf_schema_get_list_type (sc));
+        *p++ = type_byte (gconf_schema_get_car_type (sc));
+        *p++ = type_byte (gconf_schema_get_cdr_type (sc));
+        p = binary_put_string (p, gconf_schema_get_locale (sc), TRUE);
+        p = binary_put_string (p, gconf_schema_get_short_desc (sc), TRUE);
+        p = binary_put_string (p, gconf_schema_get_long_desc (sc), TRUE);
+        p = binary_put_string (p, gconf_schema_get_owner (sc), TRUE);
+
+        if (default_value)
+          p = binary_put_value (p, default_value);
+        else
+          *p++ = type_byte (GCONF_VALUE_INVALID);
+      }
+      break;
+
+    case GCONF_VALUE_LIST:
+      {
+        GSList* list = gconf_value_get_list (val);
+        GSList* tmp;
+
+        *p++ = type_byte (gconf_value_get_list_type (val));
+        p = binary_put_uint32 (p, g_slist_length (list));
+        for (tmp = list; tmp != NULL; tmp = tmp->next)
+          p = binary_put_value (p, tmp->data);
+      }
+      break;
+
+    case GCONF_VALUE_PAIR:
+      p = binary_put_value (p, gconf_value_get_car (val));
+      p = binary_put_value (p, gconf_value_get_cdr (val));
+      break;
+
+    default:
+      g_assert_not_reached ();
+      break;
+    }
+
+  return p;
+}
+
+/**
+ * gconf_value_encode_binary:
+ * @val: the value to encode
+ * @len: return location for the length of the encoding
+ *
+ * Encodes @val in the binary format, which
+ * gconf_value_decode_binary() reads back.  The result is not
+ * nul-terminated.
+ *
+ * Returns: newly allocated encoding, to be freed with g_free()
+ */
+guchar*
+gconf_value_encode_binary (const GConfValue* val,
+                           gsize*            len)
+{
+  guchar* retval;
+  guchar* end;
+  gsize size;
+
+  g_return_val_if_fail (val != NULL, NULL);
+  g_return_val_if_fail (len != NULL, NULL);
+
+  size = 1 + binary_value_size (val);
+  retval = g_malloc (size);
+
+  retval[0] = GCONF_VALUE_BINARY_VERSION;
+  end = binary_put_value (retval + 1, val);
+
+  g_assert (end == retval + size);
+
+  *len = size;
+
+  return retval;
+}
+
+typedef struct {
+  const guchar* p;
+  const guchar* end;
+} BinaryReader;
+
+static gboolean
+binary_get_byte (BinaryReader* r, guchar* byte)
+{
+  if (r->p == r->end)
+    return FALSE;
+
+  *byte = *r->p++;
+
+  return TRUE;
+}
+
+static gboolean
+binary_get_uint32 (BinaryReader* r, guint32* n)
+{
+  if (r->end - r->p < 4)
+    return FALSE;
+
+  *n = ((guint32) r->p[0] |
+        ((guint32) r->p[1] << 8) |
+        ((guint32) r->p[2] << 16) |
+        ((guint32) r->p[3] << 24));
+  r->p += 4;
+
+  return TRUE;
+}
+
+static gboolean
+binary_get_type (BinaryReader* r, GConfValueType* type)
+{
+  guchar byte;
+
+  if (!binary_get_byte (r, &byte))
+    return FALSE;
+
+  *type = byte_type (byte);
+
+  /* byte_type() maps unknown bytes to invalid too */
+  return *type != GCONF_VALUE_INVALID || byte == 'v';
+}
+
+static gboolean
+binary_get_string (BinaryReader* r, gchar** str, gboolean nullable)
+{
+  guint32 len;
+
+  if (!binary_get_uint32 (r, &len))
+    return FALSE;
+
+  if (nullable && len == BINARY_NULL_STRING)
+    {
+      *str = NULL;
+      return TRUE;
+    }
+
+  /* g_utf8_validate() with an explicit length also rejects embedded nuls */
+  if ((guint32) (r->end - r->p) < len ||
+      !g_utf8_validate ((const gchar*) r->p, len, NULL))
+    return FALSE;
+
+  *str = g_strndup ((const gchar*) r->p, len);
+  r->p += len;
+
+  return TRUE;
+}
+
+static gboolean
+type_is_primitive (GConfValueType type)
+{
+  return type == GCONF_VALUE_INT ||
+    type == GCONF_VALUE_BOOL ||
+    type == GCONF_VALUE_FLOAT ||
+    type == GCONF_VALUE_STRING ||
+    type == GCONF_VALUE_SCHEMA;
+}
+
+static GConfValue*
+binary_get_value (BinaryReader* r, int depth)
+{
+  GConfValueType type;
+  GConfValue* val;
+
+  if (depth > BINARY_MAX_DEPTH ||
+      !binary_get_type (r, &type) ||
+      type == GCONF_VALUE_INVALID)
+    return NULL;
+
+  val = gconf_value_new (type);
+
+  switch (type)
+    {
+    case GCONF_VALUE_INT:
+      {
+        guint32 n;
+
+        if (!binary_get_uint32 (r, &n))
+          goto failed;
+
+        gconf_value_set_int (val, (gint32) n);
+      }
+      break;
+
+    case GCONF_VALUE_BOOL:
+      {
+        guchar byte;
+
+        if (!binary_get_byte (r, &byte) || byte > 1)
+          goto failed;
+
+        gconf_value_set_bool (val, byte);
+      }
+      break;
+
+    case GCONF_VALUE_FLOAT:
+      {
+        union { gdouble d; guint64 n; } u;
+        guint32 lo, hi;
+
+        if (!binary_get_uint32 (r, &lo) || !binary_get_uint32 (r, &hi))
+          goto failed;
+
+        u.n = ((guint64) hi << 32) | lo;
+        gconf_value_set_float (val, u.d);
+      }
+      break;
+
+    case GCONF_VALUE_STRING:
+      {
+        gchar* str;
+
+        if (!binary_get_string (r, &str, FALSE))
+          goto failed;
+
+        gconf_value_set_string_nocopy (val, str);
+      }
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema* sc;
+        GConfValueType types[4];
+        gchar* strings[4] = { NULL, NULL, NULL, NULL };
+        GConfValue* default_value = NULL;
+        int i;
+
+        sc = gconf_schema_new ();
+        gconf_value_set_schema_nocopy (val, sc);
+
+        for (i = 0; i < 4; i++)
+          if (!binary_get_type (r, &types[i]))
+            goto failed;
+
+        for (i = 0; i < 4; i++)
+          if (!binary_get_string (r, &strings[i], TRUE))
+            {
+              while (i-- > 0)
+                g_free (strings[i]);
+              goto failed;
+            }
+
+        gconf_schema_set_type (sc, types[0]);
+        gconf_schema_set_list_type (sc, types[1]);
+        gconf_schema_set_car_type (sc, types[2]);
+        gconf_schema_set_cdr_type (sc, types[3]);
+        gconf_schema_set_locale (sc, strings[0]);
+        gconf_schema_set_short_desc (sc, strings[1]);
+        gconf_schema_set_long_desc (sc, strings[2]);
+        gconf_schema_set_owner (sc, strings[3]);
+
+        for (i = 0; i < 4; i++)
+          g_free (strings[i]);
+
+        if (r->p < r->end && *r->p == 'v')
+          r->p++;
+        else if ((default_value = binary_get_value (r, depth + 1)) != NULL)
+          gconf_schema_set_default_value_nocopy (sc, default_value);
+        else
+          goto failed;
+      }
+      break;
+
+    case GCONF_VALUE_LIST:
+      {
+        GConfValueType list_type;
+        GSList* list = NULL;
+        guint32 n_elems;
+
+        if (!binary_get_type (r, &list_type) ||
+            !type_is_primitive (list_type) ||
+            !binary_get_uint32 (r, &n_elems))
+          goto failed;
+
+        /* Every element takes at least one byte */
+        if ((guint32) (r->end - r->p) < n_elems)
+          goto failed;
+
+        gconf_value_set_list_type (val, list_type);
+
+        while (n_elems-- > 0)
+          {
+            GConfValue* elem;
+
+            elem = binary_get_value (r, depth + 1);
+            if (elem == NULL || elem->type != list_type)
+              {
+                if (elem)
+                  gconf_value_free (elem);
+                g_slist_foreach (list, (GFunc) gconf_value_free, NULL);
+                g_slist_free (list);
+                goto failed;
+              }
+
+            list = g_slist_prepend (list, elem);
+          }
+
+        gconf_value_set_list_nocopy (val, g_slist_reverse (list));
+      }
+      break;
+
+    case GCONF_VALUE_PAIR:
+      {
+        GConfValue* car;
+        GConfValue* cdr;
+
+        car = binary_get_value (r, depth + 1);
+        if (car == NULL)
+          goto failed;
+
+        cdr = binary_get_value (r, depth + 1);
+        if (cdr == NULL ||
+            !type_is_primitive (car->type) ||
+            !type_is_primitive (cdr->type))
+          {
+            gconf_value_free (car);
+            if (cdr)
+              gconf_value_free (cdr);
+            goto failed;
+          }
+
+        gconf_value_set_car_nocopy (val, car);
+        gconf_value_set_cdr_nocopy (val, cdr);
+      }
+      break;
+
+    default:
+      g_assert_not_reached ();
+      break;
+    }
+
+  return val;
+
+ failed:
+  gconf_value_free (val);
+  return NULL;
+}
+
+/**
+ * gconf_value_decode_binary:
+ * @data: the output of gconf_value_encode_binary()
+ * @len: length of @data
+ * @err: return location for a #GError
+ *
+ * Decodes a value encoded with gconf_value_encode_binary().  The
+ * input is fully validated, so arbitrary data can be passed in.
+ *
+ * Returns: the decoded value, or %NULL if @data is not a valid
+ * encoding
+ */
+GConfValue*
+gconf_value_decode_binary (const guchar* data,
+                           gsize         len,
+                           GError**      err)
+{
+  BinaryReader r;
+  GConfValue* val;
+
+  g_return_val_if_fail (data != NULL || len == 0, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  if (len == 0 || data[0] != GCONF_VALUE_BINARY_VERSION)
+    {
+      gconf_set_error (err, GCONF_ERROR_PARSE_ERROR,
+                       _("Encoded value has an unknown format version"));
+      return NULL;
+    }
+
+  r.p = data + 1;
+  r.end = data + len;
+
+  val = binary_get_value (&r, 0);
+
+  if (val != NULL && r.p != r.end)
+    {
+      gconf_value_free (val);
+      val = NULL;
+    }
+
+  if (val == NULL)
+    gconf_set_error (err, GCONF_ERROR_PARSE_ERROR,
+                     _("Encoded value is truncated or corrupt"));
+
+  return val;
+}
+
 #ifdef HAVE_CORBA
 
 /*
@@ -90,6 +90,29 @@ const char *_gconf_win32_get_home_dir (void);
 gchar*       gconf_key_directory  (const gchar* key);
 const gchar* gconf_key_key        (const gchar* key);
 
+/* Interned keys.  An atom exists once per distinct key while it is
+ * referenced, so atoms can be compared and hashed as pointers.  Every
+ * ancestor directory of an atom is itself interned, held by a
+ * reference from its child and reachable through the parent pointer;
+ * the root "/" has no parent.
+ *
+ * gconf_key_atom_intern() returns a new reference that must be
+ * dropped with gconf_key_atom_unref(); gconf_key_atom_lookup() only
+ * finds an atom someone else holds and doesn't add a reference.
+ */
+typedef struct _GConfKeyAtom GConfKeyAtom;
+
+struct _GConfKeyAtom {
+  const GConfKeyAtom *parent;
+  const gchar        *name;       /* last component, points into full_name */
+  const gchar        *full_name;
+  guint               refcount;
+};
+
+const GConfKeyAtom* gconf_key_atom_intern (const gchar* key);
+const GConfKeyAtom* gconf_key_atom_lookup (const gchar* key);
+void                gconf_key_atom_unref  (const GConfKeyAtom* atom);
+
 /* These file tests are in libgnome, I cut-and-pasted them */
 enum {
   GCONF_FILE_EXISTS=(1<<0)|(1<<1)|(1<<2), /*any type of file*/
@@ -197,6 +220,17 @@ void   gconf_unquote_string_inplace (gchar        *str,
 GConfValue* gconf_value_decode (const gchar *encoded);
 gchar*      gconf_value_encode (GConfValue  *val);
 
+/* Versioned binary encoding, with length-prefixed strings and raw
+ * numbers.  The text encoding above is kept for compatibility.
+ */
+#define GCONF_VALUE_BINARY_VERSION 1
+
+guchar*     gconf_value_encode_binary (const GConfValue *val,
+                                       gsize            *len);
+GConfValue* gconf_value_decode_binary (const guchar     *data,
+                                       gsize             len,
+                                       GError          **err);
+
 /*
  * List/pair conversion stuff
  */
@@ -287,6 +321,17 @@ gboolean gconf_engine_recursive_unset (GConfEngine      *engine,
                                        GConfUnsetFlags   flags,
                                        GError          **err);
 
+/* Sets n_keys keys at once.  An invalid key or value, or a key that
+ * can't be set, doesn't keep the others from being set.  errors, if
+ * not NULL, is an array of n_keys NULL errors; errors[i] is set if
+ * keys[i] wasn't set.  Returns TRUE if every key was set.
+ */
+gboolean gconf_engine_set_values      (GConfEngine       *engine,
+                                       const gchar      **keys,
+                                       GConfValue * const *values,
+                                       guint              n_keys,
+                                       GError           **errors);
+
 #ifdef HAVE_CORBA
 gboolean gconf_CORBA_Object_equal (gconstpointer a,
                                    gconstpointer b);
@@ -298,6 +343,9 @@ GConfValue* gconf_schema_steal_default_value (GConfSchema *schema);
 void gconf_value_set_string_nocopy (GConfValue *value,
                                     char       *str);
 
+/* Like gconf_entry_copy(), but the copy shares src's value */
+GConfEntry* gconf_entry_copy_shared (const GConfEntry *src);
+
 void _gconf_init_i18n (void);
 
 gboolean gconf_use_local_locks (void);
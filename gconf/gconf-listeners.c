@@ -68,6 +68,14 @@ struct _LTable {
   
   /* Connection array indexes to be recycled */
   GSList* removed_indices;
+
+  /* Reused by ltable_notify so it doesn't allocate: a copy of the
+   * key split in place, and the listeners to call
+   */
+  gchar* key_scratch;
+  gsize key_scratch_size;
+  GPtrArray* notify_scratch;
+  guint notify_scratch_busy : 1;
 };
 
 typedef struct _LTableEntry LTableEntry;
@@ -78,6 +86,7 @@ struct _LTableEntry {
                         want to notify all listeners *below* this node as well. 
                      */
   gchar *full_name; /* fully-qualified name */
+  GHashTable *children; /* name -> child GNode, NULL until there are any */
 };
 
 static LTable* ltable_new(void);
@@ -278,6 +287,8 @@ ltable_new(void)
   lt->removed_indices = NULL;
 
   lt->next_cnxn = 1; /* 0 is invalid */
+
+  lt->notify_scratch = g_ptr_array_new();
   
   return lt;
 }
@@ -360,8 +371,19 @@ ltable_insert(LTable* lt, const gchar* where, Listener* l)
       /* Find this dirname on this level, or add it. */
       g_assert (cur != NULL);        
 
+      lte = cur->data;
       found = NULL;
 
+      if (lte->children != NULL)
+        found = g_hash_table_lookup(lte->children, dirnames[i]);
+
+      if (found != NULL)
+        {
+          cur = found;
+          ++i;
+          continue;
+        }
+
       across = cur->children;
 
       while (across != NULL)
@@ -396,6 +418,11 @@ ltable_insert(LTable* lt, const gchar* where, Listener* l)
             found = g_node_insert_data_before(cur, across, ne);
           else                /* Never went past, append - could speed this up by saving last visited */
             found = g_node_append_data(cur, ne);
+
+          lte = cur->data;
+          if (lte->children == NULL)
+            lte->children = g_hash_table_new(g_str_hash, g_str_equal);
+          g_hash_table_insert(lte->children, ne->name, found);
         }
 
       g_assert(found != NULL);
@@ -510,6 +537,12 @@ ltable_remove(LTable* lt, guint cnxn)
           {
             if (cur == lt->tree)
               lt->tree = NULL;
+            else
+              {
+                LTableEntry* parent_lte = parent->data;
+
+                g_hash_table_remove(parent_lte->children, lte->name);
+              }
               
             ltable_entry_destroy(lte);
             g_node_destroy(cur);
@@ -566,29 +599,20 @@ ltable_destroy(LTable* ltable)
   g_ptr_array_free(ltable->listeners, TRUE);
 
   g_slist_free(ltable->removed_indices);
+
+  g_free(ltable->key_scratch);
+  g_ptr_array_free(ltable->notify_scratch, TRUE);
   
   g_free(ltable);
 }
 
 static void
-notify_listener_list(GConfListeners* listeners,
-                     GList* list,
-                     const gchar* key,
-                     GConfListenersCallback callback,
-                     gpointer user_data)
+add_listeners_to_notify(GPtrArray* to_notify, GList* list)
 {
-  GList* tmp;
-
-  tmp = list;
-  while (tmp != NULL)
+  for (; list != NULL; list = list->next)
     {
-      Listener* l = tmp->data;
-
-      /* don't notify listeners that were removed during the notify */
-      if (!l->removed)
-        (*callback)(listeners, key, l->cnxn, l->listener_data, user_data);
-
-      tmp = g_list_next(tmp);
+      listener_ref(list->data);
+      g_ptr_array_add(to_notify, list->data);
     }
 }
 
@@ -596,69 +620,96 @@ static void
 ltable_notify(LTable* lt, const gchar* key,
               GConfListenersCallback callback, gpointer user_data)
 {
-  gchar** dirs;
-  guint i;
-  const gchar* noroot_key;
+  gchar* dir;
   GNode* cur;
-  GList *to_notify;
+  GPtrArray* to_notify;
+  gsize len;
+  guint i;
   
-  noroot_key = key + 1;
-
+  /* Callers pass a key that was validated when it was set, so
+   * only do the cheap checks here; the walk below stops at an
+   * empty component, so a bad key can't match the wrong listeners.
+   */
+  g_return_if_fail(key != NULL);
   g_return_if_fail(*key == '/');
-  g_return_if_fail(gconf_valid_key(key, NULL));
 
   if (lt->tree == NULL)
     return; /* no one to notify */
 
-  /* we build a list "to_notify" to be safe against tree
-   * modifications during the notification.
+  /* Split a copy of the key in place rather than g_strsplit() it */
+  len = strlen(key);
+  if (len + 1 > lt->key_scratch_size)
+    {
+      lt->key_scratch_size = MAX(len + 1, lt->key_scratch_size * 2);
+      g_free(lt->key_scratch);
+      lt->key_scratch = g_malloc(lt->key_scratch_size);
+    }
+  memcpy(lt->key_scratch, key, len + 1);
+
+  /* we collect the listeners first to be safe against tree
+   * modifications during the notification; a callback may
+   * notify again, that one can't use the scratch array.
    */
+  if (lt->notify_scratch_busy)
+    to_notify = g_ptr_array_new();
+  else
+    {
+      to_notify = lt->notify_scratch;
+      lt->notify_scratch_busy = TRUE;
+    }
   
   /* Notify "/" listeners */
-  to_notify = g_list_copy (((LTableEntry*)lt->tree->data)->listeners);  
-
-  dirs = g_strsplit (noroot_key, "/", -1);
+  add_listeners_to_notify(to_notify,
+                          ((LTableEntry*)lt->tree->data)->listeners);
 
   cur = lt->tree;
-  i = 0;
-  while (dirs[i] && cur)
+  dir = lt->key_scratch + 1;
+  while (*dir != '\0' && cur != NULL)
     {
-      GNode* child = cur->children;
-
-      while (child != NULL)
-        {
-          LTableEntry* lte = child->data;
+      LTableEntry* lte = cur->data;
+      gchar* end;
+
+      end = strchr(dir, '/');
+      if (end == dir)
+        break; /* "//" or a trailing slash, not a valid key */
+      if (end != NULL)
+        *end = '\0';
+
+      if (lte->children != NULL)
+        cur = g_hash_table_lookup(lte->children, dir);
+      else
+        cur = NULL;
 
-          if (strcmp(lte->name, dirs[i]) == 0)
-            {
-              GList *copy = g_list_copy (lte->listeners);
-              to_notify = g_list_concat (to_notify, copy);
+      if (cur != NULL)
+        add_listeners_to_notify(to_notify,
+                                ((LTableEntry*)cur->data)->listeners);
 
-              break;
-            }
+      if (end == NULL)
+        break;
 
-          child = g_node_next_sibling(child);
-        }
+      dir = end + 1;
+    }
 
-      if (child != NULL) /* we found a child, scan below it */
-        cur = child;
-      else               /* end of the line */
-        cur = NULL;
+  for (i = 0; i < to_notify->len; ++i)
+    {
+      Listener* l = g_ptr_array_index(to_notify, i);
 
-      ++i;
+      /* don't notify listeners that were removed during the notify */
+      if (!l->removed)
+        (*callback)((GConfListeners*)lt, key, l->cnxn, l->listener_data,
+                    user_data);
     }
-  
-  g_strfreev(dirs);
-
-  g_list_foreach (to_notify, (GFunc) listener_ref, NULL);
-  
-  notify_listener_list ((GConfListeners*)lt,
-                        to_notify, key,
-                        callback, user_data);
 
-  g_list_foreach (to_notify, (GFunc) listener_unref, NULL);
+  for (i = 0; i < to_notify->len; ++i)
+    listener_unref(g_ptr_array_index(to_notify, i));
 
-  g_list_free (to_notify);
+  if (to_notify == lt->notify_scratch)
+    {
+      g_ptr_array_set_size(to_notify, 0);
+      lt->notify_scratch_busy = FALSE;
+    }
+  else
+    g_ptr_array_free(to_notify, TRUE);
 }
 
 struct NodeTraverseData
@@ -865,6 +916,8 @@ static void
 ltable_entry_destroy(LTableEntry* lte)
 {
   g_return_if_fail(lte->listeners == NULL); /* should destroy all listeners first. */
+  if (lte->children != NULL)
+    g_hash_table_destroy(lte->children);
   g_free(lte->name);
   g_free(lte->full_name);
   g_free(lte);
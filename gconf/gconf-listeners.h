@@ -66,6 +66,11 @@ guint               gconf_listeners_add     (GConfListeners* listeners,
 
 void     gconf_listeners_remove   (GConfListeners          *listeners,
                                    guint                    cnxn_id);
+
+/* all_above must be a valid key (see gconf_valid_key()); it is
+ * not validated again here, since notifications are sent for keys
+ * that were checked when they were set.
+ */
 void     gconf_listeners_notify   (GConfListeners          *listeners,
                                    const gchar             *all_above,
                                    GConfListenersCallback   callback,
@@ -44,7 +44,7 @@ gconf_schema_new (void)
 {
   GConfRealSchema *real;
 
-  real = g_new0 (GConfRealSchema, 1);
+  real = g_slice_new0 (GConfRealSchema);
 
   real->type = GCONF_VALUE_INVALID;
   real->list_type = GCONF_VALUE_INVALID;
@@ -74,7 +74,7 @@ gconf_schema_free (GConfSchema* sc)
   if (real->default_value)
     gconf_value_free (real->default_value);
   
-  g_free (sc);
+  g_slice_free (GConfRealSchema, real);
 }
 
 GConfSchema*  
@@ -69,6 +69,8 @@ gconf_resolve_address(const gchar* address, GError** err)
     }
 }
 
+static void writable_map_free (GConfSource *source);
+
 void         
 gconf_source_free (GConfSource* source)
 {
@@ -80,6 +82,8 @@ gconf_source_free (GConfSource* source)
   backend = source->backend;
   address = source->address;
 
+  writable_map_free (source);
+
   (*source->backend->vtable.destroy_source)(source);
   
   /* Remove ref held by the source. */
@@ -92,18 +96,238 @@ gconf_source_free (GConfSource* source)
        ((source)->backend->vtable.readable != NULL &&     \
         (*(source)->backend->vtable.readable)((source), (key), (err))) )
 
+/* Writability map
+ *
+ * For sources that are only partly writable, remember the answers
+ * of the backend's writable method in a tree of namespace sections.
+ * The vtable promises that if a key is writable so is everything
+ * below it; so a writable node covers its whole subtree, and a
+ * read-only key makes its parents read-only as well.
+ */
+
+#define MAX_WRITABLE_NODES 8192
+
+typedef enum {
+  WRITABLE_UNKNOWN,
+  WRITABLE_YES,
+  WRITABLE_NO
+} WritableState;
+
+typedef struct _WritableNode WritableNode;
+
+struct _WritableNode {
+  GHashTable *children; /* component -> WritableNode, or NULL */
+  WritableState state;
+};
+
+typedef struct {
+  WritableNode *root;
+  guint n_nodes;
+} WritableMap;
+
+static WritableNode*
+writable_node_new (WritableMap *map)
+{
+  map->n_nodes += 1;
+
+  return g_new0 (WritableNode, 1);
+}
+
+static void
+writable_node_free (WritableNode *node)
+{
+  if (node->children)
+    g_hash_table_destroy (node->children);
+  g_free (node);
+}
+
+static void
+writable_map_free (GConfSource *source)
+{
+  WritableMap *map = source->writable_map;
+
+  if (map == NULL)
+    return;
+
+  writable_node_free (map->root);
+  g_free (map);
+  source->writable_map = NULL;
+}
+
+static WritableMap*
+writable_map_get (GConfSource *source)
+{
+  WritableMap *map = source->writable_map;
+
+  if (map == NULL || map->n_nodes > MAX_WRITABLE_NODES)
+    {
+      writable_map_free (source);
+
+      map = g_new0 (WritableMap, 1);
+      map->root = writable_node_new (map);
+      source->writable_map = map;
+    }
+
+  return map;
+}
+
+static WritableState
+writable_map_lookup (WritableMap *map,
+                     const gchar *key)
+{
+  WritableNode *node;
+  WritableState state;
+  gchar buf[256];
+  gchar *scratch;
+  gchar *start;
+  gchar *end;
+  gsize len;
+
+  /* Components are looked up in place, by cutting a copy of the key
+   * at each slash; only unusually long keys need the heap
+   */
+  len = strlen (key);
+  if (len < sizeof (buf))
+    scratch = memcpy (buf, key, len + 1);
+  else
+    scratch = g_strdup (key);
+
+  node = map->root;
+  start = scratch + 1;
+
+  while (TRUE)
+    {
+      if (node->state == WRITABLE_YES)
+        {
+          state = WRITABLE_YES;
+          goto out;
+        }
+
+      if (*start == '\0')
+        break;
+
+      if (node->children == NULL)
+        {
+          state = WRITABLE_UNKNOWN;
+          goto out;
+        }
+
+      end = strchr (start, '/');
+      if (end != NULL)
+        *end = '\0';
+
+      node = g_hash_table_lookup (node->children, start);
+
+      if (node == NULL)
+        {
+          state = WRITABLE_UNKNOWN;
+          goto out;
+        }
+
+      start = (end != NULL) ? end + 1 : start + strlen (start);
+    }
+
+  /* The exact key; a read-only state further up doesn't count */
+  state = node->state;
+
+ out:
+  if (scratch != buf)
+    g_free (scratch);
+
+  return state;
+}
+
+static void
+writable_map_record (WritableMap *map,
+                     const gchar *key,
+                     gboolean     writable)
+{
+  WritableNode *node;
+  WritableNode *child;
+  gchar **components;
+  int i;
+
+  node = map->root;
+  if (!writable)
+    node->state = WRITABLE_NO;
+
+  components = g_strsplit (key + 1, "/", -1);
+
+  for (i = 0; components[i] != NULL && components[i][0] != '\0'; i++)
+    {
+      if (node->children == NULL)
+        node->children =
+          g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                 (GDestroyNotify) writable_node_free);
+
+      child = g_hash_table_lookup (node->children, components[i]);
+      if (child == NULL)
+        {
+          child = writable_node_new (map);
+          g_hash_table_insert (node->children,
+                               g_strdup (components[i]), child);
+        }
+
+      node = child;
+
+      /* a parent of a read-only key is read-only */
+      if (!writable)
+        node->state = WRITABLE_NO;
+    }
+
+  g_strfreev (components);
+
+  if (writable)
+    {
+      /* covers everything below, forget the details */
+      node->state = WRITABLE_YES;
+      if (node->children != NULL)
+        {
+          g_hash_table_destroy (node->children);
+          node->children = NULL;
+        }
+    }
+}
+
 static gboolean
 source_is_writable(GConfSource* source, const gchar* key, GError** err)
 {
+  WritableMap *map;
+  GError *tmp_err;
+  gboolean writable;
+
   if ((source->flags & GCONF_SOURCE_NEVER_WRITEABLE) != 0)
     return FALSE;
   else if ((source->flags & GCONF_SOURCE_ALL_WRITEABLE) != 0)
     return TRUE;
-  else if ((source->backend->vtable.writable != NULL) &&
-           (*source->backend->vtable.writable)(source, key, err))
-    return TRUE;
-  else
+  else if (source->backend->vtable.writable == NULL)
     return FALSE;
+
+  map = writable_map_get (source);
+
+  switch (writable_map_lookup (map, key))
+    {
+    case WRITABLE_YES:
+      return TRUE;
+    case WRITABLE_NO:
+      return FALSE;
+    case WRITABLE_UNKNOWN:
+      break;
+    }
+
+  tmp_err = NULL;
+  writable = (*source->backend->vtable.writable)(source, key, &tmp_err);
+
+  if (tmp_err != NULL)
+    {
+      /* don't remember failures */
+      g_propagate_error (err, tmp_err);
+      return FALSE;
+    }
+
+  writable_map_record (map, key, writable);
+
+  return writable;
 }
 
 static GConfValue*
@@ -194,6 +418,242 @@ gconf_source_unset_value      (GConfSource* source,
     return FALSE;
 }
 
+static void
+keep_first_error (GError **first_error,
+                  GError  *error)
+{
+  if (error == NULL)
+    return;
+
+  if (*first_error == NULL)
+    *first_error = error;
+  else
+    g_error_free (error);
+}
+
+/* Batch versions of the wrappers above. Keys the source won't let us
+ * read or write are left out, errors from asking about that are
+ * ignored. If the backend has no multi-key call, it gets one call
+ * per key.
+ *
+ * Puts the keys we may pass on into subset, and their positions in
+ * keys into positions; returns how many there are.
+ */
+static guint
+source_filter_keys (GConfSource  *source,
+                    const gchar **keys,
+                    guint         n_keys,
+                    gboolean      writing,
+                    const gchar **subset,
+                    guint        *positions)
+{
+  guint i;
+  guint n;
+
+  n = 0;
+  for (i = 0; i < n_keys; ++i)
+    {
+      gboolean ok;
+
+      if (writing)
+        ok = source_is_writable (source, keys[i], NULL);
+      else
+        ok = SOURCE_READABLE (source, keys[i], NULL);
+
+      if (ok)
+        {
+          subset[n] = keys[i];
+          positions[n] = i;
+          ++n;
+        }
+    }
+
+  return n;
+}
+
+static void
+gconf_source_query_values     (GConfSource* source,
+                               const gchar** keys,
+                               guint n_keys,
+                               const gchar** locales,
+                               GConfValue** values,
+                               gchar** schema_names,
+                               GError** err)
+{
+  const gchar **subset;
+  guint *positions;
+  GConfValue **subset_values;
+  gchar **subset_schema_names;
+  GError *first_error;
+  guint n;
+  guint i;
+
+  g_return_if_fail (source != NULL);
+  g_return_if_fail (err == NULL || *err == NULL);
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      values[i] = NULL;
+      if (schema_names)
+        schema_names[i] = NULL;
+    }
+
+  subset = g_new (const gchar*, n_keys);
+  positions = g_new (guint, n_keys);
+  n = source_filter_keys (source, keys, n_keys, FALSE, subset, positions);
+
+  subset_values = g_new0 (GConfValue*, n);
+  subset_schema_names = schema_names ? g_new0 (gchar*, n) : NULL;
+
+  first_error = NULL;
+  if (n == 0)
+    ;
+  else if (source->backend->vtable.query_values != NULL)
+    (*source->backend->vtable.query_values) (source, subset, n, locales,
+                                             subset_values,
+                                             subset_schema_names,
+                                             &first_error);
+  else
+    {
+      for (i = 0; i < n; ++i)
+        {
+          GError *error = NULL;
+
+          subset_values[i] =
+            (*source->backend->vtable.query_value) (source, subset[i], locales,
+                                                    subset_schema_names ?
+                                                    &subset_schema_names[i] : NULL,
+                                                    &error);
+          keep_first_error (&first_error, error);
+        }
+    }
+
+  for (i = 0; i < n; ++i)
+    {
+      values[positions[i]] = subset_values[i];
+      if (schema_names)
+        schema_names[positions[i]] = subset_schema_names[i];
+    }
+
+  g_free (subset_schema_names);
+  g_free (subset_values);
+  g_free (positions);
+  g_free (subset);
+
+  if (first_error != NULL)
+    g_propagate_error (err, first_error);
+}
+
+/* written[i] says whether the source was writable at keys[i] */
+static void
+gconf_source_set_values       (GConfSource* source,
+                               const gchar** keys,
+                               GConfValue* const* values,
+                               guint n_keys,
+                               gboolean* written,
+                               GError** err)
+{
+  const gchar **subset;
+  GConfValue **subset_values;
+  guint *positions;
+  GError *first_error;
+  guint n;
+  guint i;
+
+  g_return_if_fail (source != NULL);
+  g_return_if_fail (err == NULL || *err == NULL);
+
+  subset = g_new (const gchar*, n_keys);
+  positions = g_new (guint, n_keys);
+  n = source_filter_keys (source, keys, n_keys, TRUE, subset, positions);
+
+  subset_values = g_new (GConfValue*, n);
+  for (i = 0; i < n_keys; ++i)
+    written[i] = FALSE;
+  for (i = 0; i < n; ++i)
+    {
+      subset_values[i] = values[positions[i]];
+      written[positions[i]] = TRUE;
+    }
+
+  first_error = NULL;
+  if (n == 0)
+    ;
+  else if (source->backend->vtable.set_values != NULL)
+    (*source->backend->vtable.set_values) (source, subset, subset_values, n,
+                                           &first_error);
+  else
+    {
+      for (i = 0; i < n; ++i)
+        {
+          GError *error = NULL;
+
+          (*source->backend->vtable.set_value) (source, subset[i],
+                                                subset_values[i], &error);
+          keep_first_error (&first_error, error);
+        }
+    }
+
+  g_free (subset_values);
+  g_free (positions);
+  g_free (subset);
+
+  if (first_error != NULL)
+    g_propagate_error (err, first_error);
+}
+
+/* written[i] says whether the source was writable at keys[i] */
+static void
+gconf_source_unset_values     (GConfSource* source,
+                               const gchar** keys,
+                               guint n_keys,
+                               const gchar* locale,
+                               gboolean* written,
+                               GError** err)
+{
+  const gchar **subset;
+  guint *positions;
+  GError *first_error;
+  guint n;
+  guint i;
+
+  g_return_if_fail (source != NULL);
+  g_return_if_fail (err == NULL || *err == NULL);
+
+  subset = g_new (const gchar*, n_keys);
+  positions = g_new (guint, n_keys);
+  n = source_filter_keys (source, keys, n_keys, TRUE, subset, positions);
+
+  for (i = 0; i < n_keys; ++i)
+    written[i] = FALSE;
+  for (i = 0; i < n; ++i)
+    written[positions[i]] = TRUE;
+
+  first_error = NULL;
+  if (n == 0)
+    ;
+  else if (source->backend->vtable.unset_values != NULL)
+    (*source->backend->vtable.unset_values) (source, subset, n, locale,
+                                             &first_error);
+  else
+    {
+      for (i = 0; i < n; ++i)
+        {
+          GError *error = NULL;
+
+          (*source->backend->vtable.unset_value) (source, subset[i], locale,
+                                                  &error);
+          keep_first_error (&first_error, error);
+        }
+    }
+
+  g_free (positions);
+  g_free (subset);
+
+  if (first_error != NULL)
+    g_propagate_error (err, first_error);
+}
+
 static GSList*      
 gconf_source_all_entries         (GConfSource* source,
                                   const gchar* dir,
@@ -335,6 +795,10 @@ gconf_source_remove_listener (GConfSource *source,
  *   Source stacks
  */
 
+static void value_cache_create  (GConfSources *sources);
+static void value_cache_destroy (GConfSources *sources);
+static gboolean all_sources_notify_changes (GConfSources *sources);
+
 GConfSources* 
 gconf_sources_new_from_addresses(GSList * addresses, GError** err)
 {
@@ -423,6 +887,12 @@ gconf_sources_new_from_addresses(GSList * addresses, GError** err)
             gconf_log (GCL_INFO,
                        _("Resolved address \"%s\" to a partially writable config source at position %d"),
                        source->address, i);
+
+            /* Ask about the root now, if that's writable so is
+             * everything and we never need to ask again.
+             */
+            if (source_is_writable (source, "/", NULL))
+              source->flags |= GCONF_SOURCE_ALL_WRITEABLE;
           }
 
         ++i;
@@ -465,6 +935,8 @@ gconf_sources_free(GConfSources* sources)
 
   g_list_free(sources->sources);
 
+  value_cache_destroy (sources);
+
   g_free(sources);
 }
 
@@ -473,12 +945,16 @@ gconf_sources_clear_cache        (GConfSources  *sources)
 {
   GList* tmp;
 
+  gconf_sources_invalidate (sources, NULL);
+
   tmp = sources->sources;
 
   while (tmp != NULL)
     {
       GConfSource* source = tmp->data;
 
+      writable_map_free (source);
+
       if (source->backend->vtable.clear_cache)
         (*source->backend->vtable.clear_cache)(source);
       
@@ -486,76 +962,633 @@ gconf_sources_clear_cache        (GConfSources  *sources)
     }
 }
 
-GConfValue*   
-gconf_sources_query_value (GConfSources* sources, 
-                           const gchar* key,
-                           const gchar** locales,
-                           gboolean use_schema_default,
-                           gboolean* value_is_default,
-                           gboolean* value_is_writable,
-                           gchar   **schema_namep,
-                           GError** err)
-{
-  GList* tmp;
-  gchar* schema_name;
-  GError* error;
-  GConfValue* val;
-  
-  g_return_val_if_fail (sources != NULL, NULL);
-  g_return_val_if_fail (key != NULL, NULL);
-  g_return_val_if_fail ((err == NULL) || (*err == NULL), NULL);
+/*
+ * Resolved value cache
+ */
 
-  /* A value is writable if it is unset and a writable source exists,
-   * or if it's set and the setting is within or after a writable source.
-   * So basically if we see a writable source before we get the value,
-   * or get the value from a writable source, the value is writable.
-   */
-  
-  if (!gconf_key_check(key, err))
-    return NULL;
+/* Resolving a value can take several probes of every source, plus
+ * another round for the schema default. So the daemon's stacks keep
+ * the results, keyed by key and then by locale list; any change
+ * going through the stack or reported by a backend drops the key,
+ * together with the keys whose default came from it as a schema.
+ */
 
-  if (value_is_default)
-    *value_is_default = FALSE;
+#define MAX_CACHED_KEYS 4096
 
-  if (value_is_writable)
-    *value_is_writable = FALSE;
+typedef struct {
+  gchar *locales;   /* from make_locales_key() */
+  GConfValue *value;
+  gchar *schema_name;
+  guint is_default : 1;
+  guint is_writable : 1;
+} CachedValue;
 
-  if (schema_namep)
-    *schema_namep = NULL;
+static gchar*
+make_locales_key (const gchar **locales,
+                  gboolean      use_schema_default)
+{
+  GString *str;
+  int i;
 
-  val = NULL;
-  schema_name = NULL;
-  error = NULL;
-  
-  tmp = sources->sources;
+  str = g_string_new (use_schema_default ? "d" : "n");
 
-  while (tmp != NULL)
+  if (locales != NULL)
     {
-      GConfSource* source;      
-      gchar** schema_name_retloc;
-
-      schema_name_retloc = &schema_name;
-      if (schema_name != NULL ||                          /* already have the schema name */
-          (schema_namep == NULL && !use_schema_default))  /* don't need to get the schema name */
-        schema_name_retloc = NULL;
-      
-      source = tmp->data;
-
-      if (val == NULL)
+      for (i = 0; locales[i] != NULL; i++)
         {
-          /* A key is writable if the source containing its value or
-           * an earlier source is writable
-           */          
-          if (value_is_writable &&
-              source_is_writable (source, key, NULL)) /* ignore errors */
-            *value_is_writable = TRUE;
-          
-          val = gconf_source_query_value (source, key, locales,
-                                          schema_name_retloc, &error);
-
+          g_string_append_c (str, ':');
+          g_string_append (str, locales[i]);
         }
-      else if (schema_name_retloc != NULL)
-        {
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+cached_value_free (CachedValue *cv)
+{
+  g_free (cv->locales);
+  if (cv->value)
+    gconf_value_free (cv->value);
+  g_free (cv->schema_name);
+  g_free (cv);
+}
+
+static void
+cached_value_list_free (GSList *list)
+{
+  g_slist_foreach (list, (GFunc) cached_value_free, NULL);
+  g_slist_free (list);
+}
+
+/* The default values of schemas, so keys sharing a schema don't
+ * each fetch and copy the whole schema.
+ */
+typedef struct {
+  gchar *locales;   /* from make_locales_key() */
+  GConfValue *default_value;
+  /* type stored at the schema key, GCONF_VALUE_INVALID if unset */
+  GConfValueType stored_type;
+} SchemaDefault;
+
+static gboolean
+remove_always (gpointer key,
+               gpointer value,
+               gpointer data)
+{
+  return TRUE;
+}
+
+static void
+schema_default_free (SchemaDefault *sd)
+{
+  g_free (sd->locales);
+  if (sd->default_value)
+    gconf_value_free (sd->default_value);
+  g_free (sd);
+}
+
+static void
+schema_default_list_free (GSList *list)
+{
+  g_slist_foreach (list, (GFunc) schema_default_free, NULL);
+  g_slist_free (list);
+}
+
+static void
+value_cache_create (GConfSources *sources)
+{
+  sources->value_cache =
+    g_hash_table_new_full (g_str_hash, g_str_equal,
+                           g_free, (GDestroyNotify) cached_value_list_free);
+  /* schema key -> set of keys that took their default from it */
+  sources->schema_users =
+    g_hash_table_new_full (g_str_hash, g_str_equal,
+                           g_free, (GDestroyNotify) g_hash_table_destroy);
+  /* schema key -> list of SchemaDefault */
+  sources->schema_defaults =
+    g_hash_table_new_full (g_str_hash, g_str_equal,
+                           g_free, (GDestroyNotify) schema_default_list_free);
+}
+
+static void
+value_cache_destroy (GConfSources *sources)
+{
+  if (sources->value_cache == NULL)
+    return;
+
+  g_hash_table_destroy (sources->value_cache);
+  g_hash_table_destroy (sources->schema_users);
+  g_hash_table_destroy (sources->schema_defaults);
+  sources->value_cache = NULL;
+  sources->schema_users = NULL;
+  sources->schema_defaults = NULL;
+}
+
+static CachedValue*
+value_cache_lookup (GConfSources *sources,
+                    const gchar  *key,
+                    const gchar  *locales)
+{
+  GSList *tmp;
+
+  tmp = g_hash_table_lookup (sources->value_cache, key);
+  while (tmp != NULL)
+    {
+      CachedValue *cv = tmp->data;
+
+      if (strcmp (cv->locales, locales) == 0)
+        return cv;
+
+      tmp = tmp->next;
+    }
+
+  return NULL;
+}
+
+static void
+value_cache_insert (GConfSources *sources,
+                    const gchar  *key,
+                    CachedValue  *cv)
+{
+  GSList *list;
+
+  if (g_hash_table_size (sources->value_cache) >= MAX_CACHED_KEYS)
+    {
+      value_cache_destroy (sources);
+      value_cache_create (sources);
+    }
+
+  /* steal so the destroy notify doesn't free the list */
+  list = g_hash_table_lookup (sources->value_cache, key);
+  if (list != NULL)
+    g_hash_table_steal (sources->value_cache, key);
+  list = g_slist_prepend (list, cv);
+  g_hash_table_insert (sources->value_cache, g_strdup (key), list);
+
+  if (cv->is_default && cv->schema_name != NULL)
+    {
+      GHashTable *users;
+
+      users = g_hash_table_lookup (sources->schema_users, cv->schema_name);
+      if (users == NULL)
+        {
+          users = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, NULL);
+          g_hash_table_insert (sources->schema_users,
+                               g_strdup (cv->schema_name), users);
+        }
+
+      if (g_hash_table_lookup (users, key) == NULL)
+        {
+          gchar *user_key = g_strdup (key);
+
+          g_hash_table_insert (users, user_key, user_key);
+        }
+    }
+}
+
+/* Take key out of the user sets of the schemas its cached
+ * defaults came from
+ */
+static void
+value_cache_forget_schema_users (GConfSources *sources,
+                                 const gchar  *key)
+{
+  GSList *tmp;
+
+  tmp = g_hash_table_lookup (sources->value_cache, key);
+  while (tmp != NULL)
+    {
+      CachedValue *cv = tmp->data;
+      GHashTable *users;
+
+      if (cv->is_default && cv->schema_name != NULL)
+        {
+          users = g_hash_table_lookup (sources->schema_users,
+                                       cv->schema_name);
+          if (users != NULL)
+            {
+              g_hash_table_remove (users, key);
+              if (g_hash_table_size (users) == 0)
+                g_hash_table_remove (sources->schema_users,
+                                     cv->schema_name);
+            }
+        }
+
+      tmp = tmp->next;
+    }
+}
+
+static void
+remove_user_foreach (gpointer key,
+                     gpointer value,
+                     gpointer data)
+{
+  GConfSources *sources = data;
+
+  value_cache_forget_schema_users (sources, key);
+  g_hash_table_remove (sources->value_cache, key);
+}
+
+void
+gconf_sources_invalidate (GConfSources *sources,
+                          const gchar  *key)
+{
+  GHashTable *users;
+  gpointer orig_key;
+
+  if (sources->value_cache == NULL)
+    return;
+
+  if (key == NULL)
+    {
+      value_cache_destroy (sources);
+      value_cache_create (sources);
+      return;
+    }
+
+  value_cache_forget_schema_users (sources, key);
+  g_hash_table_remove (sources->value_cache, key);
+  g_hash_table_remove (sources->schema_defaults, key);
+
+  if (g_hash_table_lookup_extended (sources->schema_users, key,
+                                    &orig_key, (gpointer *) &users))
+    {
+      g_hash_table_steal (sources->schema_users, key);
+
+      /* The set is no longer in schema_users, so forgetting the
+       * users can't modify it while we walk it
+       */
+      g_hash_table_foreach (users, remove_user_foreach, sources);
+
+      g_hash_table_destroy (users);
+      g_free (orig_key);
+    }
+}
+
+static GConfValue*
+query_value_uncached (GConfSources* sources, 
+                      const gchar* key,
+                      const gchar** locales,
+                      gboolean use_schema_default,
+                      gboolean* value_is_default,
+                      gboolean* value_is_writable,
+                      gchar   **schema_namep,
+                      GError** err);
+
+static SchemaDefault*
+schema_default_lookup (GConfSources *sources,
+                       const gchar  *schema_name,
+                       const gchar  *locales_key)
+{
+  GSList *tmp;
+
+  tmp = g_hash_table_lookup (sources->schema_defaults, schema_name);
+  for (; tmp != NULL; tmp = tmp->next)
+    {
+      SchemaDefault *sd = tmp->data;
+
+      if (strcmp (sd->locales, locales_key) == 0)
+        return sd;
+    }
+
+  return NULL;
+}
+
+/* Remembers what is stored at schema_name; takes ownership of
+ * locales_key and frees val.
+ */
+static SchemaDefault*
+schema_default_insert (GConfSources *sources,
+                       const gchar  *schema_name,
+                       gchar        *locales_key,
+                       GConfValue   *val)
+{
+  SchemaDefault *sd;
+  GSList *list;
+
+  sd = g_new0 (SchemaDefault, 1);
+  sd->locales = locales_key;
+
+  if (val != NULL)
+    {
+      sd->stored_type = val->type;
+
+      if (val->type == GCONF_VALUE_SCHEMA)
+        sd->default_value =
+          gconf_schema_steal_default_value (gconf_value_get_schema (val));
+
+      gconf_value_free (val);
+    }
+
+  if (g_hash_table_size (sources->schema_defaults) >= MAX_CACHED_KEYS)
+    g_hash_table_foreach_remove (sources->schema_defaults,
+                                 (GHRFunc) remove_always, NULL);
+
+  list = g_hash_table_lookup (sources->schema_defaults, schema_name);
+  if (list != NULL)
+    g_hash_table_steal (sources->schema_defaults, schema_name);
+  list = g_slist_prepend (list, sd);
+  g_hash_table_insert (sources->schema_defaults, g_strdup (schema_name), list);
+
+  return sd;
+}
+
+/* Returns a copy of the default value of the schema stored at
+ * schema_name, and the type of whatever is stored there so callers
+ * can complain if it isn't a schema.
+ */
+static GConfValue*
+query_schema_default (GConfSources   *sources,
+                      const gchar    *schema_name,
+                      const gchar   **locales,
+                      GConfValueType *stored_type,
+                      GError        **err)
+{
+  SchemaDefault *sd;
+  gchar *locales_key;
+  GConfValue *val;
+  GError *error;
+
+  *stored_type = GCONF_VALUE_INVALID;
+
+  if (!gconf_key_check (schema_name, err))
+    return NULL;
+
+  if (sources->schema_defaults == NULL)
+    locales_key = NULL;
+  else
+    {
+      locales_key = make_locales_key (locales, FALSE);
+
+      sd = schema_default_lookup (sources, schema_name, locales_key);
+      if (sd != NULL)
+        {
+          g_free (locales_key);
+          *stored_type = sd->stored_type;
+          return sd->default_value ?
+            gconf_value_ref (sd->default_value) : NULL;
+        }
+    }
+
+  /* Bypass the value cache, we only want to keep the default */
+  error = NULL;
+  val = query_value_uncached (sources, schema_name, locales, FALSE,
+                              NULL, NULL, NULL, &error);
+
+  if (error != NULL)
+    {
+      g_propagate_error (err, error);
+      g_free (locales_key);
+      return NULL;
+    }
+
+  if (sources->schema_defaults == NULL)
+    {
+      GConfValue *defval = NULL;
+
+      if (val != NULL)
+        {
+          *stored_type = val->type;
+
+          if (val->type == GCONF_VALUE_SCHEMA)
+            defval =
+              gconf_schema_steal_default_value (gconf_value_get_schema (val));
+
+          gconf_value_free (val);
+        }
+
+      return defval;
+    }
+
+  sd = schema_default_insert (sources, schema_name, locales_key, val);
+
+  *stored_type = sd->stored_type;
+  return sd->default_value ? gconf_value_ref (sd->default_value) : NULL;
+}
+
+typedef struct
+{
+  guint                pending;
+  GConfSourceReadyFunc ready_func;
+  gpointer             user_data;
+} PrepareReadData;
+
+static void
+prepare_read_done (gpointer user_data)
+{
+  PrepareReadData *prd = user_data;
+
+  prd->pending -= 1;
+  if (prd->pending == 0)
+    {
+      (* prd->ready_func) (prd->user_data);
+      g_free (prd);
+    }
+}
+
+/* Returns TRUE if reading key (a key or a directory) won't block on a
+ * slow source. Otherwise returns FALSE and calls ready_func from the
+ * main loop once all sources that had to fetch something are done.
+ */
+gboolean
+gconf_sources_prepare_read (GConfSources        *sources,
+                            const gchar         *key,
+                            GConfSourceReadyFunc ready_func,
+                            gpointer             user_data)
+{
+  PrepareReadData *prd;
+  GList *tmp;
+
+  g_return_val_if_fail (sources != NULL, TRUE);
+  g_return_val_if_fail (key != NULL, TRUE);
+
+  prd = NULL;
+  for (tmp = sources->sources; tmp != NULL; tmp = tmp->next)
+    {
+      GConfSource *src = tmp->data;
+
+      if (src->backend->vtable.prepare_read == NULL ||
+          !SOURCE_READABLE (src, key, NULL))
+        continue;
+
+      if (prd == NULL)
+        {
+          prd = g_new (PrepareReadData, 1);
+          /* Held until we've asked every source */
+          prd->pending = 1;
+          prd->ready_func = ready_func;
+          prd->user_data = user_data;
+        }
+
+      prd->pending += 1;
+      if ((* src->backend->vtable.prepare_read) (src, key,
+                                                 prepare_read_done, prd))
+        prd->pending -= 1;
+    }
+
+  if (prd == NULL)
+    return TRUE;
+
+  if (prd->pending == 1)
+    {
+      g_free (prd);
+      return TRUE;
+    }
+
+  prd->pending -= 1;
+  return FALSE;
+}
+
+GConfValue*   
+gconf_sources_query_value (GConfSources* sources, 
+                           const gchar* key,
+                           const gchar** locales,
+                           gboolean use_schema_default,
+                           gboolean* value_is_default,
+                           gboolean* value_is_writable,
+                           gchar   **schema_namep,
+                           GError** err)
+{
+  CachedValue *cv;
+  gchar *locales_key;
+  
+  g_return_val_if_fail (sources != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+  g_return_val_if_fail ((err == NULL) || (*err == NULL), NULL);
+  
+  if (!gconf_key_check(key, err))
+    return NULL;
+
+  /* A backend may have stopped noticing external edits */
+  if (sources->value_cache != NULL && !all_sources_notify_changes (sources))
+    value_cache_destroy (sources);
+
+  if (sources->value_cache == NULL)
+    return query_value_uncached (sources, key, locales, use_schema_default,
+                                 value_is_default, value_is_writable,
+                                 schema_namep, err);
+
+  locales_key = make_locales_key (locales, use_schema_default);
+
+  cv = value_cache_lookup (sources, key, locales_key);
+
+  if (cv == NULL)
+    {
+      gboolean is_default;
+      gboolean is_writable;
+      gchar *schema_name;
+      GConfValue *val;
+      GError *error;
+
+      /* Always ask for everything, so the result is good for
+       * any caller.
+       */
+      error = NULL;
+      schema_name = NULL;
+      val = query_value_uncached (sources, key, locales, use_schema_default,
+                                  &is_default, &is_writable, &schema_name,
+                                  &error);
+
+      if (error != NULL)
+        {
+          /* don't cache failures */
+          g_propagate_error (err, error);
+          if (val)
+            gconf_value_free (val);
+          g_free (schema_name);
+          g_free (locales_key);
+          return NULL;
+        }
+
+      cv = g_new0 (CachedValue, 1);
+      cv->locales = locales_key;
+      cv->value = val;
+      cv->schema_name = schema_name;
+      cv->is_default = is_default != FALSE;
+      cv->is_writable = is_writable != FALSE;
+
+      value_cache_insert (sources, key, cv);
+    }
+  else
+    g_free (locales_key);
+
+  if (value_is_default)
+    *value_is_default = cv->is_default;
+
+  if (value_is_writable)
+    *value_is_writable = cv->is_writable;
+
+  if (schema_namep)
+    *schema_namep = g_strdup (cv->schema_name);
+
+  return cv->value ? gconf_value_ref (cv->value) : NULL;
+}
+
+static GConfValue*
+query_value_uncached (GConfSources* sources, 
+                      const gchar* key,
+                      const gchar** locales,
+                      gboolean use_schema_default,
+                      gboolean* value_is_default,
+                      gboolean* value_is_writable,
+                      gchar   **schema_namep,
+                      GError** err)
+{
+  GList* tmp;
+  gchar* schema_name;
+  GError* error;
+  GConfValue* val;
+
+  /* A value is writable if it is unset and a writable source exists,
+   * or if it's set and the setting is within or after a writable source.
+   * So basically if we see a writable source before we get the value,
+   * or get the value from a writable source, the value is writable.
+   */
+
+  if (value_is_default)
+    *value_is_default = FALSE;
+
+  if (value_is_writable)
+    *value_is_writable = FALSE;
+
+  if (schema_namep)
+    *schema_namep = NULL;
+
+  val = NULL;
+  schema_name = NULL;
+  error = NULL;
+  
+  tmp = sources->sources;
+
+  while (tmp != NULL)
+    {
+      GConfSource* source;      
+      gchar** schema_name_retloc;
+
+      schema_name_retloc = &schema_name;
+      if (schema_name != NULL ||                          /* already have the schema name */
+          (schema_namep == NULL && !use_schema_default))  /* don't need to get the schema name */
+        schema_name_retloc = NULL;
+      
+      source = tmp->data;
+
+      if (val == NULL)
+        {
+          /* A key is writable if the source containing its value or
+           * an earlier source is writable
+           */          
+          if (value_is_writable &&
+              source_is_writable (source, key, NULL)) /* ignore errors */
+            *value_is_writable = TRUE;
+          
+          val = gconf_source_query_value (source, key, locales,
+                                          schema_name_retloc, &error);
+
+        }
+      else if (schema_name_retloc != NULL)
+        {
           GConfMetaInfo *mi;
           
           mi = gconf_source_query_metainfo (source, key, &error);
@@ -629,47 +1662,44 @@ gconf_sources_query_value (GConfSources* sources,
 
       if (use_schema_default)
         {
-          val = gconf_sources_query_value (sources, schema_name, locales,
-                                           FALSE, NULL, NULL, NULL, &error);
-        }
-      
-      if (error != NULL)
-        {
-          if (err)
-            *err = error;
-          else
-            g_error_free(error);
+          GConfValueType stored_type;
 
-          g_free(schema_name);
-          return NULL;
-        }
-      else if (val != NULL &&
-               val->type != GCONF_VALUE_SCHEMA)
-        {
-          gconf_set_error (err, GCONF_ERROR_FAILED,
-                           _("Schema `%s' specified for `%s' stores a non-schema value"), schema_name, key);
+          val = query_schema_default (sources, schema_name, locales,
+                                      &stored_type, &error);
 
-          if (schema_namep)
-            *schema_namep = schema_name;
-          else
-            g_free (schema_name);
+          if (error != NULL)
+            {
+              if (err)
+                *err = error;
+              else
+                g_error_free(error);
 
-          return NULL;
-        }
-      else if (val != NULL)
-        {
-          GConfValue* retval;
+              g_free(schema_name);
+              return NULL;
+            }
+          else if (stored_type != GCONF_VALUE_INVALID &&
+                   stored_type != GCONF_VALUE_SCHEMA)
+            {
+              gconf_set_error (err, GCONF_ERROR_FAILED,
+                               _("Schema `%s' specified for `%s' stores a non-schema value"), schema_name, key);
 
-          retval = gconf_schema_steal_default_value (gconf_value_get_schema (val));          
+              if (schema_namep)
+                *schema_namep = schema_name;
+              else
+                g_free (schema_name);
 
-          gconf_value_free (val);
+              return NULL;
+            }
+        }
 
+      if (val != NULL)
+        {
           if (schema_namep)
             *schema_namep = schema_name;
           else
             g_free (schema_name);
           
-          return retval;
+          return val;
         }
       else
         {
@@ -685,6 +1715,17 @@ gconf_sources_query_value (GConfSources* sources,
   return NULL;
 }
 
+static void
+set_no_writable_error (GError     **err,
+                       const gchar *key)
+{
+  g_set_error (err,
+               GCONF_ERROR,
+               GCONF_ERROR_NO_WRITABLE_DATABASE,
+               _("Unable to store a value at key '%s', as the configuration server has no writable databases. There are some common causes of this problem: 1) your configuration path file %s/path doesn't contain any databases or wasn't found 2) somehow we mistakenly created two gconfd processes 3) your operating system is misconfigured so NFS file locking doesn't work in your home directory or 4) your NFS client machine crashed and didn't properly notify the server on reboot that file locks should be dropped. If you have two gconfd processes (or had two at the time the second was launched), logging out, killing all copies of gconfd, and logging back in may help. If you have stale locks, remove ~/.gconf*/*lock. Perhaps the problem is that you attempted to use GConf from two machines at once, and ORBit still has its default configuration that prevents remote CORBA connections - put \"ORBIIOPIPv4=1\" in /etc/orbitrc. As always, check the user.* syslog for details on problems gconfd encountered. There can only be one gconfd per home directory, and it must own a lockfile in ~/.gconfd and also lockfiles in individual storage locations such as ~/.gconf"),
+               key, GCONF_CONFDIR);
+}
+
 void
 gconf_sources_set_value   (GConfSources* sources,
                            const gchar* key,
@@ -712,6 +1753,8 @@ gconf_sources_set_value   (GConfSources* sources,
                       _("The '/' name can only be a directory, not a key"));
       return;
     }
+
+  gconf_sources_invalidate (sources, key);
   
   tmp = sources->sources;
 
@@ -760,11 +1803,180 @@ gconf_sources_set_value   (GConfSources* sources,
     }
 
   /* If we arrived here, then there was nowhere to write a value */
-  g_set_error (err,
-               GCONF_ERROR,
-               GCONF_ERROR_NO_WRITABLE_DATABASE,
-               _("Unable to store a value at key '%s', as the configuration server has no writable databases. There are some common causes of this problem: 1) your configuration path file %s/path doesn't contain any databases or wasn't found 2) somehow we mistakenly created two gconfd processes 3) your operating system is misconfigured so NFS file locking doesn't work in your home directory or 4) your NFS client machine crashed and didn't properly notify the server on reboot that file locks should be dropped. If you have two gconfd processes (or had two at the time the second was launched), logging out, killing all copies of gconfd, and logging back in may help. If you have stale locks, remove ~/.gconf*/*lock. Perhaps the problem is that you attempted to use GConf from two machines at once, and ORBit still has its default configuration that prevents remote CORBA connections - put \"ORBIIOPIPv4=1\" in /etc/orbitrc. As always, check the user.* syslog for details on problems gconfd encountered. There can only be one gconfd per home directory, and it must own a lockfile in ~/.gconfd and also lockfiles in individual storage locations such as ~/.gconf"),           
-               key, GCONF_CONFDIR);
+  set_no_writable_error (err, key);
+}
+
+/* Stores error as the error of key i, unless it already has one */
+static void
+set_key_error (GError **errors,
+               guint    i,
+               GError  *error)
+{
+  if (errors != NULL && errors[i] == NULL)
+    errors[i] = error;
+  else
+    g_error_free (error);
+}
+
+/* Like gconf_sources_set_value() for a set of keys, but handing each
+ * source all the keys it should store at once. modified_sources, if
+ * not NULL, is filled with the sources keys[i] was stored in, or NULL.
+ * A failing key doesn't keep the others from being set. errors, if
+ * not NULL, is an array of n_keys NULL errors; errors[i] is set if
+ * keys[i] wasn't stored.
+ */
+void
+gconf_sources_set_values (GConfSources* sources,
+                          const gchar** keys,
+                          GConfValue* const* values,
+                          guint n_keys,
+                          GConfSources** modified_sources,
+                          GError** errors)
+{
+  const gchar **pending;
+  GConfValue **pending_values;
+  guint *positions;
+  gboolean *written;
+  GConfValue **existing;
+  GError *source_error;
+  guint n_pending;
+  GList *tmp;
+  guint i;
+  guint n;
+
+  g_return_if_fail (sources != NULL);
+
+  pending = g_new (const gchar*, n_keys);
+  pending_values = g_new (GConfValue*, n_keys);
+  positions = g_new (guint, n_keys);
+
+  n_pending = 0;
+  for (i = 0; i < n_keys; ++i)
+    {
+      GError *error = NULL;
+
+      if (modified_sources)
+        modified_sources[i] = NULL;
+
+      if (!gconf_key_check (keys[i], &error))
+        {
+          set_key_error (errors, i, error);
+          continue;
+        }
+
+      if (keys[i][1] == '\0')
+        {
+          gconf_set_error (&error, GCONF_ERROR_IS_DIR,
+                           _("The '/' name can only be a directory, not a key"));
+          set_key_error (errors, i, error);
+          continue;
+        }
+
+      if (!gconf_value_validate (values[i], &error))
+        {
+          set_key_error (errors, i, error);
+          continue;
+        }
+
+      gconf_sources_invalidate (sources, keys[i]);
+
+      pending[n_pending] = keys[i];
+      pending_values[n_pending] = values[i];
+      positions[n_pending] = i;
+      ++n_pending;
+    }
+
+  written = g_new (gboolean, n_keys);
+  existing = g_new (GConfValue*, n_keys);
+
+  /* The last error a source gave, for the keys no source stored */
+  source_error = NULL;
+
+  for (tmp = sources->sources; tmp != NULL && n_pending > 0; tmp = tmp->next)
+    {
+      GConfSource *src = tmp->data;
+      GError *error = NULL;
+
+      gconf_source_set_values (src, pending, pending_values, n_pending,
+                               written, &error);
+      if (error != NULL)
+        {
+          if (source_error != NULL)
+            g_error_free (source_error);
+          source_error = error;
+        }
+
+      n = 0;
+      for (i = 0; i < n_pending; ++i)
+        {
+          if (written[i])
+            {
+              if (modified_sources)
+                modified_sources[positions[i]] =
+                  gconf_sources_new_from_source (src);
+            }
+          else
+            {
+              pending[n] = pending[i];
+              pending_values[n] = pending_values[i];
+              positions[n] = positions[i];
+              ++n;
+            }
+        }
+      n_pending = n;
+
+      if (n_pending == 0)
+        break;
+
+      /* Keys set in a source we can't write to would override the
+       * new value, so that's an error
+       */
+      gconf_source_query_values (src, pending, n_pending, NULL,
+                                 existing, NULL, NULL);
+
+      n = 0;
+      for (i = 0; i < n_pending; ++i)
+        {
+          if (existing[i] != NULL)
+            {
+              gconf_value_free (existing[i]);
+
+              error = NULL;
+              gconf_set_error (&error, GCONF_ERROR_OVERRIDDEN,
+                               _("Value for `%s' set in a read-only source at the front of your configuration path"), pending[i]);
+              set_key_error (errors, positions[i], error);
+            }
+          else
+            {
+              pending[n] = pending[i];
+              pending_values[n] = pending_values[i];
+              positions[n] = positions[i];
+              ++n;
+            }
+        }
+      n_pending = n;
+    }
+
+  for (i = 0; i < n_pending; ++i)
+    {
+      GError *error = NULL;
+
+      if (source_error != NULL)
+        error = g_error_copy (source_error);
+      else
+        set_no_writable_error (&error, pending[i]);
+
+      set_key_error (errors, positions[i], error);
+    }
+
+  if (source_error != NULL)
+    g_error_free (source_error);
+
+  g_free (existing);
+  g_free (written);
+  g_free (positions);
+  g_free (pending_values);
+  g_free (pending);
 }
 
 void
@@ -777,6 +1989,8 @@ gconf_sources_unset_value   (GConfSources* sources,
   /* We unset in every layer we can write to... */
   GList* tmp;
   GError* error = NULL;
+
+  gconf_sources_invalidate (sources, key);
   
   tmp = sources->sources;
 
@@ -822,6 +2036,65 @@ gconf_sources_unset_value   (GConfSources* sources,
     }
 }
 
+/* Like gconf_sources_unset_value() for a set of keys, handing each
+ * source all of them at once. Unlike it, this goes on past errors,
+ * so one failing key doesn't leave the others set; the first error
+ * is reported. modified_sources is as for gconf_sources_set_values().
+ */
+static void
+sources_unset_values (GConfSources  *sources,
+                      const gchar  **keys,
+                      guint          n_keys,
+                      const gchar   *locale,
+                      GConfSources **modified_sources,
+                      GError       **err)
+{
+  gboolean *written;
+  GError *first_error;
+  GList *tmp;
+  guint i;
+
+  for (i = 0; i < n_keys; ++i)
+    {
+      gconf_sources_invalidate (sources, keys[i]);
+
+      if (modified_sources)
+        modified_sources[i] = NULL;
+    }
+
+  written = g_new (gboolean, n_keys);
+  first_error = NULL;
+
+  for (tmp = sources->sources; tmp != NULL; tmp = tmp->next)
+    {
+      GConfSource *src = tmp->data;
+      GError *error = NULL;
+
+      gconf_source_unset_values (src, keys, n_keys, locale, written, &error);
+      keep_first_error (&first_error, error);
+
+      if (modified_sources == NULL)
+        continue;
+
+      for (i = 0; i < n_keys; ++i)
+        {
+          if (!written[i])
+            continue;
+
+          if (modified_sources[i] == NULL)
+            modified_sources[i] = gconf_sources_new_from_source (src);
+          else
+            modified_sources[i]->sources =
+              g_list_prepend (modified_sources[i]->sources, src);
+        }
+    }
+
+  g_free (written);
+
+  if (first_error != NULL)
+    g_propagate_error (err, first_error);
+}
+
 static GSList *
 prepend_unset_notify (GSList       *notifies,
 		      GConfSources *modified_sources,
@@ -918,36 +2191,44 @@ recursive_unset_helper (GConfSources   *sources,
 
   if (entries != NULL)
     {
-      tmp = entries;
+      GConfSources **modified;
+      gchar **keys;
+      guint n_keys;
+      guint i;
 
-      while (tmp != NULL)
+      n_keys = g_slist_length (entries);
+      keys = g_new (gchar*, n_keys);
+
+      i = 0;
+      for (tmp = entries; tmp != NULL; tmp = tmp->next)
         {
           GConfEntry* entry = tmp->data;
-          char *full, *freeme;
 
-	  full = freeme = gconf_concat_dir_and_key (key,
-						    gconf_entry_get_key (entry));
-          
-          
-          gconf_sources_unset_value (sources, full, locale, modifiedp, &err);
-          if (notifies)
-	    {
-	      *notifies = prepend_unset_notify (*notifies, modified_sources, full);
-	      modified_sources = NULL;
-	      freeme = NULL;
-	    }
+          keys[i++] = gconf_concat_dir_and_key (key,
+                                                gconf_entry_get_key (entry));
+          gconf_entry_free (entry);
+        }
+      g_slist_free (entries);
 
-          if (err != NULL)
-            {
-              gconf_log (GCL_DEBUG, "Error unsetting '%s': %s\n",
-                         full, err->message);
+      modified = notifies ? g_new (GConfSources*, n_keys) : NULL;
 
-              if (*first_error)
-                g_error_free (err);
-              else
-                *first_error = err;
-              err = NULL;
-            }
+      sources_unset_values (sources, (const gchar**) keys, n_keys, locale,
+                            modified, &err);
+      if (err != NULL)
+        {
+          gconf_log (GCL_DEBUG, "Error unsetting values in '%s': %s\n",
+                     key, err->message);
+
+          if (*first_error)
+            g_error_free (err);
+          else
+            *first_error = err;
+          err = NULL;
+        }
+
+      for (i = 0; i < n_keys; ++i)
+        {
+          char *full = keys[i];
 
           if (flags & GCONF_UNSET_INCLUDING_SCHEMA_NAMES)
             {
@@ -966,14 +2247,18 @@ recursive_unset_helper (GConfSources   *sources,
                   err = NULL;
                 }
             }
-          
-          gconf_entry_free (entry);
-          g_free (freeme);
-          
-          tmp = g_slist_next (tmp);
+
+          if (notifies)
+            {
+              *notifies = prepend_unset_notify (*notifies, modified[i], full);
+              keys[i] = NULL;
+            }
         }
 
-      g_slist_free (entries);
+      for (i = 0; i < n_keys; ++i)
+        g_free (keys[i]);
+      g_free (keys);
+      g_free (modified);
     }
 
   gconf_sources_unset_value (sources, key, locale, modifiedp, &err);
@@ -1012,6 +2297,9 @@ gconf_sources_recursive_unset (GConfSources   *sources,
   g_return_if_fail (key != NULL);
   g_return_if_fail (err == NULL || *err == NULL);
 
+  /* any key below, and any key using a schema below, may change */
+  gconf_sources_invalidate (sources, NULL);
+
   first_error = NULL;
   recursive_unset_helper (sources, key, locale, flags,
                           notifies, &first_error);
@@ -1076,6 +2364,8 @@ gconf_sources_remove_dir (GConfSources* sources,
   
   if (!gconf_key_check(dir, err))
     return;
+
+  gconf_sources_invalidate (sources, NULL);
   
   tmp = sources->sources;
 
@@ -1119,6 +2409,8 @@ gconf_sources_set_schema (GConfSources *sources,
 
   if (schema_key && !gconf_key_check (schema_key, err))
     return;
+
+  gconf_sources_invalidate (sources, key);
   
   tmp = sources->sources;
 
@@ -1138,10 +2430,10 @@ gconf_sources_set_schema (GConfSources *sources,
 /* God, this is depressingly inefficient. Maybe there's a nicer way to
    implement it... */
 /* Then we have to ship it all to the app via CORBA... */
-/* Anyway, we use a hash to be sure we have a single value for 
-   each key in the directory, and we always take that value from
-   the first source that had one set. When we're done we flatten
-   the hash.
+/* Anyway, for subdirs we use a hash to be sure we list each name
+   once no matter how many sources have it. When we're done we
+   flatten the hash. Entries are merged from sorted lists instead,
+   see gconf_sources_all_entries().
 */
 static void
 hash_listify_func(gpointer key, gpointer value, gpointer user_data)
@@ -1152,67 +2444,164 @@ hash_listify_func(gpointer key, gpointer value, gpointer user_data)
 }
 
 static void
-hash_destroy_entries_func(gpointer key, gpointer value, gpointer user_data)
+hash_destroy_pointers_func(gpointer key, gpointer value, gpointer user_data)
 {
-  GConfEntry* entry;
+  g_free(value);
+}
 
-  entry = value;
+static gint
+entry_key_compare (gconstpointer a, gconstpointer b)
+{
+  const GConfEntry *ea = a;
+  const GConfEntry *eb = b;
 
-  gconf_entry_free(entry);
+  return strcmp (ea->key, eb->key);
 }
 
-static void
-hash_destroy_pointers_func(gpointer key, gpointer value, gpointer user_data)
+static gint
+compare_strings (gconstpointer a, gconstpointer b)
 {
-  g_free(value);
+  return strcmp (a, b);
 }
 
-struct DefaultsLookupData {
-  GConfSources* sources;
-  const gchar** locales;
-};
-
+/* Look up the schemas used by entries that need a default and aren't
+ * known yet in one batch, so each source gets a single multi-key
+ * query. Schemas for keys of one directory usually live in one
+ * directory as well, sorting the names keeps those together.
+ */
 static void
-hash_lookup_defaults_func(gpointer key, gpointer value, gpointer user_data)
+prefetch_schema_defaults (GConfSources *sources,
+                          GSList       *entries,
+                          const gchar **locales)
 {
-  GConfEntry *entry = value;
-  struct DefaultsLookupData* dld = user_data;
-  GConfSources *sources = dld->sources;
-  const gchar** locales = dld->locales;
-  
-  if (gconf_entry_get_value(entry) == NULL)
+  GSList *names;
+  GSList *tmp;
+  const gchar **pending;
+  GConfValue **values;
+  gchar *locales_key;
+  guint n_pending;
+  guint i;
+  guint n;
+  GList *src;
+
+  locales_key = make_locales_key (locales, FALSE);
+
+  names = NULL;
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
     {
-      if (gconf_entry_get_schema_name(entry) != NULL)
-        {
-          GConfValue *val;
+      GConfEntry *entry = tmp->data;
+      const gchar *schema_name;
 
+      schema_name = gconf_entry_get_schema_name (entry);
 
-          val = gconf_sources_query_value(sources,
-                                          gconf_entry_get_schema_name(entry),
-                                          locales,
-                                          TRUE,
-                                          NULL,
-                                          NULL,
-                                          NULL,
-                                          NULL);
+      if (gconf_entry_get_value (entry) == NULL &&
+          schema_name != NULL &&
+          gconf_key_check (schema_name, NULL) &&
+          schema_default_lookup (sources, schema_name, locales_key) == NULL)
+        names = g_slist_prepend (names, (gchar*) schema_name);
+    }
 
-          if (val != NULL &&
-              val->type == GCONF_VALUE_SCHEMA)
-            {
-              GConfValue* defval;
+  if (names == NULL)
+    {
+      g_free (locales_key);
+      return;
+    }
+
+  names = g_slist_sort (names, compare_strings);
+
+  pending = g_new (const gchar*, g_slist_length (names));
+  n_pending = 0;
+  for (tmp = names; tmp != NULL; tmp = tmp->next)
+    {
+      if (n_pending == 0 || strcmp (pending[n_pending - 1], tmp->data) != 0)
+        pending[n_pending++] = tmp->data;
+    }
+
+  values = g_new (GConfValue*, n_pending);
+
+  for (src = sources->sources; src != NULL && n_pending > 0; src = src->next)
+    {
+      GError *error = NULL;
 
-              defval = gconf_schema_steal_default_value (gconf_value_get_schema(val));
+      gconf_source_query_values (src->data, pending, n_pending, locales,
+                                 values, NULL, &error);
 
-              gconf_entry_set_value_nocopy (entry, defval);
-              gconf_entry_set_is_default (entry, TRUE);
+      if (error != NULL)
+        {
+          /* Leave these to query_schema_default(), which can
+           * report the failure
+           */
+          g_error_free (error);
+          for (i = 0; i < n_pending; ++i)
+            {
+              if (values[i] != NULL)
+                gconf_value_free (values[i]);
             }
+          n_pending = 0;
+          break;
+        }
 
-          if (val)
-            gconf_value_free(val);
+      n = 0;
+      for (i = 0; i < n_pending; ++i)
+        {
+          if (values[i] != NULL)
+            schema_default_insert (sources, pending[i],
+                                   g_strdup (locales_key), values[i]);
+          else
+            pending[n++] = pending[i];
         }
+      n_pending = n;
     }
+
+  /* Not stored anywhere */
+  for (i = 0; i < n_pending; ++i)
+    schema_default_insert (sources, pending[i], g_strdup (locales_key), NULL);
+
+  g_free (values);
+  g_free (pending);
+  g_slist_free (names);
+  g_free (locales_key);
 }
 
+/* Fill in schema defaults for entries that have a schema name but
+ * no value. Entries in a directory frequently share a schema, and
+ * query_schema_default() keeps the defaults around, so each distinct
+ * schema only costs one lookup through the sources.
+ */
+static void
+lookup_defaults (GConfSources *sources,
+                 GSList       *entries,
+                 const gchar **locales)
+{
+  GSList *tmp;
+
+  if (sources->schema_defaults != NULL)
+    prefetch_schema_defaults (sources, entries, locales);
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+      const gchar *schema_name;
+      GConfValue *defval;
+      GConfValueType stored_type;
+
+      if (gconf_entry_get_value (entry) != NULL)
+        continue;
+
+      schema_name = gconf_entry_get_schema_name (entry);
+      if (schema_name == NULL)
+        continue;
+
+      defval = query_schema_default (sources, schema_name, locales,
+                                     &stored_type, NULL);
+
+      if (defval != NULL)
+        {
+          gconf_entry_set_value_nocopy (entry, defval);
+          gconf_entry_set_is_default (entry, TRUE);
+        }
+    }
+}
 
 static gboolean
 key_is_writable (GConfSources *sources,
@@ -1252,151 +2641,152 @@ gconf_sources_all_entries   (GConfSources* sources,
                              GError** err)
 {
   GList* tmp;
-  GHashTable* hash;
-  GSList* flattened;
-  gboolean first_pass = TRUE; /* as an optimization, don't bother
-                                 doing hash lookups on first source
-                              */
-  struct DefaultsLookupData dld = { NULL, NULL };
-  
-  dld.sources = sources;
-  dld.locales = locales;
+  GSList** heads;
+  GConfSource** srcs;
+  GSList* merged;
+  guint n_sources;
+  guint i;
 
   /* Empty GConfSources, skip it */
   if (sources->sources == NULL)
     return NULL;
 
-  hash = g_hash_table_new(g_str_hash, g_str_equal);
+  n_sources = g_list_length (sources->sources);
+  heads = g_new0 (GSList*, n_sources);
+  srcs = g_new (GConfSource*, n_sources);
 
+  i = 0;
   tmp = sources->sources;
-
   while (tmp != NULL)
     {
-      GConfSource* src;
-      GSList* pairs;
-      GSList* iter;
       GError* error = NULL;
-      
-      src   = tmp->data;
-      pairs = gconf_source_all_entries(src, dir, locales, &error);
-      iter  = pairs;
-      
+
+      srcs[i] = tmp->data;
+      heads[i] = gconf_source_all_entries (srcs[i], dir, locales, &error);
+
       /* On error, set error and bail */
       if (error != NULL)
         {
-          g_hash_table_foreach(hash, hash_destroy_entries_func, NULL);
-          
-          g_hash_table_destroy(hash);
-          
+          guint j;
+
+          for (j = 0; j < i; ++j)
+            {
+              g_slist_foreach (heads[j], (GFunc) gconf_entry_free, NULL);
+              g_slist_free (heads[j]);
+            }
+          g_free (heads);
+          g_free (srcs);
+
           if (err)
             {
-              g_return_val_if_fail(*err == NULL, NULL);
+              g_return_val_if_fail (*err == NULL, NULL);
               *err = error;
-              return NULL;
             }
           else
-            {
-              g_error_free(error);
-              return NULL;
-            }
+            g_error_free (error);
+
+          return NULL;
         }
 
-      /* Iterate over the list of entries, stuffing them in the hash
-         and setting their writability flag if they're new
-      */
-      
-      while (iter != NULL)
+      heads[i] = g_slist_sort (heads[i], entry_key_compare);
+
+      ++i;
+      tmp = g_list_next (tmp);
+    }
+
+  /* Merge the sorted lists. For each key the entry from the first
+   * source that has one is kept, and a value or schema name missing
+   * there is taken from the first later source that has it. Every
+   * source is walked exactly once; the number of sources is tiny so
+   * scanning the heads for the smallest key is cheap.
+   */
+  merged = NULL;
+  while (TRUE)
+    {
+      GConfEntry* pair;
+      const gchar* key;
+      gchar* full;
+
+      key = NULL;
+      for (i = 0; i < n_sources; ++i)
         {
-          GConfEntry* pair = iter->data;
-          GConfEntry* previous;
-          gchar *full;
-          
-          if (first_pass)
-            previous = NULL; /* Can't possibly be there. */
-          else
-            previous = g_hash_table_lookup(hash, pair->key);
-          
-          if (previous != NULL)
+          if (heads[i] != NULL &&
+              (key == NULL ||
+               strcmp (((GConfEntry*) heads[i]->data)->key, key) < 0))
+            key = ((GConfEntry*) heads[i]->data)->key;
+        }
+
+      if (key == NULL)
+        break;
+
+      pair = NULL;
+      for (i = 0; i < n_sources; ++i)
+        {
+          /* A backend shouldn't return a key twice, but fold any
+           * duplicates like we would for separate sources.
+           */
+          while (heads[i] != NULL &&
+                 strcmp (((GConfEntry*) heads[i]->data)->key, key) == 0)
             {
-              if (gconf_entry_get_value (previous) != NULL)
-                /* Discard this latest one */
-                ;
-              else
+              GConfEntry* next = heads[i]->data;
+
+              heads[i] = g_slist_delete_link (heads[i], heads[i]);
+
+              if (pair == NULL)
                 {
-                  /* Save the new value, previously we had an entry but no value */
-                  gconf_entry_set_value_nocopy (previous,
-                                                gconf_entry_steal_value(pair));
+                  pair = next;
+                  key = pair->key;
 
                   /* As an efficiency hack, remember that
                    * entry->key is relative not absolute on the
                    * gconfd side
                    */
-                  full = gconf_concat_dir_and_key (dir, previous->key);
-
-                  gconf_entry_set_is_writable (previous,
+                  full = gconf_concat_dir_and_key (dir, pair->key);
+                  gconf_entry_set_is_writable (pair,
                                                key_is_writable (sources,
-                                                                src,
+                                                                srcs[i],
                                                                 full,
                                                                 NULL));
-
                   g_free (full);
+                  continue;
                 }
-              
-              if (gconf_entry_get_schema_name (previous) != NULL)
-                /* Discard this latest one */
-                ;
-              else
+
+              if (gconf_entry_get_value (pair) == NULL &&
+                  gconf_entry_get_value (next) != NULL)
                 {
-                  /* Save the new schema name, previously we had an entry but no schema name*/
-                  if (gconf_entry_get_schema_name (pair) != NULL)
-                    {
-                      gconf_entry_set_schema_name (previous,
-                                                   gconf_entry_get_schema_name (pair));
-                    }
+                  /* Save the new value, previously we had an entry but no value */
+                  gconf_entry_set_value_nocopy (pair,
+                                                gconf_entry_steal_value (next));
+
+                  full = gconf_concat_dir_and_key (dir, pair->key);
+                  gconf_entry_set_is_writable (pair,
+                                               key_is_writable (sources,
+                                                                srcs[i],
+                                                                full,
+                                                                NULL));
+                  g_free (full);
                 }
 
-              gconf_entry_free(pair);
-            }
-          else
-            {
-              /* Save */
-              g_hash_table_insert(hash, pair->key, pair);
-              
-              /* As an efficiency hack, remember that
-               * entry->key is relative not absolute on the
-               * gconfd side
-               */
-              full = gconf_concat_dir_and_key (dir, pair->key);
-
-              gconf_entry_set_is_writable (pair,
-                                           key_is_writable (sources,
-                                                            src,
-                                                            full,
-                                                            NULL));
-              
-              g_free (full);
-            }
+              if (gconf_entry_get_schema_name (pair) == NULL &&
+                  gconf_entry_get_schema_name (next) != NULL)
+                gconf_entry_set_schema_name (pair,
+                                             gconf_entry_get_schema_name (next));
 
-          iter = g_slist_next(iter);
+              gconf_entry_free (next);
+            }
         }
-      
-      /* All pairs are either stored or destroyed. */
-      g_slist_free(pairs);
-
-      first_pass = FALSE;
 
-      tmp = g_list_next(tmp);
+      merged = g_slist_prepend (merged, pair);
     }
 
-  flattened = NULL;
+  g_free (heads);
+  g_free (srcs);
 
-  g_hash_table_foreach(hash, hash_lookup_defaults_func, &dld);
-  
-  g_hash_table_foreach(hash, hash_listify_func, &flattened);
+  merged = g_slist_reverse (merged);
 
-  g_hash_table_destroy(hash);
-  
-  return flattened;
+  lookup_defaults (sources, merged, locales);
+
+  return merged;
 }
 
 GSList*       
@@ -1620,6 +3010,7 @@ gconf_sources_query_default_value(GConfSources* sources,
   GError* error = NULL;
   GConfValue* val;
   GConfMetaInfo* mi;
+  GConfValueType stored_type;
   
   g_return_val_if_fail(err == NULL || *err == NULL, NULL);
 
@@ -1649,62 +3040,34 @@ gconf_sources_query_default_value(GConfSources* sources,
       return NULL;
     }
       
-  val = gconf_sources_query_value(sources,
-                                  gconf_meta_info_get_schema(mi), locales,
-                                  TRUE, NULL, NULL, NULL, &error);
-  
-  if (val != NULL)
-    {
-      GConfSchema* schema;
+  val = query_schema_default (sources, gconf_meta_info_get_schema(mi),
+                              locales, &stored_type, &error);
 
-      if (val->type != GCONF_VALUE_SCHEMA)
+  if (error != NULL)
+    {
+      if (err)
+        *err = error;
+      else
         {
-          gconf_log(GCL_WARNING,
-                    _("Key `%s' listed as schema for key `%s' actually stores type `%s'"),
+          gconf_log(GCL_ERR, _("Error getting value for `%s': %s"),
                     gconf_meta_info_get_schema(mi),
-                    key,
-                    gconf_value_type_to_string(val->type));
-
-          gconf_meta_info_free(mi);
-          return NULL;
-        }
-
-      gconf_meta_info_free(mi);
-
-      schema = gconf_value_steal_schema (val);
-      gconf_value_free (val);
-      
-      if (schema != NULL)
-        {
-          GConfValue* retval;
-
-          retval = gconf_schema_steal_default_value (schema);
-
-          gconf_schema_free (schema);
-          
-          return retval;
+                    error->message);
+          g_error_free(error);
         }
-      return NULL;
     }
-  else
+  else if (stored_type != GCONF_VALUE_INVALID &&
+           stored_type != GCONF_VALUE_SCHEMA)
     {
-      if (error != NULL)
-        {
-          if (err)
-            *err = error;
-          else
-            {
-              gconf_log(GCL_ERR, _("Error getting value for `%s': %s"),
-                        gconf_meta_info_get_schema(mi),
-                        error->message);
-              g_error_free(error);
-            }
-        }
-      
-      gconf_meta_info_free(mi);
-      
-      return NULL;
+      gconf_log(GCL_WARNING,
+                _("Key `%s' listed as schema for key `%s' actually stores type `%s'"),
+                gconf_meta_info_get_schema(mi),
+                key,
+                gconf_value_type_to_string(stored_type));
     }
+
+  gconf_meta_info_free(mi);
+
+  return val;
 }
 
 void
@@ -1721,6 +3084,39 @@ gconf_sources_set_notify_func (GConfSources          *sources,
 
       tmp = tmp->next;
     }
+
+  /* Whoever gets told about changes in the backends is able to
+   * keep a cache of resolved values up to date, by calling
+   * gconf_sources_invalidate(). That only works if every backend
+   * in the stack reports external edits; otherwise, such as for
+   * the old XML backend, don't cache.
+   */
+  if (notify_func != NULL && all_sources_notify_changes (sources))
+    {
+      if (sources->value_cache == NULL)
+        value_cache_create (sources);
+    }
+  else
+    value_cache_destroy (sources);
+}
+
+static gboolean
+all_sources_notify_changes (GConfSources *sources)
+{
+  GList *tmp;
+
+  tmp = sources->sources;
+  while (tmp != NULL)
+    {
+      GConfSource *source = tmp->data;
+
+      if (!(source->flags & GCONF_SOURCE_NOTIFIES_CHANGES))
+        return FALSE;
+
+      tmp = tmp->next;
+    }
+
+  return TRUE;
 }
 
 void
@@ -38,6 +38,10 @@ struct _GConfSource {
   guint flags;
   gchar* address;
   GConfBackend* backend;
+  /* What the backend told us about writability, by namespace
+   * section; private to gconf-sources.c
+   */
+  gpointer writable_map;
 };
 
 typedef enum {
@@ -48,6 +52,12 @@ typedef enum {
   GCONF_SOURCE_ALL_WRITEABLE = 1 << 0,
   GCONF_SOURCE_ALL_READABLE = 1 << 1,
   GCONF_SOURCE_NEVER_WRITEABLE = 1 << 2, 
+  /* While a notify func is set, every change made behind the
+   * backend's back is reported through it, so values resolved
+   * from the source can be cached. The backend clears it again
+   * if it loses track of changes.
+   */
+  GCONF_SOURCE_NOTIFIES_CHANGES = 1 << 3,
   GCONF_SOURCE_ALL_FLAGS = ((1 << 0) | (1 << 1))
 } GConfSourceFlags;
 
@@ -55,6 +65,11 @@ typedef void (* GConfSourceNotifyFunc) (GConfSource *source,
 					const gchar *location,
 					gpointer     user_data);
 
+/* Called once a source finished fetching something, see prepare_read
+ * in GConfBackendVTable
+ */
+typedef void (* GConfSourceReadyFunc)  (gpointer     user_data);
+
 GConfSource*  gconf_resolve_address         (const gchar* address,
                                              GError** err);
 
@@ -65,6 +80,12 @@ typedef struct _GConfSources GConfSources;
 
 struct _GConfSources {
   GList* sources;
+  /* Resolved values, see gconf_sources_query_value(); NULL for
+   * stacks that don't cache.
+   */
+  GHashTable* value_cache;
+  GHashTable* schema_users;
+  GHashTable* schema_defaults;
 };
 
 typedef struct
@@ -82,6 +103,19 @@ GConfSources* gconf_sources_new_from_addresses (GSList* addresses,
 GConfSources* gconf_sources_new_from_source    (GConfSource   *source);
 void          gconf_sources_free               (GConfSources  *sources);
 void          gconf_sources_clear_cache        (GConfSources  *sources);
+/* Drop cached values for key, or for all keys if key is NULL */
+void          gconf_sources_invalidate         (GConfSources  *sources,
+                                                const gchar   *key);
+gboolean      gconf_sources_prepare_read       (GConfSources  *sources,
+                                                const gchar   *key,
+                                                GConfSourceReadyFunc ready_func,
+                                                gpointer       user_data);
+
+/* The values returned by gconf_sources_query_value(),
+ * gconf_sources_query_default_value() and gconf_sources_all_entries()
+ * may be shared with the cache; use gconf_value_make_writable()
+ * before changing them.
+ */
 GConfValue*   gconf_sources_query_value        (GConfSources  *sources,
                                                 const gchar   *key,
                                                 const gchar  **locales,
@@ -95,6 +129,12 @@ void          gconf_sources_set_value          (GConfSources  *sources,
                                                 const GConfValue *value,
 						GConfSources **modified_sources,
                                                 GError   **err);
+void          gconf_sources_set_values         (GConfSources  *sources,
+                                                const gchar  **keys,
+                                                GConfValue * const *values,
+                                                guint          n_keys,
+                                                GConfSources **modified_sources,
+                                                GError       **errors);
 void          gconf_sources_unset_value        (GConfSources  *sources,
                                                 const gchar   *key,
                                                 const gchar   *locale,
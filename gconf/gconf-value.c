@@ -27,6 +27,8 @@
 
 typedef struct {
   GConfValueType type;
+  /* values with more than one reference are shared and immutable */
+  guint refcount;
   union {
     gchar* string_data;
     gint int_data;
@@ -35,7 +37,10 @@ typedef struct {
     GConfSchema* schema_data;
     struct {
       GConfValueType type;
+      guint length;
       GSList* list;
+      /* the elements of list, for indexed access; built on demand */
+      GConfValue** elems;
     } list_data;
     struct {
       GConfValue* car;
@@ -46,6 +51,33 @@ typedef struct {
 
 #define REAL_VALUE(x) ((GConfRealValue*)(x))
 
+#define VALUE_IS_WRITABLE(x) (REAL_VALUE (x)->refcount == 1)
+
+static void
+list_index_clear (GConfRealValue *real)
+{
+  g_free (real->d.list_data.elems);
+  real->d.list_data.elems = NULL;
+  real->d.list_data.length = 0;
+}
+
+static void
+list_index_ensure (GConfRealValue *real)
+{
+  GSList *tmp;
+  guint i;
+
+  if (real->d.list_data.elems != NULL ||
+      real->d.list_data.list == NULL)
+    return;
+
+  real->d.list_data.length = g_slist_length (real->d.list_data.list);
+  real->d.list_data.elems = g_new (GConfValue*, real->d.list_data.length);
+
+  for (tmp = real->d.list_data.list, i = 0; tmp != NULL; tmp = tmp->next, ++i)
+    real->d.list_data.elems[i] = tmp->data;
+}
+
 static void
 set_string(gchar** dest, const gchar* src)
 {
@@ -76,6 +108,7 @@ gconf_value_new(GConfValueType type)
   value = (GConfValue*) g_slice_new0 (GConfRealValue);
 
   value->type = type;
+  REAL_VALUE (value)->refcount = 1;
 
   /* the g_new0() is important: sets list type to invalid, NULLs all
    * pointers
@@ -791,6 +824,40 @@ gconf_value_free_list(GConfValue* value)
   g_slist_free(real->d.list_data.list);
 
   real->d.list_data.list = NULL;
+  list_index_clear (real);
+}
+
+GConfValue*
+gconf_value_ref (GConfValue *value)
+{
+  g_return_val_if_fail (value != NULL, NULL);
+  g_return_val_if_fail (REAL_VALUE (value)->refcount > 0, NULL);
+
+  REAL_VALUE (value)->refcount += 1;
+
+  return value;
+}
+
+void
+gconf_value_unref (GConfValue *value)
+{
+  gconf_value_free (value);
+}
+
+GConfValue*
+gconf_value_make_writable (GConfValue *value)
+{
+  GConfValue *copy;
+
+  g_return_val_if_fail (value != NULL, NULL);
+
+  if (VALUE_IS_WRITABLE (value))
+    return value;
+
+  copy = gconf_value_copy (value);
+  gconf_value_unref (value);
+
+  return copy;
 }
 
 void 
@@ -801,6 +868,12 @@ gconf_value_free(GConfValue* value)
   g_return_if_fail(value != NULL);
 
   real = REAL_VALUE (value);
+
+  g_return_if_fail (real->refcount > 0);
+
+  real->refcount -= 1;
+  if (real->refcount > 0)
+    return;
   
   switch (real->type)
     {
@@ -846,6 +919,7 @@ gconf_value_steal_string (GConfValue *value)
   
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_STRING, NULL);
+  g_return_val_if_fail (VALUE_IS_WRITABLE (value), NULL);
 
   real = REAL_VALUE (value);
 
@@ -891,6 +965,39 @@ gconf_value_get_list (const GConfValue *value)
   return REAL_VALUE (value)->d.list_data.list;
 }
 
+guint
+gconf_value_get_list_length (const GConfValue *value)
+{
+  GConfRealValue *real;
+
+  g_return_val_if_fail (value != NULL, 0);
+  g_return_val_if_fail (value->type == GCONF_VALUE_LIST, 0);
+
+  /* the index is a cache, so it's fine to build it on a const value */
+  real = REAL_VALUE (value);
+  list_index_ensure (real);
+
+  return real->d.list_data.length;
+}
+
+GConfValue*
+gconf_value_get_list_nth (const GConfValue *value,
+                          guint             n)
+{
+  GConfRealValue *real;
+
+  g_return_val_if_fail (value != NULL, NULL);
+  g_return_val_if_fail (value->type == GCONF_VALUE_LIST, NULL);
+
+  real = REAL_VALUE (value);
+  list_index_ensure (real);
+
+  if (n >= real->d.list_data.length)
+    return NULL;
+
+  return real->d.list_data.elems[n];
+}
+
 GSList*
 gconf_value_steal_list (GConfValue *value)
 {
@@ -899,11 +1006,13 @@ gconf_value_steal_list (GConfValue *value)
   
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_LIST, NULL);
+  g_return_val_if_fail (VALUE_IS_WRITABLE (value), NULL);
 
   real = REAL_VALUE (value);
 
   list = real->d.list_data.list;
   real->d.list_data.list = NULL;
+  list_index_clear (real);
   return list;
 }
 
@@ -952,6 +1061,7 @@ gconf_value_steal_schema (GConfValue *value)
   
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_SCHEMA, NULL);
+  g_return_val_if_fail (VALUE_IS_WRITABLE (value), NULL);
 
   real = REAL_VALUE (value);
 
@@ -966,6 +1076,7 @@ gconf_value_set_int(GConfValue* value, gint the_int)
 {
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_INT);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
 
   REAL_VALUE (value)->d.int_data = the_int;
 }
@@ -985,6 +1096,7 @@ gconf_value_set_string_nocopy (GConfValue *value,
 
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_STRING);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
 
   real = REAL_VALUE (value);
 
@@ -997,6 +1109,7 @@ gconf_value_set_float(GConfValue* value, gdouble the_float)
 {
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_FLOAT);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
 
   REAL_VALUE (value)->d.float_data = the_float;
 }
@@ -1006,6 +1119,7 @@ gconf_value_set_bool(GConfValue* value, gboolean the_bool)
 {
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_BOOL);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
 
   REAL_VALUE (value)->d.bool_data = the_bool;
 }
@@ -1017,6 +1131,7 @@ gconf_value_set_schema(GConfValue* value, const GConfSchema* sc)
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_SCHEMA);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
 
   real = REAL_VALUE (value);
   
@@ -1033,6 +1148,7 @@ gconf_value_set_schema_nocopy(GConfValue* value, GConfSchema* sc)
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_SCHEMA);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
   g_return_if_fail(sc != NULL);
 
   real = REAL_VALUE (value);
@@ -1056,6 +1172,7 @@ gconf_value_set_car_nocopy(GConfValue* value, GConfValue* car)
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_PAIR);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
 
   real = REAL_VALUE (value);
   
@@ -1078,6 +1195,7 @@ gconf_value_set_cdr_nocopy(GConfValue* value, GConfValue* cdr)
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_PAIR);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
 
   real = REAL_VALUE (value);
   
@@ -1095,6 +1213,7 @@ gconf_value_set_list_type (GConfValue    *value,
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_LIST);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
   g_return_if_fail(type != GCONF_VALUE_LIST);
   g_return_if_fail(type != GCONF_VALUE_PAIR);
 
@@ -1117,6 +1236,7 @@ gconf_value_set_list_nocopy (GConfValue* value,
   
   g_return_if_fail (value != NULL);
   g_return_if_fail (value->type == GCONF_VALUE_LIST);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
 
   real = REAL_VALUE (value);
   
@@ -1136,6 +1256,7 @@ gconf_value_set_list       (GConfValue* value,
   
   g_return_if_fail (value != NULL);
   g_return_if_fail (value->type == GCONF_VALUE_LIST);
+  g_return_if_fail (VALUE_IS_WRITABLE (value));
 
   real = REAL_VALUE (value);
 
@@ -1363,7 +1484,7 @@ gconf_meta_info_new(void)
 {
   GConfMetaInfo* gcmi;
 
-  gcmi = g_new0(GConfMetaInfo, 1);
+  gcmi = g_slice_new0 (GConfMetaInfo);
 
   /* pointers and time are NULL/0 */
   
@@ -1375,7 +1496,7 @@ gconf_meta_info_free(GConfMetaInfo* gcmi)
 {
   g_free(gcmi->schema);
   g_free(gcmi->mod_user);
-  g_free(gcmi);
+  g_slice_free (GConfMetaInfo, gcmi);
 }
 
 const char*
@@ -1518,6 +1639,26 @@ gconf_entry_copy (const GConfEntry *src)
   return entry;
 }
 
+GConfEntry*
+gconf_entry_copy_shared (const GConfEntry *src)
+{
+  GConfEntry *entry;
+  GConfRealEntry *real;
+  GConfValue *value;
+
+  value = REAL_ENTRY (src)->value;
+  
+  entry = gconf_entry_new_nocopy (g_strdup (REAL_ENTRY (src)->key),
+                                  value ? gconf_value_ref (value) : NULL);
+  real = REAL_ENTRY (entry);
+  
+  real->schema_name = g_strdup (REAL_ENTRY (src)->schema_name);
+  real->is_default = REAL_ENTRY (src)->is_default;
+  real->is_writable = REAL_ENTRY (src)->is_writable;
+
+  return entry;
+}
+
 gboolean
 gconf_entry_equal (const GConfEntry *a,
                    const GConfEntry *b)
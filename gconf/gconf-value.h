@@ -64,6 +64,10 @@ int            gconf_value_get_int       (const GConfValue *value);
 double         gconf_value_get_float     (const GConfValue *value);
 GConfValueType gconf_value_get_list_type (const GConfValue *value);
 GSList*        gconf_value_get_list      (const GConfValue *value);
+/* constant time after the first call on a value */
+guint          gconf_value_get_list_length (const GConfValue *value);
+GConfValue*    gconf_value_get_list_nth  (const GConfValue *value,
+                                          guint             n);
 GConfValue*    gconf_value_get_car       (const GConfValue *value);
 GConfValue*    gconf_value_get_cdr       (const GConfValue *value);
 gboolean       gconf_value_get_bool      (const GConfValue *value);
@@ -79,6 +83,15 @@ GConfValue* gconf_value_new_from_string      (GConfValueType type,
 GConfValue* gconf_value_copy                 (const GConfValue* src);
 void        gconf_value_free                 (GConfValue* value);
 
+/* Values can also be shared: gconf_value_free() drops one reference.
+ * A value with more than one reference can't be modified; call
+ * gconf_value_make_writable() first, which returns the value itself
+ * if it isn't shared, or a copy after dropping a reference to it.
+ */
+GConfValue* gconf_value_ref                  (GConfValue* value);
+void        gconf_value_unref                (GConfValue* value);
+GConfValue* gconf_value_make_writable        (GConfValue* value);
+
 void        gconf_value_set_int              (GConfValue* value,
                                               gint the_int);
 void        gconf_value_set_string           (GConfValue* value,
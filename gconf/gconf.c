@@ -1284,6 +1284,61 @@ gconf_engine_set (GConfEngine* conf, const gchar* key,
   return TRUE;
 }
 
+gboolean
+gconf_engine_set_values (GConfEngine* conf, const gchar** keys,
+                         GConfValue* const* values, guint n_keys,
+                         GError** errors)
+{
+  gboolean retval;
+  guint i;
+
+  g_return_val_if_fail(conf != NULL, FALSE);
+  g_return_val_if_fail(keys != NULL || n_keys == 0, FALSE);
+  g_return_val_if_fail(values != NULL || n_keys == 0, FALSE);
+
+  CHECK_OWNER_USE (conf);
+
+  if (gconf_engine_is_local(conf))
+    {
+      GError** local_errors;
+
+      /* Invalid keys and values are reported per key there too */
+      local_errors = errors != NULL ? errors : g_new0(GError*, n_keys);
+
+      gconf_sources_set_values(conf->local_sources, keys, values, n_keys,
+                               NULL, local_errors);
+
+      retval = TRUE;
+      for (i = 0; i < n_keys; ++i)
+        {
+          if (local_errors[i] != NULL)
+            {
+              retval = FALSE;
+              if (errors == NULL)
+                g_error_free(local_errors[i]);
+            }
+        }
+
+      if (errors == NULL)
+        g_free(local_errors);
+
+      return retval;
+    }
+
+  /* gconf_engine_set() checks each key and value, so an invalid one
+   * only fails itself
+   */
+  retval = TRUE;
+  for (i = 0; i < n_keys; ++i)
+    {
+      if (!gconf_engine_set(conf, keys[i], values[i],
+                            errors != NULL ? &errors[i] : NULL))
+        retval = FALSE;
+    }
+
+  return retval;
+}
+
 gboolean
 gconf_engine_unset (GConfEngine* conf, const gchar* key, GError** err)
 {
@@ -2580,11 +2635,57 @@ gconf_is_initialized (void)
 
 static const gchar invalid_chars[] = " \t\r\n\"$&<>,+=#!()'|{}[]?~`;%\\";
 
+enum {
+  KEY_CHAR_OK,
+  KEY_CHAR_SLASH,
+  KEY_CHAR_PERIOD,
+  KEY_CHAR_INVALID,
+  KEY_CHAR_NOT_ASCII,
+  KEY_CHAR_END
+};
+
+#define O KEY_CHAR_OK
+#define S KEY_CHAR_SLASH
+#define P KEY_CHAR_PERIOD
+#define I KEY_CHAR_INVALID
+#define N KEY_CHAR_NOT_ASCII
+#define E KEY_CHAR_END
+
+/* Class of each byte, so the common case of a valid key is one
+ * table lookup per character. The I entries must match
+ * invalid_chars above.
+ */
+static const guchar key_char_class[256] = {
+  E, O, O, O, O, O, O, O, O, I, I, O, O, I, O, O, /* 0x00 */
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* 0x10 */
+  I, I, I, I, I, I, I, I, I, I, O, I, I, O, P, S, /* 0x20 */
+  O, O, O, O, O, O, O, O, O, O, O, I, I, I, I, I, /* 0x30 */
+  O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* 0x40 */
+  O, O, O, O, O, O, O, O, O, O, O, I, I, I, O, O, /* 0x50 */
+  I, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* 0x60 */
+  O, O, O, O, O, O, O, O, O, O, O, I, I, I, I, O, /* 0x70 */
+  N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, /* 0x80 */
+  N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, /* 0x90 */
+  N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, /* 0xa0 */
+  N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, /* 0xb0 */
+  N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, /* 0xc0 */
+  N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, /* 0xd0 */
+  N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, /* 0xe0 */
+  N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N  /* 0xf0 */
+};
+
+#undef O
+#undef S
+#undef P
+#undef I
+#undef N
+#undef E
+
 gboolean     
 gconf_valid_key      (const gchar* key, gchar** why_invalid)
 {
-  const gchar* s = key;
-  gboolean just_saw_slash = FALSE;
+  const guchar* s = (const guchar*) key;
+  gboolean just_saw_slash;
 
   /* Key must start with the root */
   if (*key != '/')
@@ -2595,73 +2696,69 @@ gconf_valid_key      (const gchar* key, gchar** why_invalid)
     }
   
   /* Root key is a valid dir */
-  if (*key == '/' && key[1] == '\0')
+  if (key[1] == '\0')
     return TRUE;
 
-  while (*s)
+  just_saw_slash = TRUE;
+  ++s;
+
+  while (TRUE)
     {
-      if (just_saw_slash)
+      switch (key_char_class[*s])
         {
-          /* Can't have two slashes in a row, since it would mean
-           * an empty spot.
-           * Can't have a period right after a slash,
+        case KEY_CHAR_OK:
+          just_saw_slash = FALSE;
+          break;
+
+        case KEY_CHAR_PERIOD:
+          /* Can't have a period right after a slash,
            * because it would be a pain for filesystem-based backends.
            */
-          if (*s == '/' || *s == '.')
+          if (just_saw_slash)
             {
               if (why_invalid != NULL)
-                {
-                  if (*s == '/')
-                    *why_invalid = g_strdup(_("Can't have two slashes (/) in a row"));
-                  else
-                    *why_invalid = g_strdup(_("Can't have a period (.) right after a slash (/)"));
-                }
+                *why_invalid = g_strdup(_("Can't have a period (.) right after a slash (/)"));
               return FALSE;
             }
-        }
-
-      if (*s == '/')
-        {
-          just_saw_slash = TRUE;
-        }
-      else
-        {
-          const gchar* inv = invalid_chars;
+          break;
 
-          just_saw_slash = FALSE;
-          
-          if (((unsigned char)*s) > 127)
+        case KEY_CHAR_SLASH:
+          /* Can't have two slashes in a row, since it would mean
+           * an empty spot.
+           */
+          if (just_saw_slash)
             {
               if (why_invalid != NULL)
-                *why_invalid = g_strdup_printf (_("'%c' is not an ASCII character, so isn't allowed in key names"),
-                                                *s);
+                *why_invalid = g_strdup(_("Can't have two slashes (/) in a row"));
               return FALSE;
             }
-          
-          while (*inv)
+          just_saw_slash = TRUE;
+          break;
+
+        case KEY_CHAR_INVALID:
+          if (why_invalid != NULL)
+            *why_invalid = g_strdup_printf(_("`%c' is an invalid character in key/directory names"), *s);
+          return FALSE;
+
+        case KEY_CHAR_NOT_ASCII:
+          if (why_invalid != NULL)
+            *why_invalid = g_strdup_printf (_("'%c' is not an ASCII character, so isn't allowed in key names"),
+                                            *s);
+          return FALSE;
+
+        case KEY_CHAR_END:
+          /* Can't end with slash */
+          if (just_saw_slash)
             {
-              if (*inv == *s)
-                {
-                  if (why_invalid != NULL)
-                    *why_invalid = g_strdup_printf(_("`%c' is an invalid character in key/directory names"), *s);
-                  return FALSE;
-                }
-              ++inv;
+              if (why_invalid != NULL)
+                *why_invalid = g_strdup(_("Key/directory may not end with a slash (/)"));
+              return FALSE;
             }
+          return TRUE;
         }
 
       ++s;
     }
-
-  /* Can't end with slash */
-  if (just_saw_slash)
-    {
-      if (why_invalid != NULL)
-        *why_invalid = g_strdup(_("Key/directory may not end with a slash (/)"));
-      return FALSE;
-    }
-  else
-    return TRUE;
 }
 
 /**
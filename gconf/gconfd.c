@@ -1238,6 +1238,9 @@ gconfd_notify_other_listeners (GConfDatabase *modified_db,
 	{
 	  GList *tmp2;
 
+	  /* The backend may be shared with modified_db */
+	  gconf_sources_invalidate (db->sources, key);
+
 	  tmp2 = modified_sources->sources;
 	  while (tmp2)
 	    {
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <libxml/tree.h>
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 #include <libxml/globals.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -1984,7 +1985,7 @@ do_get_list_size(GConfEngine* conf, const gchar** args)
       return 1;
     }
 
-  g_print ("%u\n", g_slist_length (gconf_value_get_list (list)));
+  g_print ("%u\n", gconf_value_get_list_length (list));
 
   return 0;
 }
@@ -1994,7 +1995,6 @@ do_get_list_element(GConfEngine* conf, const gchar** args)
 {
   GError* err = NULL;
   GConfValue *list = NULL, *element = NULL;
-  GSList *iter = NULL;
   gchar* s = NULL;
   int idx = 0;
 
@@ -2042,8 +2042,7 @@ do_get_list_element(GConfEngine* conf, const gchar** args)
       return 1;
     }
 
-  iter = gconf_value_get_list (list);
-  element = g_slist_nth_data (iter, idx);
+  element = gconf_value_get_list_nth (list, idx);
 
   if (element == NULL)
     {
@@ -2861,6 +2860,102 @@ typedef struct {
   GConfValue* value;
 } EntryInfo;
 
+/* Values waiting to be set together with gconf_engine_set_values() */
+typedef struct {
+  gchar* key;
+  GConfValue* value;
+} QueuedValue;
+
+static void
+queue_value_nocopy(GArray* batch, gchar* key, GConfValue* value)
+{
+  QueuedValue qv;
+
+  qv.key = key;
+  qv.value = value;
+
+  g_array_append_val(batch, qv);
+}
+
+/* errors is an array of batch->len NULL errors, see
+ * gconf_engine_set_values()
+ */
+static gboolean
+set_queued_values(GConfEngine* conf, GArray* batch, GError** errors)
+{
+  const gchar** keys;
+  GConfValue** values;
+  gboolean retval;
+  guint i;
+
+  keys = g_new(const gchar*, batch->len);
+  values = g_new(GConfValue*, batch->len);
+
+  for (i = 0; i < batch->len; i++)
+    {
+      keys[i] = g_array_index(batch, QueuedValue, i).key;
+      values[i] = g_array_index(batch, QueuedValue, i).value;
+    }
+
+  retval = gconf_engine_set_values(conf, keys, values, batch->len, errors);
+
+  g_free(keys);
+  g_free(values);
+
+  return retval;
+}
+
+static void
+clear_queued_values(GArray* batch)
+{
+  guint i;
+
+  for (i = 0; i < batch->len; i++)
+    {
+      g_free(g_array_index(batch, QueuedValue, i).key);
+      gconf_value_free(g_array_index(batch, QueuedValue, i).value);
+    }
+
+  g_array_set_size(batch, 0);
+}
+
+/* While loading an entry file, values are queued here and set
+ * ENTRY_BATCH_SIZE at a time by flush_entry_batch().
+ */
+#define ENTRY_BATCH_SIZE 256
+
+static GArray* entry_batch = NULL;
+
+static void
+flush_entry_batch(GConfEngine* conf)
+{
+  GError** errors;
+  guint i;
+
+  if (entry_batch->len == 0)
+    return;
+
+  errors = g_new0(GError*, entry_batch->len);
+
+  if (!set_queued_values(conf, entry_batch, errors))
+    {
+      for (i = 0; i < entry_batch->len; i++)
+        {
+          if (errors[i] == NULL)
+            continue;
+
+          g_printerr (_("Error setting value for `%s': %s\n"),
+                      g_array_index(entry_batch, QueuedValue, i).key,
+                      errors[i]->message);
+          g_error_free(errors[i]);
+        }
+    }
+
+  g_free(errors);
+
+  clear_queued_values(entry_batch);
+}
+
 static void
 set_values(GConfEngine* conf, gboolean unload, const gchar* base_dir, const gchar* key, const char* schema_key, GSList* values)
 {
@@ -2904,7 +2999,18 @@ set_values(GConfEngine* conf, gboolean unload, const gchar* base_dir, const gcha
       GError* error;
 
       error = NULL;
-      if (!unload)
+      if (!unload && entry_batch != NULL)
+        {
+          /* A bad key or value only fails its own entry; see
+           * flush_entry_batch()
+           */
+          queue_value_nocopy(entry_batch, g_strdup(full_key),
+                             gconf_value_copy(value));
+
+          if (entry_batch->len >= ENTRY_BATCH_SIZE)
+            flush_entry_batch(conf);
+        }
+      else if (!unload)
         gconf_engine_set(conf, full_key, value, &error);
       else
         gconf_engine_unset(conf, full_key, &error);
@@ -3528,6 +3634,92 @@ get_schema_from_xml(xmlNodePtr node, gchar **schema_key, GHashTable** schemas_ha
   return 0;
 }
 
+/* While installing schema files with --makefile-install-rule, the
+ * schemas of a file are queued here and installed in one batch by
+ * flush_schema_batch(), instead of one request per key and locale.
+ */
+static GArray* schema_batch = NULL;
+
+static void
+queue_schema(const gchar* key, GConfSchema* schema)
+{
+  GConfValue* value;
+
+  value = gconf_value_new(GCONF_VALUE_SCHEMA);
+  gconf_value_set_schema_nocopy(value, schema);
+
+  queue_value_nocopy(schema_batch, g_strdup(key), value);
+}
+
+static gsize
+key_dir_len(const gchar* key)
+{
+  const gchar* slash = strrchr(key, '/');
+
+  /* invalid keys are rejected when the batch is set */
+  return slash ? slash - key : 0;
+}
+
+/* Orders keys by their directory first, so all keys of a directory
+ * reach the backend as one run.
+ */
+static int
+compare_queued_schemas(const void* a, const void* b)
+{
+  const gchar* key_a = ((const QueuedValue*) a)->key;
+  const gchar* key_b = ((const QueuedValue*) b)->key;
+  gsize dir_len_a = key_dir_len(key_a);
+  gsize dir_len_b = key_dir_len(key_b);
+  int result;
+
+  result = strncmp(key_a, key_b, MIN(dir_len_a, dir_len_b));
+  if (result != 0)
+    return result;
+
+  if (dir_len_a != dir_len_b)
+    return dir_len_a < dir_len_b ? -1 : 1;
+
+  return strcmp(key_a, key_b);
+}
+
+static void
+flush_schema_batch(GConfEngine* conf)
+{
+  GError** errors;
+  guint i;
+
+  if (schema_batch->len == 0)
+    return;
+
+  qsort(schema_batch->data, schema_batch->len, sizeof(QueuedValue),
+        compare_queued_schemas);
+
+  errors = g_new0(GError*, schema_batch->len);
+
+  set_queued_values(conf, schema_batch, errors);
+
+  for (i = 0; i < schema_batch->len; i++)
+    {
+      QueuedValue* qv = &g_array_index(schema_batch, QueuedValue, i);
+      GConfSchema* schema = gconf_value_get_schema(qv->value);
+
+      if (errors[i] != NULL)
+        {
+          g_printerr (_("WARNING: failed to install schema `%s' locale `%s': %s\n"),
+                      qv->key, gconf_schema_get_locale(schema),
+                      errors[i]->message);
+          g_error_free(errors[i]);
+        }
+      else
+        g_print (_("Installed schema `%s' for locale `%s'\n"),
+                 qv->key, gconf_schema_get_locale(schema));
+    }
+
+  g_free(errors);
+
+  clear_queued_values(schema_batch);
+}
+
 static void
 hash_install_foreach(gpointer key, gpointer value, gpointer user_data)
 {
@@ -3542,6 +3734,13 @@ hash_install_foreach(gpointer key, gpointer value, gpointer user_data)
   info = user_data;
   schema = value;
 
+  if (!info->unload && schema_batch != NULL)
+    {
+      /* the queue takes over the schema */
+      queue_schema(info->key, schema);
+      return;
+    }
+
   if (!info->unload)
     {
       if (!gconf_engine_set_schema(info->conf, info->key, schema, &error))
@@ -3668,6 +3867,131 @@ process_list(GConfEngine* conf, LoadType load_type, gboolean unload, xmlNodePtr
 #undef LOAD_TYPE_TO_LIST
 }
 
+/* Loads an entry file without building the whole document: each
+ * <entry> is expanded on its own, handed to process_entry() and freed
+ * again, and the values are set in batches as they are read.
+ */
+static int
+load_entry_file(GConfEngine* conf, gboolean unload, const gchar* file, const gchar** base_dirs)
+{
+  xmlTextReaderPtr reader;
+  xmlChar* orig_base = NULL;
+  gboolean seen_root = FALSE;
+  int retval = 0;
+  int ret;
+  /* file comes from the command line, is thus in locale charset */
+  gchar *utf8_file = g_locale_to_utf8 (file, -1, NULL, NULL, NULL);
+
+  errno = 0;
+  reader = xmlNewTextReaderFilename(file);
+
+  if (reader == NULL)
+    {
+      if (errno != 0)
+        g_printerr (_("Failed to open `%s': %s\n"),
+		    utf8_file, g_strerror(errno));
+      g_free(utf8_file);
+      return 1;
+    }
+
+  if (!unload)
+    entry_batch = g_array_new(FALSE, FALSE, sizeof(QueuedValue));
+
+  ret = xmlTextReaderRead(reader);
+  while (ret == 1)
+    {
+      const char* name;
+      int depth;
+
+      if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT)
+        {
+          ret = xmlTextReaderRead(reader);
+          continue;
+        }
+
+      name = (const char*) xmlTextReaderConstName(reader);
+      depth = xmlTextReaderDepth(reader);
+
+      if (depth == 0)
+        {
+          if (strcmp(name, "gconfentryfile") != 0)
+            {
+              g_printerr (_("Document `%s' has the wrong type of root node (<%s>, should be <%s>)\n"),
+			  utf8_file, name, "gconfentryfile");
+              retval = 1;
+              break;
+            }
+
+          seen_root = TRUE;
+          ret = xmlTextReaderRead(reader);
+        }
+      else if (depth == 1)
+        {
+          if (strcmp(name, "entrylist") == 0)
+            {
+              if (orig_base)
+                xmlFree(orig_base);
+              orig_base = xmlTextReaderGetAttribute(reader, (const xmlChar*) "base");
+
+              ret = xmlTextReaderRead(reader);
+            }
+          else
+            {
+              g_printerr (_("WARNING: node <%s> below <%s> not understood\n"),
+			  name, "gconfentryfile");
+              ret = xmlTextReaderNext(reader);
+            }
+        }
+      else if (depth == 2)
+        {
+          if (strcmp(name, "entry") == 0)
+            {
+              xmlNodePtr node;
+
+              node = xmlTextReaderExpand(reader);
+              if (node != NULL)
+                process_entry(conf, unload, node, base_dirs, (const char*) orig_base);
+            }
+          else
+            g_printerr (_("WARNING: node <%s> not understood below <%s>\n"),
+			name, "entrylist");
+
+          /* Skipping the subtree lets the reader free it */
+          ret = xmlTextReaderNext(reader);
+        }
+      else
+        ret = xmlTextReaderRead(reader);
+    }
+
+  if (ret < 0)
+    {
+      g_printerr (_("Failed to parse `%s'\n"), utf8_file);
+      retval = 1;
+    }
+  else if (retval == 0 && !seen_root)
+    {
+      g_printerr (_("Document `%s' has no top level <%s> node\n"),
+		  utf8_file, "gconfentryfile");
+      retval = 1;
+    }
+
+  if (entry_batch != NULL)
+    {
+      /* Whatever was read before an error is still set */
+      flush_entry_batch(conf);
+      g_array_free(entry_batch, TRUE);
+      entry_batch = NULL;
+    }
+
+  if (orig_base)
+    xmlFree(orig_base);
+
+  xmlFreeTextReader(reader);
+  g_free(utf8_file);
+
+  return retval;
+}
+
 static int
 do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar* file, const gchar** base_dirs)
 {
@@ -3676,8 +4000,13 @@ do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar
 
   xmlDocPtr doc;
   xmlNodePtr iter;
+  gchar *utf8_file;
+
+  if (load_type == LOAD_ENTRY_FILE)
+    return load_entry_file(conf, unload, file, base_dirs);
+
   /* file comes from the command line, is thus in locale charset */
-  gchar *utf8_file = g_locale_to_utf8 (file, -1, NULL, NULL, NULL);;
+  utf8_file = g_locale_to_utf8 (file, -1, NULL, NULL, NULL);
 
   errno = 0;
   doc = xmlParseFile(file);
@@ -3770,14 +4099,27 @@ do_makefile_install(GConfEngine* conf, const gchar** args, gboolean unload)
       return 1;
     }
 
+  if (!unload)
+    schema_batch = g_array_new(FALSE, FALSE, sizeof(QueuedValue));
+
   while (*args)
     {
       if (do_load_file(conf, LOAD_SCHEMA_FILE, unload, *args, NULL) != 0)
         return 1;
 
+      /* Each file's schemas go out as one batch */
+      if (schema_batch != NULL)
+        flush_schema_batch(conf);
+
       ++args;
     }
 
+  if (schema_batch != NULL)
+    {
+      g_array_free(schema_batch, TRUE);
+      schema_batch = NULL;
+    }
+
   return do_sync (conf);
 }
 
@@ -19,6 +19,7 @@
 
 #include <gconf/gconf.h>
 #include <gconf/gconf-internals.h>
+#include <gconf/gconf-dbus-utils.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -166,6 +167,275 @@ check_quoting(void)
 
 }
 
+static gdouble floats[] = { 0.0, -0.0, 1.0, -1.0, 3.14159, 1e-300, 1e300, G_MINDOUBLE, G_MAXDOUBLE };
+static const guint n_floats = sizeof(floats)/sizeof(floats[0]);
+
+static GSList*
+make_test_values(void)
+{
+  GSList* values = NULL;
+  GSList* list;
+  GConfValue* val;
+  GConfValue* car;
+  GConfValue* cdr;
+  GConfSchema* sc;
+  const gchar** testp;
+  guint i;
+
+  for (i = 0; i < n_ints; i++)
+    {
+      val = gconf_value_new(GCONF_VALUE_INT);
+      gconf_value_set_int(val, ints[i]);
+      values = g_slist_prepend(values, val);
+    }
+
+  for (i = 0; i < n_floats; i++)
+    {
+      val = gconf_value_new(GCONF_VALUE_FLOAT);
+      gconf_value_set_float(val, floats[i]);
+      values = g_slist_prepend(values, val);
+    }
+
+  val = gconf_value_new(GCONF_VALUE_BOOL);
+  gconf_value_set_bool(val, TRUE);
+  values = g_slist_prepend(values, val);
+
+  val = gconf_value_new(GCONF_VALUE_BOOL);
+  gconf_value_set_bool(val, FALSE);
+  values = g_slist_prepend(values, val);
+
+  list = NULL;
+  for (testp = quote_success_tests; *testp; testp++)
+    {
+      val = gconf_value_new(GCONF_VALUE_STRING);
+      gconf_value_set_string(val, *testp);
+      values = g_slist_prepend(values, val);
+
+      list = g_slist_prepend(list, gconf_value_copy(val));
+    }
+
+  val = gconf_value_new(GCONF_VALUE_LIST);
+  gconf_value_set_list_type(val, GCONF_VALUE_STRING);
+  gconf_value_set_list_nocopy(val, list);
+  values = g_slist_prepend(values, val);
+
+  val = gconf_value_new(GCONF_VALUE_LIST);
+  gconf_value_set_list_type(val, GCONF_VALUE_INT);
+  values = g_slist_prepend(values, val);
+
+  car = gconf_value_new(GCONF_VALUE_INT);
+  gconf_value_set_int(car, 42);
+  cdr = gconf_value_new(GCONF_VALUE_STRING);
+  gconf_value_set_string(cdr, "forty-two");
+  val = gconf_value_new(GCONF_VALUE_PAIR);
+  gconf_value_set_car_nocopy(val, car);
+  gconf_value_set_cdr_nocopy(val, cdr);
+
+  sc = gconf_schema_new();
+  gconf_schema_set_type(sc, GCONF_VALUE_PAIR);
+  gconf_schema_set_car_type(sc, GCONF_VALUE_INT);
+  gconf_schema_set_cdr_type(sc, GCONF_VALUE_STRING);
+  gconf_schema_set_locale(sc, "C");
+  gconf_schema_set_short_desc(sc, "Short \"description\"");
+  gconf_schema_set_long_desc(sc, "A longer description, with, commas");
+  gconf_schema_set_owner(sc, "testencode");
+  gconf_schema_set_default_value_nocopy(sc, val);
+  val = gconf_value_new(GCONF_VALUE_SCHEMA);
+  gconf_value_set_schema_nocopy(val, sc);
+  values = g_slist_prepend(values, val);
+
+  /* All strings NULL and no default */
+  val = gconf_value_new(GCONF_VALUE_SCHEMA);
+  gconf_value_set_schema_nocopy(val, gconf_schema_new());
+  values = g_slist_prepend(values, val);
+
+  return g_slist_reverse(values);
+}
+
+static void
+check_binary_codec(void)
+{
+  GSList* values;
+  GSList* tmp;
+
+  values = make_test_values();
+
+  /* Fixed seed, so failures can be reproduced */
+  srand(1);
+
+  for (tmp = values; tmp != NULL; tmp = tmp->next)
+    {
+      GConfValue* val = tmp->data;
+      GConfValue* decoded;
+      GError* error = NULL;
+      guchar* encoded;
+      guchar* reencoded;
+      guchar* mangled;
+      gsize len, relen, i;
+      gchar* str;
+
+      str = gconf_value_to_string(val);
+
+      encoded = gconf_value_encode_binary(val, &len);
+      decoded = gconf_value_decode_binary(encoded, len, &error);
+
+      check (decoded != NULL && error == NULL,
+             "failed to decode `%s': %s",
+             str, error ? error->message : "<NULL>");
+
+      check (gconf_value_compare(val, decoded) == 0,
+             "`%s' changed in a binary round trip", str);
+
+      reencoded = gconf_value_encode_binary(decoded, &relen);
+
+      check (relen == len && memcmp(encoded, reencoded, len) == 0,
+             "`%s' re-encoded differently", str);
+
+      g_free(reencoded);
+      gconf_value_free(decoded);
+
+      /* Every truncation must be rejected */
+      for (i = 0; i < len; i++)
+        {
+          decoded = gconf_value_decode_binary(encoded, i, &error);
+
+          check (decoded == NULL && error != NULL,
+                 "truncated encoding of `%s' at %u bytes decoded",
+                 str, (guint) i);
+
+          g_error_free(error);
+          error = NULL;
+        }
+
+      /* Random corruption must not crash, and anything that still
+       * decodes must be a well-formed value.
+       */
+      mangled = g_memdup(encoded, len);
+      for (i = 0; i < 200; i++)
+        {
+          mangled[rand() % len] = rand() & 0xff;
+
+          decoded = gconf_value_decode_binary(mangled, len, NULL);
+          if (decoded != NULL)
+            {
+              reencoded = gconf_value_encode_binary(decoded, &relen);
+
+              check (relen == len,
+                     "corrupted encoding of `%s' decoded to a different size",
+                     str);
+
+              g_free(reencoded);
+              gconf_value_free(decoded);
+            }
+
+          if (i % 20 == 19)
+            memcpy(mangled, encoded, len);
+        }
+
+      g_free(mangled);
+      g_free(encoded);
+      g_free(str);
+    }
+
+  g_slist_foreach(values, (GFunc)gconf_value_free, NULL);
+  g_slist_free(values);
+}
+
+/* Sends entries for each test value through a D-Bus message, as
+ * AllEntries and AllEntriesBinary replies do.
+ */
+static void
+check_dbus_entries(gboolean binary)
+{
+  GSList* values;
+  GSList* entries;
+  GSList* received;
+  GSList* tmp;
+  GSList* rtmp;
+  DBusMessage* message;
+  DBusMessageIter iter;
+  guint i;
+
+  values = make_test_values();
+
+  entries = NULL;
+  i = 0;
+  for (tmp = values; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry* entry;
+      gchar* key;
+
+      key = g_strdup_printf("key%u", i++);
+      entry = gconf_entry_new(key, tmp->data);
+      gconf_entry_set_is_default(entry, i % 2);
+      gconf_entry_set_is_writable(entry, i % 3 != 0);
+      if (i % 4 == 0)
+        gconf_entry_set_schema_name(entry, "/schemas/testencode");
+      g_free(key);
+
+      entries = g_slist_prepend(entries, entry);
+    }
+
+  /* Nothing set */
+  entries = g_slist_prepend(entries, gconf_entry_new("unset", NULL));
+
+  message = dbus_message_new_method_call("org.gnome.GConf.Test",
+                                         "/org/gnome/GConf/Test",
+                                         "org.gnome.GConf.Test",
+                                         "Test");
+  dbus_message_iter_init_append(message, &iter);
+  gconf_dbus_utils_append_entries(&iter, entries, binary);
+
+  dbus_message_iter_init(message, &iter);
+  received = gconf_dbus_utils_get_entries(&iter, "/dir", binary);
+
+  check (g_slist_length(received) == g_slist_length(entries),
+         "sent %u entries, got %u back",
+         g_slist_length(entries), g_slist_length(received));
+
+  /* Both lists come out reversed */
+  for (tmp = entries, rtmp = received;
+       tmp != NULL && rtmp != NULL;
+       tmp = tmp->next, rtmp = rtmp->next)
+    {
+      GConfEntry* sent = tmp->data;
+      GConfEntry* got = rtmp->data;
+      GConfValue* sent_value = gconf_entry_get_value(sent);
+      GConfValue* got_value = gconf_entry_get_value(got);
+      gchar* full;
+
+      full = gconf_concat_dir_and_key("/dir", gconf_entry_get_key(sent));
+
+      check (strcmp(gconf_entry_get_key(got), full) == 0,
+             "key `%s' came back as `%s'", full, gconf_entry_get_key(got));
+      check (gconf_entry_get_is_default(got) == gconf_entry_get_is_default(sent) &&
+             gconf_entry_get_is_writable(got) == gconf_entry_get_is_writable(sent),
+             "flags of `%s' changed", full);
+      check (null_safe_strcmp(gconf_entry_get_schema_name(got),
+                              gconf_entry_get_schema_name(sent)) == 0,
+             "schema name of `%s' changed", full);
+      check ((sent_value == NULL) == (got_value == NULL),
+             "`%s' came back %s a value", full,
+             got_value ? "with" : "without");
+
+      /* The text encoding may round floats, the binary one may not */
+      if (binary && sent_value != NULL && got_value != NULL)
+        check (gconf_value_compare(sent_value, got_value) == 0,
+               "value of `%s' changed", full);
+
+      g_free(full);
+    }
+
+  dbus_message_unref(message);
+
+  g_slist_foreach(received, (GFunc)gconf_entry_free, NULL);
+  g_slist_free(received);
+  g_slist_foreach(entries, (GFunc)gconf_entry_free, NULL);
+  g_slist_free(entries);
+  g_slist_foreach(values, (GFunc)gconf_value_free, NULL);
+  g_slist_free(values);
+}
+
 int 
 main (int argc, char** argv)
 {
@@ -176,6 +446,15 @@ main (int argc, char** argv)
   
   check_quoting();
 
+  printf("\nChecking binary value encoding:");
+
+  check_binary_codec();
+
+  printf("\nChecking entries sent over D-Bus:");
+
+  check_dbus_entries(FALSE);
+  check_dbus_entries(TRUE);
+
   printf("\n\n");
   
   return 0;
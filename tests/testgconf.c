@@ -51,6 +51,8 @@
 #include <unistd.h>
 #include <math.h>
 #include <locale.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <gconf/gconf-internals.h>
 
 static void
@@ -885,6 +887,194 @@ check_list_storage(GConfEngine* conf)
   check_unset(conf);
 }
 
+/* A batch with a bad key and a bad value in it still sets the rest,
+ * and reports the failure of each bad item
+ */
+static void
+check_set_values(GConfEngine* conf)
+{
+  const gchar* batch_keys[4];
+  GConfValue* batch_values[4];
+  GError* errors[4] = { NULL, NULL, NULL, NULL };
+  guint i;
+
+  batch_keys[0] = keys[0];
+  batch_keys[1] = "/testing/bad key";
+  batch_keys[2] = keys[1];
+  batch_keys[3] = keys[2];
+
+  for (i = 0; i < G_N_ELEMENTS (batch_values); i++)
+    {
+      batch_values[i] = gconf_value_new(GCONF_VALUE_INT);
+      gconf_value_set_int(batch_values[i], i + 1);
+    }
+
+  /* Not UTF-8 */
+  gconf_value_free(batch_values[2]);
+  batch_values[2] = gconf_value_new(GCONF_VALUE_STRING);
+  gconf_value_set_string(batch_values[2], "bad \377 value");
+
+  check (!gconf_engine_set_values(conf, batch_keys, batch_values,
+                                  G_N_ELEMENTS (batch_keys), errors),
+         "a batch with bad items reports a failure");
+
+  check (errors[0] == NULL && errors[3] == NULL,
+         "valid items of a batch don't fail");
+  check (errors[1] != NULL && errors[1]->code == GCONF_ERROR_BAD_KEY,
+         "the invalid key of a batch is reported");
+  check (errors[2] != NULL,
+         "the invalid value of a batch is reported");
+
+  check (gconf_engine_get_int(conf, keys[0], NULL) == 1 &&
+         gconf_engine_get_int(conf, keys[2], NULL) == 4,
+         "valid items of a batch are set despite the bad ones");
+
+  for (i = 0; i < G_N_ELEMENTS (batch_values); i++)
+    {
+      gconf_value_free(batch_values[i]);
+      if (errors[i] != NULL)
+        g_error_free(errors[i]);
+    }
+
+  check_unset(conf);
+}
+
+static void
+remove_tree(const char* path)
+{
+  GDir* dir;
+  const char* name;
+
+  dir = g_dir_open(path, 0, NULL);
+  if (dir == NULL)
+    {
+      unlink(path);
+      return;
+    }
+
+  while ((name = g_dir_read_name(dir)) != NULL)
+    {
+      char* child;
+
+      child = g_build_filename(path, name, NULL);
+      remove_tree(child);
+      g_free(child);
+    }
+  g_dir_close(dir);
+
+  rmdir(path);
+}
+
+/* Have the daemon refuse one key of a batch: it's set in a read-only
+ * source stacked above the writable one.
+ */
+static void
+check_set_values_refused(void)
+{
+  const gchar* batch_keys[3] = {
+    "/testing/batch/a",
+    "/testing/batch/locked",
+    "/testing/batch/b"
+  };
+  GConfValue* batch_values[3];
+  GError* errors[3] = { NULL, NULL, NULL };
+  GError* err = NULL;
+  GConfEngine* local;
+  GConfEngine* conf;
+  GSList* addresses;
+  gchar* locked_dir;
+  gchar* user_dir;
+  gchar* address;
+  guint i;
+
+  locked_dir = g_strdup_printf("%s/testgconf-locked-%d",
+                               g_get_tmp_dir(), (int) getpid());
+  user_dir = g_strdup_printf("%s/testgconf-user-%d",
+                             g_get_tmp_dir(), (int) getpid());
+  check (mkdir(locked_dir, 0700) == 0 && mkdir(user_dir, 0700) == 0,
+         "create the source directories");
+
+  address = g_strconcat("xml:readwrite:", locked_dir, NULL);
+  local = gconf_engine_get_local(address, &err);
+  check (local != NULL, "create a local engine for %s", address);
+  g_free(address);
+
+  gconf_engine_set_int(local, batch_keys[1], 42, &err);
+  check (err == NULL, "set the locked key");
+  gconf_engine_suggest_sync(local, &err);
+  check (err == NULL, "sync the locked source");
+  gconf_engine_unref(local);
+
+  addresses = g_slist_append(NULL,
+                             g_strconcat("xml:readonly:", locked_dir, NULL));
+  addresses = g_slist_append(addresses,
+                             g_strconcat("xml:readwrite:", user_dir, NULL));
+  conf = gconf_engine_get_for_addresses(addresses, &err);
+  check (conf != NULL, "create an engine for the stacked sources");
+  g_slist_foreach(addresses, (GFunc) g_free, NULL);
+  g_slist_free(addresses);
+
+  for (i = 0; i < G_N_ELEMENTS (batch_values); i++)
+    {
+      batch_values[i] = gconf_value_new(GCONF_VALUE_INT);
+      gconf_value_set_int(batch_values[i], i + 1);
+    }
+
+  check (!gconf_engine_set_values(conf, batch_keys, batch_values,
+                                  G_N_ELEMENTS (batch_keys), errors),
+         "a batch with a refused item reports a failure");
+
+  check (errors[0] == NULL && errors[2] == NULL,
+         "items of a batch the daemon accepts don't fail");
+  check (errors[1] != NULL && errors[1]->code == GCONF_ERROR_OVERRIDDEN,
+         "the item of a batch the daemon refuses is reported as overridden");
+
+  check (gconf_engine_get_int(conf, batch_keys[0], NULL) == 1 &&
+         gconf_engine_get_int(conf, batch_keys[1], NULL) == 42 &&
+         gconf_engine_get_int(conf, batch_keys[2], NULL) == 3,
+         "accepted items of a batch are set, the refused one is kept");
+
+  for (i = 0; i < G_N_ELEMENTS (batch_values); i++)
+    {
+      gconf_value_free(batch_values[i]);
+      if (errors[i] != NULL)
+        g_error_free(errors[i]);
+    }
+
+  gconf_engine_unref(conf);
+
+  remove_tree(locked_dir);
+  remove_tree(user_dir);
+  g_free(locked_dir);
+  g_free(user_dir);
+}
+
+static const char *valid_keys[] = {
+  "/",
+  "/foo",
+  "/foo/bar",
+  "/foo.bar/baz",
+  "/a/b/c/d/e/f_g-h@i"
+};
+
+static const char *invalid_keys[] = {
+  "",
+  "foo",
+  "//",
+  "/foo/",
+  "/foo//bar",
+  "/.foo",
+  "/foo/.bar",
+  "/foo bar",
+  "/foo$bar",
+  "/foo\\bar",
+  "/foo\tbar",
+  "/foo;bar",
+  "/foo%bar",
+  "/foo~bar",
+  "/foo\200bar"
+};
+
 static void
 check_utils (void)
 {
@@ -929,6 +1119,58 @@ check_utils (void)
       
       ++i;
     }  
+
+  i = 0;
+  while (i < G_N_ELEMENTS (valid_keys))
+    {
+      check (gconf_valid_key (valid_keys[i], NULL),
+             "Key '%s' is valid", valid_keys[i]);
+      ++i;
+    }
+
+  i = 0;
+  while (i < G_N_ELEMENTS (invalid_keys))
+    {
+      char *why = NULL;
+
+      check (!gconf_valid_key (invalid_keys[i], &why),
+             "Key '%s' is invalid", invalid_keys[i]);
+      check (why != NULL,
+             "Got a reason why key '%s' is invalid", invalid_keys[i]);
+      g_free (why);
+      ++i;
+    }
+}
+
+static void
+check_key_atoms (void)
+{
+  const GConfKeyAtom *atom;
+  const GConfKeyAtom *other;
+
+  atom = gconf_key_atom_intern ("/testgconf/atoms/key");
+  check (atom != NULL && strcmp (atom->full_name, "/testgconf/atoms/key") == 0,
+         "Interned key has the right name");
+  check (strcmp (atom->name, "key") == 0,
+         "Interned key has the right last component");
+  check (gconf_key_atom_lookup ("/testgconf/atoms") == atom->parent,
+         "Parent directory of an interned key is interned");
+
+  other = gconf_key_atom_intern ("/testgconf/atoms/key");
+  check (other == atom, "Interning a key twice gives the same atom");
+  gconf_key_atom_unref (other);
+
+  check (gconf_key_atom_lookup ("/testgconf/atoms/key") == atom,
+         "Atom is kept while a reference is held");
+
+  gconf_key_atom_unref (atom);
+
+  check (gconf_key_atom_lookup ("/testgconf/atoms/key") == NULL,
+         "Atom is freed with its last reference");
+  check (gconf_key_atom_lookup ("/testgconf/atoms") == NULL,
+         "Parent atom is freed with its last child");
+  check (gconf_key_atom_lookup ("/testgconf") == NULL,
+         "Ancestor atoms are freed with their last child");
 }
 
 int 
@@ -956,6 +1198,7 @@ main (int argc, char** argv)
     }
 
   check_utils ();
+  check_key_atoms ();
   
   conf = gconf_engine_get_default();
 
@@ -981,6 +1224,12 @@ main (int argc, char** argv)
   
   check_bool_storage(conf);
 
+  printf("\nChecking batch sets:");
+
+  check_set_values(conf);
+
+  check_set_values_refused();
+
   gconf_engine_set_bool(conf, "/foo", TRUE, &err);
 
   gconf_engine_unref(conf);
@@ -0,0 +1,227 @@
+/* GConf
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Edits a markup source's %gconf.xml behind the backend's back and
+ * checks that the change is reported through the notify func. The
+ * edit keeps the file size and lands within a second of the backend's
+ * own write, so only the sub-second mtime tells the two apart.
+ */
+
+#include <gconf/gconf-backend.h>
+#include <gconf/gconf-internals.h>
+#include <gconf/gconf.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define TIMEOUT_MSEC 5000
+
+static GMainLoop *loop = NULL;
+static gboolean notified = FALSE;
+
+static void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      g_printerr ("Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+static void
+source_notify (GConfSource *source,
+               const gchar *location,
+               gpointer     user_data)
+{
+  if (strcmp (location, "/test/key") == 0)
+    {
+      notified = TRUE;
+      g_main_loop_quit (loop);
+    }
+}
+
+static gboolean
+timeout_cb (gpointer data)
+{
+  g_main_loop_quit (loop);
+
+  return FALSE;
+}
+
+static void
+set_int (GConfSource *source,
+         const char  *key,
+         int          i)
+{
+  GConfValue *value;
+  GError *error;
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, i);
+
+  error = NULL;
+  (* source->backend->vtable.set_value) (source, key, value, &error);
+  exit_if_error (error);
+
+  gconf_value_free (value);
+
+  error = NULL;
+  (* source->backend->vtable.sync_all) (source, &error);
+  exit_if_error (error);
+}
+
+/* Rewrite the file in place, without a rename, so the inode stays
+ * the same too
+ */
+static void
+edit_in_place (const char *filename,
+               const char *old_text,
+               const char *new_text)
+{
+  GError *error;
+  char *contents;
+  char *p;
+  FILE *f;
+
+  g_assert (strlen (old_text) == strlen (new_text));
+
+  error = NULL;
+  g_file_get_contents (filename, &contents, NULL, &error);
+  exit_if_error (error);
+
+  p = strstr (contents, old_text);
+  if (p == NULL)
+    {
+      g_printerr ("\"%s\" not found in %s\n", old_text, filename);
+      exit (1);
+    }
+  memcpy (p, new_text, strlen (new_text));
+
+  f = fopen (filename, "r+");
+  if (f == NULL ||
+      fwrite (contents, 1, strlen (contents), f) != strlen (contents) ||
+      fclose (f) != 0)
+    {
+      g_printerr ("Failed to rewrite %s: %s\n", filename, g_strerror (errno));
+      exit (1);
+    }
+
+  g_free (contents);
+}
+
+static void
+remove_tree (const char *path)
+{
+  GDir *dir;
+  const char *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    {
+      unlink (path);
+      return;
+    }
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      char *child;
+
+      child = g_build_filename (path, name, NULL);
+      remove_tree (child);
+      g_free (child);
+    }
+  g_dir_close (dir);
+
+  rmdir (path);
+}
+
+int
+main (int argc, char **argv)
+{
+  GConfSource *source;
+  GError *error;
+  char *dirname;
+  char *address;
+  char *filename;
+
+  dirname = g_strdup_printf ("%s/testmarkupnotify-%d",
+                             g_get_tmp_dir (), (int) getpid ());
+  if (mkdir (dirname, 0700) < 0)
+    {
+      g_printerr ("Failed to create %s: %s\n", dirname, g_strerror (errno));
+      return 1;
+    }
+
+  address = g_strconcat ("xml:readwrite:", dirname, NULL);
+
+  error = NULL;
+  source = gconf_resolve_address (address, &error);
+  exit_if_error (error);
+
+  if (source->backend->vtable.set_notify_func == NULL)
+    {
+      g_printerr ("Markup backend doesn't support notification\n");
+      return 1;
+    }
+
+  (* source->backend->vtable.set_notify_func) (source, source_notify, NULL);
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  /* The events for our own write are already queued; they must not
+   * be reported
+   */
+  set_int (source, "/test/key", 1);
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+  if (notified)
+    {
+      g_printerr ("Own write was reported as an external change\n");
+      remove_tree (dirname);
+      return 1;
+    }
+
+  filename = g_build_filename (dirname, "test", "%gconf.xml", NULL);
+  edit_in_place (filename, "value=\"1\"", "value=\"2\"");
+
+  g_timeout_add (TIMEOUT_MSEC, timeout_cb, NULL);
+  g_main_loop_run (loop);
+
+  if (!notified)
+    {
+      g_printerr ("No notification for an external edit of %s\n", filename);
+      remove_tree (dirname);
+      return 1;
+    }
+
+  gconf_source_free (source);
+  remove_tree (dirname);
+
+  g_main_loop_unref (loop);
+  g_free (filename);
+  g_free (address);
+  g_free (dirname);
+
+  return 0;
+}